@@ -0,0 +1,97 @@
+package paralign;
+
+import java.io.BufferedReader;
+import java.io.FileReader;
+import java.io.IOException;
+import java.util.Arrays;
+
+import org.apache.hadoop.conf.Configuration;
+
+/**
+ * Assignment of keys to reducers written by pa-partition (see
+ * src/partition.h): keys listed in the file go to their part and all
+ * others to key % parts. Shard i of a sharded row has the key
+ * FIRST_SHARD_KEY - i and the part of its "shard" line.
+ */
+public class PartitionMap {
+  /** Job setting naming the map file, e.g. one shipped with -files */
+  public static final String KEY = "paralign.partition.map";
+
+  /** Key of the first row shard; the others count down from here */
+  public static final int FIRST_SHARD_KEY = -1000;
+
+  private int parts;
+  private short[] partOf = new short[0];
+  private short[] shardPart = new short[0];
+  private int shards = 0;
+
+  /** The map named by KEY in conf, or null when unset */
+  public static PartitionMap fromConf(Configuration conf) {
+    String path = conf.get(KEY, "");
+    if (path.isEmpty())
+      return null;
+    try {
+      return new PartitionMap(path);
+    } catch (IOException e) {
+      throw new RuntimeException("Cannot read partition map " + path, e);
+    }
+  }
+
+  public PartitionMap(String path) throws IOException {
+    BufferedReader in = new BufferedReader(new FileReader(path));
+    try {
+      String line = in.readLine();
+      String[] fields = line == null ? new String[0] : line.trim().split("\\s+");
+      if (fields.length != 2 || !fields[0].equals("parts"))
+        throw new IOException("Missing \"parts N\" header in " + path);
+      parts = Integer.parseInt(fields[1]);
+      int lastShardRow = -1;
+      while ((line = in.readLine()) != null) {
+        line = line.trim();
+        if (line.isEmpty())
+          continue;
+        fields = line.split("\\s+");
+        boolean shard = fields[0].equals("shard");
+        if (fields.length != (shard ? 4 : 2))
+          throw new IOException("Invalid line in " + path + ": " + line);
+        int key = Integer.parseInt(fields[shard ? 1 : 0]);
+        short part = Short.parseShort(fields[shard ? 3 : 1]);
+        if (key < 0 || part < 0 || part >= parts)
+          throw new IOException("Invalid line in " + path + ": " + line);
+        if (shard) {
+          if (shards == shardPart.length)
+            shardPart = Arrays.copyOf(shardPart, Math.max(16, shards * 2));
+          shardPart[shards++] = part;
+          // A sharded row's own key goes with its first shard
+          if (key == lastShardRow)
+            continue;
+          lastShardRow = key;
+        }
+        if (key >= partOf.length) {
+          int size = partOf.length;
+          partOf = Arrays.copyOf(partOf, Math.max(key + 1, size * 2));
+          Arrays.fill(partOf, size, partOf.length, (short) -1);
+        }
+        partOf[key] = part;
+      }
+    } finally {
+      in.close();
+    }
+  }
+
+  public int getPartition(int key, int numPartitions) {
+    if (numPartitions != parts)
+      throw new IllegalStateException("Partition map is for " + parts + " reducers, not " + numPartitions);
+    if (key >= 0 && key < partOf.length && partOf[key] >= 0)
+      return partOf[key];
+    if (key <= FIRST_SHARD_KEY && FIRST_SHARD_KEY - key < shards)
+      return shardPart[FIRST_SHARD_KEY - key];
+    return defaultPartition(key, numPartitions);
+  }
+
+  public static int defaultPartition(int key, int numPartitions) {
+    int p = key % numPartitions;
+    if (p < 0) p += numPartitions;
+    return p;
+  }
+}
@@ -3,12 +3,16 @@ package paralign;
 import org.apache.hadoop.io.Text;
 
 public class Partitioner1 implements org.apache.hadoop.mapred.Partitioner<Text, Text> {
+  private PartitionMap map;
+
   public int getPartition(Text key, Text value, int numPartitions) {
-    int p = Integer.parseInt(key.toString()) % numPartitions;
-    if (p < 0) p += numPartitions;
-    return p;
+    int k = Integer.parseInt(key.toString());
+    if (map != null)
+      return map.getPartition(k, numPartitions);
+    return PartitionMap.defaultPartition(k, numPartitions);
   }
 
   public void configure(org.apache.hadoop.mapred.JobConf job) {
+    map = PartitionMap.fromConf(job);
   }
 }
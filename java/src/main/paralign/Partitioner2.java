@@ -1,11 +1,26 @@
 package paralign;
 
+import org.apache.hadoop.conf.Configurable;
+import org.apache.hadoop.conf.Configuration;
 import org.apache.hadoop.io.Text;
 
-public class Partitioner2 extends org.apache.hadoop.mapreduce.Partitioner<Text, Text> {
+public class Partitioner2 extends org.apache.hadoop.mapreduce.Partitioner<Text, Text> implements Configurable {
+  private Configuration conf;
+  private PartitionMap map;
+
   public int getPartition(Text key, Text value, int numPartitions) {
-    int p = Integer.parseInt(key.toString()) % numPartitions;
-    if (p < 0) p += numPartitions;
-    return p;
+    int k = Integer.parseInt(key.toString());
+    if (map != null)
+      return map.getPartition(k, numPartitions);
+    return PartitionMap.defaultPartition(k, numPartitions);
+  }
+
+  public void setConf(Configuration conf) {
+    this.conf = conf;
+    map = PartitionMap.fromConf(conf);
+  }
+
+  public Configuration getConf() {
+    return conf;
   }
 }
@@ -0,0 +1,94 @@
+#!/bin/bash
+# Times every stage of the local pipeline (as run by test-run.bash) on a
+# synthetic Zipfian corpus. Run by `make bench`.
+#
+# Usage: pa-bench.bash BUILD_DIR
+#
+# SENTENCES (default 50000), VOCAB (50000), LENGTH (20), SPLITS (4),
+# PARTS (2) and ITERS (2) set the size of the run; WORKDIR (a temporary
+# directory by default) is removed afterwards unless KEEP=yes.
+
+[ "x$1" != x ] || { echo "Usage: $0 BUILD_DIR"; exit 1; }
+BIN=`readlink -f "$1"`
+SRC=`dirname "$0"`
+SRC=`readlink -f "$SRC/.."`
+
+for i in pa-synth pa-mapper pa-shuffle pa-combiner pa-reducer pa-diagonal pa-viterbi; do
+    [ -x "$BIN/$i" ] || { echo "Cannot find $i under $BIN!"; exit 1; }
+done
+
+SENTENCES=${SENTENCES:-50000}
+VOCAB=${VOCAB:-50000}
+LENGTH=${LENGTH:-20}
+SPLITS=${SPLITS:-4}
+PARTS=${PARTS:-2}
+ITERS=${ITERS:-2}
+
+set -e
+
+if [ "x$WORKDIR" = x ]; then
+    WORKDIR=`mktemp -d "${TMPDIR:-/tmp}/pa-bench.XXXXXX"`
+fi
+[ "$KEEP" = yes ] || trap 'rm -rf "$WORKDIR"' EXIT
+
+declare -A SECONDS_OF
+STAGES=""
+
+# Runs "$@" and adds its wall time to stage $1
+stage() {
+    local name=$1 start=`date +%s%N`
+    shift
+    "$@"
+    local end=`date +%s%N`
+    [ "x${SECONDS_OF[$name]}" != x ] || STAGES="$STAGES $name"
+    SECONDS_OF[$name]=$(( ${SECONDS_OF[$name]:-0} + end - start ))
+}
+
+stage synth sh -c "\"$BIN/pa-synth\" corpus -n $SENTENCES -v $VOCAB -l $LENGTH > \"$WORKDIR/corpus\""
+mkdir -p "$WORKDIR/input"
+split -n l/$SPLITS -d "$WORKDIR/corpus" "$WORKDIR/input/part-"
+
+export pa_ttable_parts=$PARTS
+export pa_ttable_dir=$WORKDIR/0000
+export pa_size_counts_file=$WORKDIR/size_counts
+mkdir -p "$WORKDIR/0000"
+for j in `seq 0 $(($PARTS-1))`; do
+    touch "$WORKDIR/0000/entry.$j" "$WORKDIR/0000/index.$j"
+done
+
+for i in `seq $ITERS`; do
+    CUR="$WORKDIR/`printf %04d $i`"
+    mkdir -p "$CUR"
+    if [ "$i" -eq 1 ]; then
+	export pa_emit_size_counts=yes pa_optimize_tension=no
+    else
+	export pa_emit_size_counts=no pa_optimize_tension=yes
+    fi
+    for j in "$WORKDIR/input/"*; do
+	TASK=`basename "$j"`
+	stage mapper sh -c "\"$BIN/pa-mapper\" < \"$j\" > \"$CUR/map.$TASK.out\" 2> \"$CUR/map.$TASK.err\""
+    done
+    stage shuffle sh -c "\"$BIN/pa-shuffle\" -n $PARTS -o \"$CUR/part.%d.out\" -T \"$CUR\" \"$CUR/map.\"*.out 2> \"$CUR/part.err\""
+    for j in `seq 0 $(($PARTS-1))`; do
+	stage combiner sh -c "\"$BIN/pa-combiner\" < \"$CUR/part.$j.out\" > \"$CUR/combine.$j.out\" 2> \"$CUR/combine.$j.err\""
+	stage shuffle sh -c "\"$BIN/pa-shuffle\" -T \"$CUR\" \"$CUR/combine.$j.out\" > \"$CUR/sorted.$j.out\" 2> \"$CUR/shuffle.$j.err\""
+	stage reducer sh -c "mapreduce_task_output_dir=\"$CUR\" mapreduce_task_partition=$j \"$BIN/pa-reducer\" < \"$CUR/sorted.$j.out\" > \"$CUR/reduce.$j.out\" 2> \"$CUR/reduce.$j.err\""
+    done
+    stage shuffle sh -c "\"$BIN/pa-shuffle\" -T \"$CUR\" \"$CUR/reduce.\"*.out > \"$CUR/stats.out\" 2> \"$CUR/shuffle.err\""
+    stage diagonal sh -c "\"$BIN/pa-diagonal\" < \"$CUR/stats.out\" > \"$CUR/diagonal.out\" 2> \"$CUR/diagonal.err\""
+    export pa_ttable_dir=$CUR
+    if [ "$i" -gt 1 ]; then
+	export pa_diagonal_tension=`cat "$CUR/diagonal.out"`
+    fi
+done
+stage viterbi sh -c "\"$BIN/pa-viterbi\" < \"$WORKDIR/corpus\" > \"$WORKDIR/viterbi.out\" 2> \"$WORKDIR/viterbi.err\""
+
+echo "pa-bench: $SENTENCES sentences, vocabulary $VOCAB, $ITERS iterations, $PARTS parts"
+grep perplexity "$CUR/diagonal.err" || true
+TOTAL=0
+for s in $STAGES; do
+    NS=${SECONDS_OF[$s]}
+    TOTAL=$(( TOTAL + NS ))
+    printf "%-10s %10.3f s\n" $s `echo "$NS" | awk '{ print $1 / 1e9 }'`
+done
+printf "%-10s %10.3f s\n" total `echo "$TOTAL" | awk '{ print $1 / 1e9 }'`
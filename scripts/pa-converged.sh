@@ -0,0 +1,31 @@
+#!/bin/sh
+# Exits with status 0 if the last iteration converged, given the
+# convergence records pa-diagonal wrote for the iteration before
+# (PREVIOUS) and the last one (LAST): every direction improved its
+# perplexity by less than PERPLEXITY (relative) or moved its table by
+# less than CHANGE per row. Used by pa-hadoop.bash and test-run.bash.
+#
+# Usage: pa-converged.sh [-p PERPLEXITY] [-c CHANGE] PREVIOUS LAST
+
+PPL=
+CHANGE=
+while getopts "p:c:" OPT; do
+    case $OPT in
+	p) PPL=$OPTARG ;;
+	c) CHANGE=$OPTARG ;;
+	*) echo "Usage: $0 [-p PERPLEXITY] [-c CHANGE] PREVIOUS LAST" 1>&2; exit 2 ;;
+    esac
+done
+shift `expr $OPTIND - 1`
+[ $# -eq 2 ] || { echo "Usage: $0 [-p PERPLEXITY] [-c CHANGE] PREVIOUS LAST" 1>&2; exit 2; }
+
+awk -F'\t' -v ppl="$PPL" -v change="$CHANGE" '
+    FNR == 1 { next }
+    NR == FNR { prev[$1] = $4; next }
+    {
+	n++
+	if ((ppl != "" && ($1 in prev) && (prev[$1] - $4) / prev[$1] < ppl + 0) ||
+	    (change != "" && $5 != "-" && $5 + 0 < change + 0))
+	    done++
+    }
+    END { exit !(n > 0 && done == n) }' "$1" "$2"
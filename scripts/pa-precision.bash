@@ -0,0 +1,141 @@
+#!/bin/bash
+# Checks that computing posteriors in float (pa_compute_precision=float)
+# trains the same model as double: trains with test-run.bash once in
+# each precision on a reference corpus, then compares the perplexity of
+# every iteration and the Viterbi alignments of the final models. Run
+# by `make precision`.
+#
+# Usage: pa-precision.bash BUILD_DIR
+#
+# BUILD_DIR holds the programs and the configured scripts/test-run.bash.
+# CORPUS is the reference corpus in the pa-mapper input format (by
+# default a synthetic Zipfian one of SENTENCES sentences, 20000 by
+# default); SPLITS (default 4), PARTS (2) and ITERS (5) set the size of
+# the run. Fails if perplexity differs by more than MAX_PERPLEXITY_DIFF
+# (relative, default 0.001) in any iteration, or if fewer than
+# MIN_AGREEMENT (default 0.99) of the alignment links agree. VB and
+# pa_* variables, pa_bidirectional included, apply to both runs as they
+# do to test-run.bash.
+# WORKDIR (a temporary directory by default) is removed afterwards
+# unless KEEP=yes.
+
+[ "x$1" != x ] || { echo "Usage: $0 BUILD_DIR"; exit 1; }
+BIN=`readlink -f "$1"`
+BASE=`readlink -f "$0"`
+BASE=`dirname "$BASE"`
+TEST_RUN=$BIN/scripts/test-run.bash
+
+for i in pa-synth pa-mapper pa-shuffle pa-combiner pa-reducer pa-diagonal pa-viterbi; do
+    [ -x "$BIN/$i" ] || { echo "Cannot find $i under $BIN!"; exit 1; }
+done
+[ -f "$TEST_RUN" ] || { echo "Cannot find $TEST_RUN; run configure first"; exit 1; }
+
+SENTENCES=${SENTENCES:-20000}
+SPLITS=${SPLITS:-4}
+export PARTS=${PARTS:-2}
+export ITERS=${ITERS:-5}
+MAX_PERPLEXITY_DIFF=${MAX_PERPLEXITY_DIFF:-0.001}
+MIN_AGREEMENT=${MIN_AGREEMENT:-0.99}
+
+set -e
+
+if [ "x$WORKDIR" = x ]; then
+    WORKDIR=`mktemp -d "${TMPDIR:-/tmp}/pa-precision.XXXXXX"`
+fi
+mkdir -p "$WORKDIR"
+[ "$KEEP" = yes ] || trap 'rm -rf "$WORKDIR"' EXIT
+
+if [ "x$CORPUS" = x ]; then
+    CORPUS=$WORKDIR/corpus
+    "$BIN/pa-synth" corpus -n $SENTENCES > "$CORPUS"
+fi
+export INPUT=$WORKDIR/input
+mkdir -p "$INPUT"
+split -n l/$SPLITS -d "$CORPUS" "$INPUT/part-"
+
+# test-run.bash takes the programs from the build directory, and
+# pa-converged.sh from the source one
+export LIBEXEC=$WORKDIR/libexec
+mkdir -p "$LIBEXEC"
+for i in pa-mapper pa-shuffle pa-combiner pa-reducer pa-diagonal pa-viterbi; do
+    ln -sf "$BIN/$i" "$LIBEXEC/$i"
+done
+ln -sf "$BASE/pa-converged.sh" "$LIBEXEC/pa-converged.sh"
+
+# Trains all ITERS iterations in precision $1 under $WORKDIR/$1 and
+# aligns the corpus with the final model
+train() (
+    local DIR=$WORKDIR/$1
+    export pa_compute_precision=$1
+    WORKDIR=$DIR CONVERGE_PERPLEXITY= CONVERGE_CHANGE= bash "$TEST_RUN" > "$DIR.log" 2>&1 ||
+	{ echo "test-run.bash failed in $1, see $DIR.log"; exit 1; }
+    local LAST=$DIR/`printf %04d $ITERS`
+    # The reverse tension is on the second line with pa_bidirectional
+    local REVERSE_TENSION=`sed -n 2p "$LAST/diagonal.out"`
+    if [ "x$REVERSE_TENSION" != x ]; then
+	export pa_reverse_diagonal_tension=$REVERSE_TENSION
+    fi
+    pa_ttable_parts=$PARTS pa_ttable_dir=$LAST pa_diagonal_tension=`sed -n 1p "$LAST/diagonal.out"` "$BIN/pa-viterbi" \
+	< "$CORPUS" > "$DIR/viterbi.out" 2> "$DIR/viterbi.err"
+)
+
+train double
+train float
+
+echo "pa-precision: `wc -l < "$CORPUS"` sentences, $ITERS iterations"
+FAILED=no
+printf "%-6s %14s %14s %12s\n" iter double float difference
+for i in `seq $ITERS`; do
+    ITER=`printf %04d $i`
+    # Perplexity of every direction, from the convergence records
+    if ! paste "$WORKDIR/double/$ITER/convergence.out" "$WORKDIR/float/$ITER/convergence.out" |
+	awk -F'\t' -v iter=$i -v max="$MAX_PERPLEXITY_DIFF" '
+	    NR == 1 { next }
+	    {
+		d = ($4 - $9) / $4
+		if (d < 0) d = -d
+		printf "%-6s %14.6g %14.6g %12.3g%s\n", iter ($1 == "reverse" ? "r" : ""), $4, $9, d,
+		    (d > max + 0 ? "  FAILED" : "")
+		if (d > max + 0) bad = 1
+	    }
+	    END { exit bad }'; then
+	FAILED=yes
+    fi
+done
+
+# Links of each sentence in either alignment, and those in both
+if ! paste -d '\n' "$WORKDIR/double/viterbi.out" "$WORKDIR/float/viterbi.out" |
+    awk -F'\t' -v min="$MIN_AGREEMENT" '
+	NR % 2 == 1 {
+	    delete links
+	    for (t = 2; t <= NF; ++t) {
+		n = split($t, a, " ")
+		for (k = 1; k <= n; ++k) links[t ":" a[k]] = 1
+		total += n
+	    }
+	    line = $0
+	    next
+	}
+	{
+	    for (t = 2; t <= NF; ++t) {
+		n = split($t, a, " ")
+		for (k = 1; k <= n; ++k) common += links[t ":" a[k]] == 1
+		total += n
+	    }
+	    same += $0 == line
+	    sentences++
+	}
+	END {
+	    agreement = total ? 2 * common / total : 1
+	    printf "viterbi: %.4f of links agree, %.4f of sentences aligned the same%s\n",
+		agreement, same / sentences, (agreement < min + 0 ? "  FAILED" : "")
+	    exit agreement < min + 0
+	}'; then
+    FAILED=yes
+fi
+
+if [ $FAILED = yes ]; then
+    echo "pa-precision: float differs from double beyond MAX_PERPLEXITY_DIFF=$MAX_PERPLEXITY_DIFF or MIN_AGREEMENT=$MIN_AGREEMENT"
+    exit 1
+fi
+echo "pa-precision: OK"
@@ -0,0 +1,17 @@
+#!/bin/sh
+# Runs a streaming reducer that writes translation table pieces (e.g.
+# pa-reducer) with the pieces going to a local directory, then copies
+# them to the task output directory, which Hadoop commits along with
+# the task. This keeps libhdfs and its JVM out of the reducer; the copy
+# still starts a `hadoop fs` JVM, once per task, after the reducer has
+# exited.
+#
+# Usage: pa-reduce.sh COMMAND [ARG]...
+
+test "$mapreduce_task_output_dir" || { echo "Cannot read mapreduce_task_output_dir from env; are you using hadoop?" 1>&2; exit 1; }
+
+OUT=`mktemp -d "$PWD/ttable.XXXXXX"` || exit 1
+trap 'rm -rf "$OUT"' EXIT
+
+pa_ttable_output_dir=$OUT "$@" || exit 1
+hadoop fs -put "$OUT"/* "$mapreduce_task_output_dir/" || exit 1
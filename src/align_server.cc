@@ -0,0 +1,308 @@
+// pa-align-server: loads the translation table once and answers
+// Viterbi alignment requests until killed.
+//
+// Usage: pa-align-server [-s SOCKET] [-j THREADS] [-b BATCH]
+//
+// Each request is a line in the pa-mapper input format
+// (`id\tsrc words\ttgt words`), each reply a line in the pa-viterbi
+// output format (`id\talignment`), in request order. Requests are read
+// from stdin and answered on stdout, or, with `-s`, from every
+// connection to a Unix socket at SOCKET. Lines that arrive together
+// are aligned as a batch; batches from all connections are shared by
+// THREADS workers. The request `STATS` is answered with the latency
+// percentiles and throughput so far. Model options come from the
+// environment as usual (`pa_ttable_dir`, `pa_diagonal_tension`, ...).
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/utility.hpp>
+
+#include "io.h"
+#include "options.h"
+#include "pipeline.h"
+#include "ttable.h"
+#include "types.h"
+#include "viterbi.h"
+#include "contrib/log.h"
+
+using namespace std;
+
+namespace paralign {
+// Request latencies (from arrival to reply) and throughput
+class LatencyStats : boost::noncopyable {
+ public:
+  static const size_t kMaxSamples = 1 << 20;
+
+  LatencyStats() : start_(WallTime()), count_(0) {}
+
+  void Add(double latency) {
+    boost::lock_guard<boost::mutex> lock(mu_);
+    if (samples_.size() < kMaxSamples)
+      samples_.push_back(latency);
+    else
+      samples_[count_ % kMaxSamples] = latency;
+    ++count_;
+  }
+
+  string Summary() {
+    vector<double> samples;
+    size_t count;
+    {
+      boost::lock_guard<boost::mutex> lock(mu_);
+      samples = samples_;
+      count = count_;
+    }
+    ostringstream out;
+    out << "requests=" << count
+        << " p50_ms=" << Percentile(&samples, 0.5) * 1000
+        << " p99_ms=" << Percentile(&samples, 0.99) * 1000
+        << " per_sec=" << count / (WallTime() - start_);
+    return out.str();
+  }
+
+ private:
+  static double Percentile(vector<double> *samples, double q) {
+    if (samples->empty())
+      return 0;
+    vector<double>::iterator nth = samples->begin() + static_cast<size_t>(q * (samples->size() - 1));
+    nth_element(samples->begin(), nth, samples->end());
+    return *nth;
+  }
+
+  const double start_;
+  vector<double> samples_;
+  size_t count_;
+  boost::mutex mu_;
+};
+
+// Reads lines from a file descriptor, handing out whatever complete
+// lines are already available in one go.
+class LineReader : boost::noncopyable {
+ public:
+  explicit LineReader(int fd) : fd_(fd), eof_(false) {}
+
+  // Blocks until at least one line is available; false on end of input
+  bool ReadBatch(size_t max_lines, vector<string> *lines) {
+    lines->clear();
+    for (;;) {
+      size_t begin = 0, end;
+      while (lines->size() < max_lines && (end = buf_.find('\n', begin)) != string::npos) {
+        lines->push_back(buf_.substr(begin, end - begin));
+        begin = end + 1;
+      }
+      buf_.erase(0, begin);
+      if (!lines->empty())
+        return true;
+      if (eof_) {
+        if (buf_.empty())
+          return false;
+        lines->push_back(buf_);
+        buf_.clear();
+        return true;
+      }
+      char chunk[1 << 16];
+      ssize_t r = read(fd_, chunk, sizeof(chunk));
+      if (r < 0 && errno == EINTR)
+        continue;
+      if (r <= 0)
+        eof_ = true;
+      else
+        buf_.append(chunk, r);
+    }
+  }
+
+ private:
+  const int fd_;
+  bool eof_;
+  string buf_;
+};
+
+class AlignServer : boost::noncopyable {
+ public:
+  AlignServer(const Options &opts, const TTable &table, int threads, size_t batch_size)
+      : aligner_(opts, table), reverse_(opts.reverse), batch_size_(batch_size),
+        work_(4 * threads) {
+    for (int i = 0; i < threads; ++i)
+      workers_.create_thread(boost::bind(&AlignServer::Work, this));
+  }
+
+  ~AlignServer() {
+    work_.Close();
+    workers_.join_all();
+    LOG(INFO) << "pa-align-server: " << stats_.Summary();
+  }
+
+  // Answers requests from `in_fd` on `out_fd` until end of input
+  void Serve(int in_fd, int out_fd) {
+    Session session(4);
+    boost::thread writer(boost::bind(&AlignServer::Write, this, &session, out_fd));
+    LineReader reader(in_fd);
+    vector<string> lines;
+    while (reader.ReadBatch(batch_size_, &lines)) {
+      Batch *batch = new Batch;
+      batch->session = &session;
+      batch->arrival = WallTime();
+      batch->requests.swap(lines);
+      batch->seq = session.Reserve();
+      work_.Push(batch);
+    }
+    session.Close();
+    writer.join();
+  }
+
+  // Accepts connections on a Unix socket forever, one session each
+  void ServeSocket(const string &path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+      LOG(FATAL) << "Cannot create socket: " << strerror(errno);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+      LOG(FATAL) << "Socket path too long: " << path;
+    strcpy(addr.sun_path, path.c_str());
+    unlink(path.c_str());
+    if (bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0)
+      LOG(FATAL) << "Cannot bind to " << path << ": " << strerror(errno);
+    if (listen(fd, 64) < 0)
+      LOG(FATAL) << "Cannot listen on " << path << ": " << strerror(errno);
+    LOG(INFO) << "pa-align-server: listening on " << path;
+    for (;;) {
+      int conn = accept(fd, NULL, NULL);
+      if (conn < 0) {
+        if (errno == EINTR)
+          continue;
+        LOG(FATAL) << "accept failed: " << strerror(errno);
+      }
+      boost::thread(boost::bind(&AlignServer::ServeConnection, this, conn)).detach();
+    }
+  }
+
+ private:
+  struct Batch;
+  typedef ReorderBuffer<Batch *> Session;
+
+  // Lines that arrived together; requests are replaced by replies
+  struct Batch {
+    Session *session;
+    size_t seq;
+    double arrival;
+    vector<string> requests;
+  };
+
+  void ServeConnection(int fd) {
+    Serve(fd, fd);
+    close(fd);
+  }
+
+  void Work() {
+    ostringstream strm;
+    ViterbiSink sink(strm);
+    size_t id;
+    vector<WordId> src, tgt;
+    vector<SentSzPair> al;
+    ViterbiAligner::Scratch scratch(aligner_);
+    Batch *batch;
+    while (work_.Pop(&batch)) {
+      for (size_t i = 0; i < batch->requests.size(); ++i) {
+        string &line = batch->requests[i];
+        strm.str("");
+        if (line == "STATS") {
+          strm << stats_.Summary() << '\n';
+        } else if (!MapperSource::TryParse(line, &id, &src, &tgt)) {
+          strm << "ERROR\t" << line << '\n';
+        } else {
+          if (reverse_) swap(src, tgt);
+          aligner_.Align(src, tgt, &scratch, &al);
+          sink.WriteAlignment(id, al.begin(), al.end());
+        }
+        line = strm.str();
+      }
+      batch->session->Put(batch->seq, batch);
+    }
+  }
+
+  void Write(Session *session, int fd) {
+    Batch *batch;
+    bool ok = true;
+    while (session->Take(&batch)) {
+      string out;
+      for (size_t i = 0; i < batch->requests.size(); ++i)
+        out += batch->requests[i];
+      // Keep draining the session even if the client went away
+      for (size_t done = 0; ok && done < out.size();) {
+        ssize_t r = write(fd, out.data() + done, out.size() - done);
+        if (r < 0 && errno == EINTR)
+          continue;
+        if (r <= 0)
+          ok = false;
+        else
+          done += r;
+      }
+      const double latency = WallTime() - batch->arrival;
+      for (size_t i = 0; i < batch->requests.size(); ++i)
+        stats_.Add(latency);
+      delete batch;
+    }
+  }
+
+  const ViterbiAligner aligner_;
+  const bool reverse_;
+  const size_t batch_size_;
+  BoundedQueue<Batch *> work_;
+  boost::thread_group workers_;
+  LatencyStats stats_;
+};
+} // namespace paralign
+
+using namespace paralign;
+
+static void Usage(const char *prog) {
+  cerr << "Usage: " << prog << " [-s SOCKET] [-j THREADS] [-b BATCH]" << endl;
+  exit(1);
+}
+
+int main(int argc, char *argv[]) {
+  string socket_path;
+  int threads = boost::thread::hardware_concurrency(), batch_size = 256;
+  int c;
+  while ((c = getopt(argc, argv, "s:j:b:")) != -1) {
+    switch (c) {
+      case 's': socket_path = optarg; break;
+      case 'j': threads = atoi(optarg); break;
+      case 'b': batch_size = atoi(optarg); break;
+      default: Usage(argv[0]);
+    }
+  }
+  if (threads <= 0)
+    threads = 1;
+  if (batch_size <= 0)
+    Usage(argv[0]);
+  signal(SIGPIPE, SIG_IGN);
+
+  Options opts = Options::FromEnv();
+  LOG(INFO) << "Options:" << endl
+            << opts << endl;
+  TTable table(opts.ttable_dir, opts.ttable_parts);
+
+  AlignServer server(opts, table, threads, batch_size);
+  if (socket_path.empty())
+    server.Serve(STDIN_FILENO, STDOUT_FILENO);
+  else
+    server.ServeSocket(socket_path);
+  return 0;
+}
@@ -0,0 +1,395 @@
+// Microbenchmarks of the hot paths, on synthetic Zipfian data.
+//
+// Usage: micro_bench [-t SECONDS] [FILTER]
+//
+// Runs each benchmark whose name contains FILTER for at least SECONDS
+// (default 0.5) and reports the time per operation. The mapper's
+// E-step as a whole is measured by scripts/pa-bench.bash.
+#include <unistd.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/scoped_ptr.hpp>
+
+#include "estep.h"
+#include "io.h"
+#include "pipeline.h"
+#include "synth.h"
+#include "ttable.h"
+#include "types.h"
+#include "contrib/da.h"
+
+using namespace std;
+using namespace paralign;
+
+namespace {
+const size_t kRows = 20000;
+const size_t kColumns = 200;
+const size_t kSentences = 2000;
+
+// Keeps results alive so the compiler cannot drop the work
+volatile double g_sink;
+
+// A benchmark does `Ops()` operations per call
+class Benchmark {
+ public:
+  virtual ~Benchmark() {}
+  virtual const char *Name() const = 0;
+  virtual size_t Ops() const = 0;
+  virtual void Run() = 0;
+};
+
+// Shared synthetic data
+struct Data {
+  Data() : tgt_words(0) {
+    MakeSynthTTable(kRows, kColumns, 1.0, 1, &rows);
+    SynthCorpus corpus(kRows, 1.0, 20, 2);
+    ostringstream strm;
+    corpus.Write(kSentences, strm);
+    istringstream in(strm.str());
+    string line;
+    size_t id;
+    while (getline(in, line)) {
+      lines.push_back(line);
+      src.push_back(vector<WordId>());
+      tgt.push_back(vector<WordId>());
+      MapperSource::Parse(line, &id, &src.back(), &tgt.back());
+      tgt_words += tgt.back().size();
+    }
+    SynthRng rng(3);
+    ZipfSampler zipf(kRows, 1.0);
+    for (size_t i = 0; i < 4096; ++i)
+      words.push_back(zipf.Sample(&rng));
+    for (size_t i = 0; i < rows.size(); ++i) {
+      ostringstream value;
+      value << rows[i];
+      values.push_back(value.str());
+    }
+
+    char dir_template[] = "/tmp/micro_bench.XXXXXX";
+    if (mkdtemp(dir_template) == NULL)
+      LOG(FATAL) << "Cannot create a temporary directory";
+    dir = dir_template;
+    WriteSynthTTable(rows, dir, 1);
+    table.reset(new TTable(dir, 1));
+  }
+
+  ~Data() {
+    table.reset();
+    remove((dir + "/index.0").c_str());
+    remove((dir + "/entry.0").c_str());
+    rmdir(dir.c_str());
+  }
+
+  vector<TTableEntry> rows;
+  vector<string> lines;
+  vector<vector<WordId> > src, tgt;
+  size_t tgt_words;
+  vector<string> values;
+  vector<WordId> words;
+  string dir;
+  boost::scoped_ptr<TTable> table;
+};
+
+class LookUpBench : public Benchmark {
+ public:
+  explicit LookUpBench(Data *data) : d_(data) {}
+  const char *Name() const { return "LookUp"; }
+  size_t Ops() const { return d_->words.size(); }
+  void Run() {
+    const TTableEntry &row = d_->rows[1];
+    double sum = 0;
+    for (size_t i = 0; i < d_->words.size(); ++i) {
+      const EntryRecord *r = LookUp(d_->words[i], &row[0], row.Size());
+      if (r) sum += r->v;
+    }
+    g_sink = sum;
+  }
+ private:
+  Data *d_;
+};
+
+class QueryBench : public Benchmark {
+ public:
+  explicit QueryBench(Data *data) : d_(data) {}
+  const char *Name() const { return "TTable::Query"; }
+  size_t Ops() const { return d_->words.size(); }
+  void Run() {
+    double sum = 0;
+    for (size_t i = 0; i < d_->words.size(); ++i)
+      sum += d_->table->Query(d_->words[i], d_->words[d_->words.size() - 1 - i]);
+    g_sink = sum;
+  }
+ private:
+  Data *d_;
+};
+
+class PlusEqBench : public Benchmark {
+ public:
+  explicit PlusEqBench(Data *data) : d_(data) {}
+  const char *Name() const { return "PlusEq"; }
+  size_t Ops() const { return 100; }
+  void Run() {
+    for (size_t i = 0; i < 100; ++i)
+      PlusEq(d_->rows[i], d_->rows[i + 1], &sum_);
+    g_sink = sum_.Size();
+  }
+ private:
+  Data *d_;
+  TTableEntry sum_;
+};
+
+class NormalizeBench : public Benchmark {
+ public:
+  NormalizeBench(Data *data, bool vb) : d_(data), vb_(vb) {}
+  const char *Name() const { return vb_ ? "TTableEntry::NormalizeVB" : "TTableEntry::Normalize"; }
+  size_t Ops() const { return 100; }
+  void Run() {
+    for (size_t i = 0; i < 100; ++i) {
+      entry_ = d_->rows[i];
+      entry_.Scale(1000);
+      if (vb_)
+        entry_.NormalizeVB(0.01);
+      else
+        entry_.Normalize();
+    }
+    g_sink = entry_[0].v;
+  }
+ private:
+  Data *d_;
+  const bool vb_;
+  TTableEntry entry_;
+};
+
+class MapperParseBench : public Benchmark {
+ public:
+  explicit MapperParseBench(Data *data) : d_(data) {}
+  const char *Name() const { return "MapperSource::Parse"; }
+  size_t Ops() const { return d_->lines.size(); }
+  void Run() {
+    size_t id, words = 0;
+    for (size_t i = 0; i < d_->lines.size(); ++i) {
+      MapperSource::Parse(d_->lines[i], &id, &src_, &tgt_);
+      words += src_.size() + tgt_.size();
+    }
+    g_sink = words;
+  }
+ private:
+  Data *d_;
+  vector<WordId> src_, tgt_;
+};
+
+class ReducerParseBench : public Benchmark {
+ public:
+  explicit ReducerParseBench(Data *data) : d_(data) {}
+  const char *Name() const { return "ReducerSource::ParseEntry"; }
+  size_t Ops() const { return 100; }
+  void Run() {
+    for (size_t i = 0; i < 100; ++i)
+      ReducerSource::ParseEntry(d_->values[i], &entry_);
+    g_sink = entry_.Size();
+  }
+ private:
+  Data *d_;
+  TTableEntry entry_;
+};
+
+class SinkBench : public Benchmark {
+ public:
+  explicit SinkBench(Data *data) : d_(data), sink_(strm_) {}
+  const char *Name() const { return "Sink::WriteTTableEntry"; }
+  size_t Ops() const { return 100; }
+  void Run() {
+    strm_.str("");
+    for (size_t i = 0; i < 100; ++i)
+      sink_.WriteTTableEntry(i, d_->rows[i]);
+    g_sink = strm_.tellp();
+  }
+ private:
+  Data *d_;
+  ostringstream strm_;
+  Sink sink_;
+};
+
+// The diagonal prior of one sentence pair of 20 x 20 words
+class DiagonalPriorBench : public Benchmark {
+ public:
+  const char *Name() const { return "DiagonalAlignment prior 20x20"; }
+  size_t Ops() const { return 1; }
+  void Run() {
+    double sum = 0;
+    for (unsigned j = 1; j <= 20; ++j) {
+      const double az = DiagonalAlignment::ComputeZ(j, 20, 20, 4.0);
+      for (unsigned i = 1; i <= 20; ++i)
+        sum += DiagonalAlignment::UnnormalizedProb(j, i, 20, 20, 4.0) / az;
+    }
+    g_sink = sum;
+  }
+};
+
+// Drops the expected counts of `LinkKernel::Expect`
+struct NoCounts {
+  void AddPseudoCount(WordId, WordId, double) {}
+};
+
+// The E-step over the corpus per target word, without storing counts,
+// with `LinkKernel` specialized for the options, in double or float,
+// or, for comparison, with the options tested in the loops as the
+// mapper did before
+class EStepBench : public Benchmark {
+ public:
+  enum Variant { kDouble, kFloat, kRuntime };
+
+  EStepBench(Data *data, bool null_word, bool diagonal, Variant variant)
+      : d_(data), opts_(MakeOptions(null_word, diagonal)), variant_(variant), priors_(opts_, true),
+        float_priors_(opts_, true) {
+    name_ = string("E-step ") + (null_word ? "null" : "no null") + (diagonal ? " diagonal" : " uniform") +
+        (variant == kFloat ? " float" : variant == kRuntime ? " (runtime)" : "");
+  }
+  const char *Name() const { return name_.c_str(); }
+  size_t Ops() const { return d_->tgt_words; }
+  void Run() {
+    if (variant_ == kRuntime)
+      g_sink = Runtime();
+    else if (variant_ == kFloat)
+      g_sink = Specialized<float>(float_priors_, &float_probs_);
+    else
+      g_sink = Specialized<double>(priors_, &probs_);
+  }
+ private:
+  static Options MakeOptions(bool null_word, bool diagonal) {
+    Options opts;
+    opts.no_null_word = !null_word;
+    opts.favor_diagonal = diagonal;
+    opts.diagonal_tension = 4.0;
+    return opts;
+  }
+
+  template <class Real>
+  double Specialized(BasicCellPriors<Real> &priors, vector<Real> *probs) {
+    if (opts_.no_null_word)
+      return opts_.favor_diagonal ? Specialized<false, true>(priors, probs) : Specialized<false, false>(priors, probs);
+    return opts_.favor_diagonal ? Specialized<true, true>(priors, probs) : Specialized<true, false>(priors, probs);
+  }
+
+  template <bool kNullWord, bool kDiagonal, class Real>
+  double Specialized(BasicCellPriors<Real> &priors, vector<Real> *probs) {
+    typedef LinkKernel<kNullWord, kDiagonal, Real> Kernel;
+    double log_likelihood = 0, emp_feat = 0;
+    for (size_t k = 0; k < d_->src.size(); ++k) {
+      const vector<WordId> &src = d_->src[k], &tgt = d_->tgt[k];
+      probs->resize(src.size() + 1);
+      priors.Set(tgt.size(), src.size(), opts_.diagonal_tension);
+      for (size_t j = 0; j < tgt.size(); ++j) {
+        const Real sum = Kernel::Joint(*d_->table, tgt[j], src, priors.Prior(j), opts_.prob_align_null,
+                                       &(*probs)[0]);
+        Kernel::Expect(&(*probs)[0], sum, tgt[j], src, priors.Feature(j), &counts_, &emp_feat);
+        log_likelihood += log(static_cast<double>(sum));
+      }
+    }
+    return log_likelihood + emp_feat;
+  }
+
+  double Runtime() {
+    double log_likelihood = 0, emp_feat = 0;
+    for (size_t k = 0; k < d_->src.size(); ++k) {
+      const vector<WordId> &src = d_->src[k], &tgt = d_->tgt[k];
+      probs_.resize(src.size() + 1);
+      priors_.Set(tgt.size(), src.size(), opts_.diagonal_tension);
+      for (size_t j = 0; j < tgt.size(); ++j) {
+        const WordId f_j = tgt[j];
+        const double *prior = priors_.Prior(j), *feature = priors_.Feature(j);
+        double sum = 0;
+        double prob_a_i = 1.0 / (src.size() + !opts_.no_null_word);
+        if (!opts_.no_null_word) {
+          if (opts_.favor_diagonal) prob_a_i = opts_.prob_align_null;
+          probs_[0] = d_->table->Query(kNull, f_j) * prob_a_i;
+          sum += probs_[0];
+        }
+        for (unsigned i = 1; i <= src.size(); ++i) {
+          if (opts_.favor_diagonal)
+            prob_a_i = prior[i - 1];
+          probs_[i] = d_->table->Query(src[i-1], f_j) * prob_a_i;
+          sum += probs_[i];
+        }
+        if (!opts_.no_null_word)
+          counts_.AddPseudoCount(kNull, f_j, probs_[0] / sum);
+        for (unsigned i = 1; i <= src.size(); ++i) {
+          const double p = probs_[i] / sum;
+          counts_.AddPseudoCount(src[i-1], f_j, p);
+          emp_feat += feature[i - 1] * p;
+        }
+        log_likelihood += log(sum);
+      }
+    }
+    return log_likelihood + emp_feat;
+  }
+
+  Data *d_;
+  const Options opts_;
+  const Variant variant_;
+  string name_;
+  CellPriors priors_;
+  BasicCellPriors<float> float_priors_;
+  vector<double> probs_;
+  vector<float> float_probs_;
+  NoCounts counts_;
+};
+
+void Measure(Benchmark *bench, double seconds) {
+  bench->Run();  // warm up
+  size_t calls = 0;
+  const double start = WallTime();
+  double elapsed = 0;
+  do {
+    bench->Run();
+    ++calls;
+    elapsed = WallTime() - start;
+  } while (elapsed < seconds);
+  const double ops = static_cast<double>(calls) * bench->Ops();
+  printf("%-36s %12.0f ops %12.1f ns/op %14.0f ops/s\n", bench->Name(), ops, elapsed / ops * 1e9,
+         ops / elapsed);
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+  double seconds = 0.5;
+  int c;
+  while ((c = getopt(argc, argv, "t:")) != -1) {
+    switch (c) {
+      case 't': seconds = atof(optarg); break;
+      default:
+        cerr << "Usage: " << argv[0] << " [-t SECONDS] [FILTER]" << endl;
+        return 1;
+    }
+  }
+  const string filter = optind < argc ? argv[optind] : "";
+
+  Data data;
+  vector<Benchmark *> benchmarks;
+  benchmarks.push_back(new LookUpBench(&data));
+  benchmarks.push_back(new QueryBench(&data));
+  benchmarks.push_back(new PlusEqBench(&data));
+  benchmarks.push_back(new NormalizeBench(&data, false));
+  benchmarks.push_back(new NormalizeBench(&data, true));
+  benchmarks.push_back(new MapperParseBench(&data));
+  benchmarks.push_back(new ReducerParseBench(&data));
+  benchmarks.push_back(new SinkBench(&data));
+  benchmarks.push_back(new DiagonalPriorBench);
+  for (int k = 0; k < 4; ++k) {
+    benchmarks.push_back(new EStepBench(&data, k < 2, k % 2, EStepBench::kDouble));
+    benchmarks.push_back(new EStepBench(&data, k < 2, k % 2, EStepBench::kFloat));
+    benchmarks.push_back(new EStepBench(&data, k < 2, k % 2, EStepBench::kRuntime));
+  }
+  for (size_t i = 0; i < benchmarks.size(); ++i) {
+    if (string(benchmarks[i]->Name()).find(filter) != string::npos)
+      Measure(benchmarks[i], seconds);
+    delete benchmarks[i];
+  }
+  return 0;
+}
@@ -1,5 +1,7 @@
 #include <iostream>
+#include <boost/scoped_ptr.hpp>
 
+#include "counters.h"
 #include "io.h"
 #include "reducer.h"
 #include "ttable.h"
@@ -10,10 +12,18 @@ using namespace paralign;
 
 int main() {
   Options opts = Options::FromEnv();
+  TaskCounters counters("combiner", opts.counters);
+  counters.CountBytes(&cin, &cout);
   ReducerSource input(cin);
-  ReducerSink output(cout);
+  ReducerSink output(cout, kForwardDirection, opts.float_counts);
+  boost::scoped_ptr<ReducerSink> reverse_output;
+  if (opts.bidirectional)
+    reverse_output.reset(new ReducerSink(cout, kReverseDirection, opts.float_counts));
 
-  Reducer(opts, NULL, &input, &output, Reducer::kCombiner).Run();
+  Reducer combiner(opts, NULL, &input, &output, Reducer::kCombiner, NULL, reverse_output.get());
+  combiner.SetCounters(&counters);
+  combiner.Run();
+  counters.Report();
 
   return 0;
 }
@@ -0,0 +1,201 @@
+#ifndef _PARALIGN_COUNTERS_H_
+#define _PARALIGN_COUNTERS_H_
+
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include <boost/scoped_ptr.hpp>
+#include <boost/utility.hpp>
+
+#include "io.h"
+#include "pipeline.h"
+
+namespace paralign {
+// Counts the bytes read through another stream buffer
+class CountingInBuf : public std::streambuf {
+ public:
+  explicit CountingInBuf(std::streambuf *src) : src_(src), bytes_(0), data_(1 << 16) {}
+
+  int64_t Bytes() const {
+    return bytes_;
+  }
+
+ protected:
+  int_type underflow() {
+    std::streamsize n = src_->sgetn(&data_[0], data_.size());
+    if (n <= 0)
+      return traits_type::eof();
+    bytes_ += n;
+    setg(&data_[0], &data_[0], &data_[0] + n);
+    return traits_type::to_int_type(data_[0]);
+  }
+
+ private:
+  std::streambuf *src_;
+  int64_t bytes_;
+  std::vector<char> data_;
+};
+
+// Counts the bytes written through another stream buffer
+class CountingOutBuf : public std::streambuf {
+ public:
+  explicit CountingOutBuf(std::streambuf *dest) : dest_(dest), bytes_(0) {}
+
+  int64_t Bytes() const {
+    return bytes_;
+  }
+
+ protected:
+  int_type overflow(int_type c) {
+    if (traits_type::eq_int_type(c, traits_type::eof()))
+      return traits_type::not_eof(c);
+    ++bytes_;
+    return dest_->sputc(traits_type::to_char_type(c));
+  }
+
+  std::streamsize xsputn(const char *s, std::streamsize n) {
+    bytes_ += n;
+    return dest_->sputn(s, n);
+  }
+
+  int sync() {
+    return dest_->pubsync();
+  }
+
+ private:
+  std::streambuf *dest_;
+  int64_t bytes_;
+};
+
+// Counters and status of a streaming task, reported to Hadoop on
+// stderr with the task name as prefix, e.g. `mapper_sentences`. When
+// disabled (`pa_counters` unset), nothing is reported, timers never
+// read the clock and the streams are left alone. Not thread-safe; add
+// up per-thread figures before handing them over.
+class TaskCounters : boost::noncopyable {
+ public:
+  // Seconds between status lines from `Progress`
+  static const int kProgressInterval = 60;
+
+  TaskCounters(const std::string &task, bool enabled)
+      : task_(task), enabled_(enabled), start_(WallTime()), last_status_(start_), calls_(0),
+        in_(NULL), out_(NULL), in_buf_(NULL), out_buf_(NULL) {}
+
+  ~TaskCounters() {
+    if (in_)
+      in_->rdbuf(in_buf_);
+    if (out_) {
+      out_->flush();
+      out_->rdbuf(out_buf_);
+    }
+  }
+
+  bool Enabled() const {
+    return enabled_;
+  }
+
+  void Add(const std::string &name, int64_t amount) {
+    if (enabled_)
+      counters_[name] += amount;
+  }
+
+  // Keeps the largest value seen
+  void Max(const std::string &name, int64_t value) {
+    if (enabled_ && value > counters_[name])
+      counters_[name] = value;
+  }
+
+  // Accumulated seconds of a phase for `PhaseTimer`, or NULL when
+  // disabled. Stays valid for the lifetime of this object.
+  double *Timer(const std::string &phase) {
+    return enabled_ ? &timers_[phase] : NULL;
+  }
+
+  // Tells Hadoop the task is alive with `items` done so far, at most
+  // every `kProgressInterval` seconds; only reads the clock every
+  // 4096 calls
+  void Progress(int64_t items, const char *unit) {
+    if (!enabled_ || (++calls_ & 4095) != 0)
+      return;
+    const double now = WallTime();
+    if (now - last_status_ < kProgressInterval)
+      return;
+    last_status_ = now;
+    std::ostringstream strm;
+    strm << task_ << ": " << items << ' ' << unit << " in " << static_cast<int64_t>(now - start_) << 's';
+    Status(strm.str());
+  }
+
+  void Status(const std::string &message) {
+    if (enabled_)
+      std::cerr << "reporter:status:" << message << std::endl;
+  }
+
+  // Counts the bytes going through `in` and `out` from now on
+  void CountBytes(std::istream *in, std::ostream *out) {
+    if (!enabled_)
+      return;
+    in_ = in;
+    in_buf_ = in->rdbuf();
+    counting_in_.reset(new CountingInBuf(in_buf_));
+    in->rdbuf(counting_in_.get());
+    out_ = out;
+    out_buf_ = out->rdbuf();
+    counting_out_.reset(new CountingOutBuf(out_buf_));
+    out->rdbuf(counting_out_.get());
+  }
+
+  // Writes out all counters, with timers in milliseconds as
+  // `<phase>_ms`; call once at the end
+  void Report() {
+    if (!enabled_)
+      return;
+    if (counting_in_)
+      Add("bytes_in", counting_in_->Bytes());
+    if (counting_out_)
+      Add("bytes_out", counting_out_->Bytes());
+    Add("wall_ms", static_cast<int64_t>((WallTime() - start_) * 1000));
+    for (std::map<std::string, int64_t>::const_iterator it = counters_.begin(); it != counters_.end(); ++it)
+      ReportCounter(task_ + "_" + it->first, it->second);
+    for (std::map<std::string, double>::const_iterator it = timers_.begin(); it != timers_.end(); ++it)
+      ReportCounter(task_ + "_" + it->first + "_ms", static_cast<int64_t>(it->second * 1000));
+    Status(task_ + ": done");
+  }
+
+ private:
+  const std::string task_;
+  const bool enabled_;
+  const double start_;
+  double last_status_;
+  int64_t calls_;
+  std::map<std::string, int64_t> counters_;
+  std::map<std::string, double> timers_;
+
+  std::istream *in_;
+  std::ostream *out_;
+  std::streambuf *in_buf_, *out_buf_;
+  boost::scoped_ptr<CountingInBuf> counting_in_;
+  boost::scoped_ptr<CountingOutBuf> counting_out_;
+};
+
+// Adds the time until it goes out of scope to a `TaskCounters::Timer`;
+// does nothing for NULL
+class PhaseTimer : boost::noncopyable {
+ public:
+  explicit PhaseTimer(double *seconds) : seconds_(seconds), start_(seconds ? WallTime() : 0) {}
+
+  ~PhaseTimer() {
+    if (seconds_)
+      *seconds_ += WallTime() - start_;
+  }
+
+ private:
+  double *seconds_;
+  const double start_;
+};
+} // namespace paralign
+
+#endif  // _PARALIGN_COUNTERS_H_
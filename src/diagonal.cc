@@ -1,5 +1,18 @@
+// pa-diagonal: sums the reducers' statistics, logs the likelihood and
+// writes the optimized diagonal tension (one line per direction).
+//
+// Usage: pa-diagonal [FILE...]
+//
+// Reads the sorted output of the reducers from stdin, or with FILEs,
+// the binary statistics they wrote with `pa_tension_stats`, which are
+// merged as they are read and need no sorting.
+#include <cerrno>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <sstream>
 
+#include "counters.h"
 #include "io.h"
 #include "reducer.h"
 #include "ttable.h"
@@ -8,12 +21,25 @@
 using namespace std;
 using namespace paralign;
 
-int main() {
+int main(int argc, char *argv[]) {
   Options opts = Options::FromEnv();
-  ReducerSource input(cin);
+  TaskCounters counters("diagonal", opts.counters);
+  istringstream no_input;
+  istream &in = argc > 1 ? static_cast<istream &>(no_input) : cin;
+  counters.CountBytes(&in, &cout);
+  ReducerSource input(in);
   ReducerSink output(cout);
 
-  Reducer(opts, NULL, &input, &output, Reducer::kTension).Run();
+  Reducer diagonal(opts, NULL, &input, &output, Reducer::kTension);
+  diagonal.SetCounters(&counters);
+  for (int i = 1; i < argc; ++i) {
+    ifstream file(argv[i], ios::binary);
+    if (!file)
+      LOG(FATAL) << "Cannot open " << argv[i] << ": " << strerror(errno);
+    diagonal.LoadStats(file, argv[i]);
+  }
+  diagonal.Run();
+  counters.Report();
 
   return 0;
 }
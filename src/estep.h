@@ -0,0 +1,167 @@
+#ifndef _PARALIGN_ESTEP_H_
+#define _PARALIGN_ESTEP_H_
+
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+#include "options.h"
+#include "ttable.h"
+#include "types.h"
+#include "contrib/da.h"
+
+namespace paralign {
+// Alignment priors and diagonal features of the cells of one sentence
+// size, recomputed only when the size or the tension changes. Priors
+// are kept with `favor_diagonal` only, features when asked for. Both
+// are computed in double and stored as `Real`, the precision of the
+// E-step that uses them.
+template <class Real>
+class BasicCellPriors {
+ public:
+  BasicCellPriors(const Options &opts, bool features)
+      : favor_diagonal_(opts.favor_diagonal), prob_align_null_(opts.prob_align_null), features_(features),
+        tgt_size_(0), src_size_(0), tension_(0) {}
+
+  void Set(size_t tgt_size, size_t src_size, double tension) {
+    if (tgt_size == tgt_size_ && src_size == src_size_ && (!favor_diagonal_ || tension == tension_))
+      return;
+    tgt_size_ = tgt_size;
+    src_size_ = src_size;
+    tension_ = tension;
+    if (favor_diagonal_)
+      prior_.resize(tgt_size * src_size);
+    if (features_)
+      feature_.resize(tgt_size * src_size);
+    for (size_t j = 0; j < tgt_size; ++j) {
+      double az = 0;
+      if (favor_diagonal_)
+        az = DiagonalAlignment::ComputeZ(j+1, tgt_size, src_size, tension) / (1 - prob_align_null_);
+      for (unsigned i = 1; i <= src_size; ++i) {
+        if (favor_diagonal_)
+          prior_[j * src_size + i - 1] = DiagonalAlignment::UnnormalizedProb(j + 1, i, tgt_size, src_size, tension) / az;
+        if (features_)
+          feature_[j * src_size + i - 1] = DiagonalAlignment::Feature(j, i, tgt_size, src_size);
+      }
+    }
+  }
+
+  // Priors of aligning target word `j` to each source word
+  const Real *Prior(size_t j) const {
+    return prior_.empty() ? NULL : &prior_[j * src_size_];
+  }
+
+  const Real *Feature(size_t j) const {
+    return feature_.empty() ? NULL : &feature_[j * src_size_];
+  }
+
+ private:
+  const bool favor_diagonal_;
+  const double prob_align_null_;
+  const bool features_;
+  size_t tgt_size_, src_size_;
+  double tension_;
+  std::vector<Real> prior_, feature_;
+};
+
+typedef BasicCellPriors<double> CellPriors;
+
+// Posterior of a link given its joint probability and their sum. In
+// float, posteriors below the float range become the smallest float, as
+// counts do with `FloatCount`, so that their entries are kept.
+inline double Posterior(double prob, double sum) {
+  return prob / sum;
+}
+
+inline float Posterior(float prob, float sum) {
+  const float p = prob / sum;
+  return p == 0 ? std::numeric_limits<float>::denorm_min() : p;
+}
+
+// The E-step for one target word, specialized at compile time on
+// whether the null word takes part (`!no_null_word`) and on the
+// diagonal prior (`favor_diagonal`), so that the loops over source
+// words do not branch on options. The aligners pick the specialization
+// for their options once; the expected counts of the mapper and
+// pa-online and the decisions of pa-viterbi all come from `Joint`.
+// Probabilities are computed as `Real`: float (`compute_precision`)
+// fits twice as many in a vector register, and is enough for
+// posteriors that end up summed into counts; callers sum the log of
+// the likelihoods in double.
+template <bool kNullWord, bool kDiagonal, class Real = double>
+struct LinkKernel {
+  // Sets `probs[i]` to the probability of target word `f_j` together
+  // with its link to source word i (0 for the null word), given the row
+  // of priors `prior`; returns their sum, the likelihood of `f_j`.
+  // `Table` needs `double Query(WordId src, WordId tgt)`.
+  template <class Table>
+  static Real Joint(Table &table, WordId f_j, const std::vector<WordId> &src, const Real *prior,
+                    double prob_align_null, Real *probs) {
+    const size_t n = src.size();
+    const Real uniform = Real(1) / (n + kNullWord);  // model 1
+    Real sum = 0;
+    if (kNullWord) {
+      probs[0] = table.Query(kNull, f_j) * (kDiagonal ? Real(prob_align_null) : uniform);
+      sum += probs[0];
+    }
+    // Lookups apart, so that the products are vectorized
+    for (size_t i = 1; i <= n; ++i)
+      probs[i] = table.Query(src[i-1], f_j);
+    if (kDiagonal) {
+      for (size_t i = 1; i <= n; ++i)
+        probs[i] *= prior[i-1];
+    } else {
+      for (size_t i = 1; i <= n; ++i)
+        probs[i] *= uniform;
+    }
+    for (size_t i = 1; i <= n; ++i)
+      sum += probs[i];
+    return sum;
+  }
+
+  // Adds the posteriors of the links of `f_j` given their joint
+  // probabilities to `counts` (through its `AddPseudoCount(src, tgt, p)`)
+  // and the expected diagonal feature to `emp_feat`
+  template <class Counts>
+  static void Expect(const Real *probs, Real sum, WordId f_j, const std::vector<WordId> &src,
+                     const Real *feature, Counts *counts, double *emp_feat) {
+    if (kNullWord)
+      counts->AddPseudoCount(kNull, f_j, Posterior(probs[0], sum));
+    for (size_t i = 1; i <= src.size(); ++i) {
+      const Real p = Posterior(probs[i], sum);
+      counts->AddPseudoCount(src[i-1], f_j, p);
+      *emp_feat += feature[i-1] * p;
+    }
+  }
+
+  // Most probable link (0 for the null word, -1 for none)
+  static int Best(const Real *probs, size_t src_size) {
+    Real max_p = -1;
+    int best = -1;
+    if (kNullWord) {
+      best = 0;
+      max_p = probs[0];
+    }
+    for (size_t i = 1; i <= src_size; ++i) {
+      if (probs[i] > max_p) {
+        best = i;
+        max_p = probs[i];
+      }
+    }
+    return best;
+  }
+};
+
+// Appends the alignment point of target word `j` and its link `best`
+// (see `LinkKernel::Best`), in the order of the input sides
+inline void AddAlignmentPoint(size_t j, int best, bool reverse, std::vector<SentSzPair> *al) {
+  if (best <= 0)
+    return;
+  if (reverse)
+    al->push_back(MkSzPair(j, best - 1));
+  else
+    al->push_back(MkSzPair(best - 1, j));
+}
+} // namespace paralign
+
+#endif  // _PARALIGN_ESTEP_H_
@@ -1,83 +1,313 @@
+// pa-estimate: predicts the size of the translation table, and what it
+// takes to train it, in one pass over a corpus with bounded memory.
+//
+// Usage: pa-estimate [-j THREADS] [-b BITS] [--reverse] [FILE...]
+//
+// Reads sentences in the pa-mapper input format from the FILEs (or
+// stdin), each taken as the input split of one map task, on THREADS
+// threads. Distinct rows and entries of the table are counted with
+// `HyperLogLog` sketches of 2^BITS bytes (default 12, about 1.6%
+// error) for each of the `pa_ttable_parts` parts (1 if unset), laid
+// out like the reducers do (by `pa_partition_map` if set), and for
+// each split.
+// Directions follow `pa_reverse` (or `--reverse`), `pa_bidirectional`
+// and `pa_no_null_word` as in pa-mapper.
+//
+// Prints the vocabularies and the table size, the size of each part,
+// the pseudo count memory and output of the mappers (which is what
+// gets shuffled), and suggested MAPS, REDUCES and MEM for
+// pa-hadoop.bash.
+#include <getopt.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
 #include <cstring>
-#include <map>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
-#include <set>
-#include <sstream>
 #include <string>
 #include <utility>
 #include <vector>
+#include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 
-#include <boost/foreach.hpp>
+#include "io.h"
+#include "options.h"
+#include "partition.h"
+#include "sketch.h"
+#include "ttable.h"
+#include "types.h"
+#include "contrib/log.h"
 
 using namespace std;
+using namespace paralign;
 
-const int kIntSize = sizeof(int), kLongLongSize = sizeof(long long), kDoubleSize = sizeof(double);
+namespace {
+// Sizing targets behind the suggestions
+const double kMB = 1024.0 * 1024.0;
+const double kPartBytes = 256 * kMB;         // table piece per reducer
+const double kPseudoCountBytes = 1024 * kMB; // pseudo counts per mapper
+const double kTaskOverheadMB = 512;          // JVM and streaming
 
-void AddTokens(const string &sentence, vector<int> *output) {
-  istringstream strm(sentence);
-  int w;
-  while (strm >> w) output->push_back(w);
+int Digits(WordId w) {
+  int d = 1;
+  for (; w >= 10; w /= 10)
+    ++d;
+  return d;
 }
 
-void Tokenize(const string &buf, bool reverse, vector<int> *src, vector<int> *tgt) {
-  if (reverse) swap(src, tgt);
-  src->clear();
-  tgt->clear();
-  size_t tab = buf.find('\t');
-  AddTokens(buf.substr(0, tab), src);
-  AddTokens(buf.substr(tab + 1), tgt);
-}
+// Rows and entries of one table, in total and per part
+struct TableSketch {
+  TableSketch(int parts, int bits)
+      : tgt_vocab(bits), part_rows(parts, HyperLogLog(bits)), part_entries(parts, HyperLogLog(bits)) {}
 
-int main(int argc, char *argv[]) {
-  bool reverse = false;
-  for (int i = 1; i < argc; ++i) {
-    if (strcmp(argv[i], "--reverse") == 0) {
-      cerr << "reversing src and tgt order" << endl;
-      reverse = true;
-      break;
+  void Merge(const TableSketch &that) {
+    tgt_vocab.Merge(that.tgt_vocab);
+    for (size_t p = 0; p < part_rows.size(); ++p) {
+      part_rows[p].Merge(that.part_rows[p]);
+      part_entries[p].Merge(that.part_entries[p]);
+    }
+  }
+
+  HyperLogLog tgt_vocab;
+  vector<HyperLogLog> part_rows, part_entries;
+};
+
+// What one map task would see
+struct Split {
+  Split() : sentences(0), bytes(0), rows(0), entries(0), output_bytes(0) {}
+
+  string name;
+  int64_t sentences, bytes;
+  // Pseudo counts, over all directions
+  double rows, entries, output_bytes;
+};
+
+class Estimator {
+ public:
+  Estimator(const Options &opts, const PartitionMap &map, int parts, int bits)
+      : opts_(opts), map_(map), parts_(parts), bits_(bits), next_(0) {
+    directions_.push_back(opts.reverse);
+    if (opts.bidirectional)
+      directions_.push_back(!opts.reverse);
+  }
+
+  void Run(const vector<string> &inputs, int threads) {
+    inputs_ = inputs;
+    splits_.resize(inputs.size());
+    threads = max(1, min<int>(threads, inputs.size()));
+    vector<Worker *> workers;
+    boost::thread_group group;
+    for (int i = 0; i < threads; ++i) {
+      workers.push_back(new Worker(directions_.size(), parts_, bits_));
+      group.create_thread(boost::bind(&Estimator::Work, this, workers.back()));
+    }
+    group.join_all();
+    for (size_t d = 0; d < directions_.size(); ++d) {
+      tables_.push_back(workers[0]->tables[d]);
+      for (int i = 1; i < threads; ++i)
+        tables_.back().Merge(workers[i]->tables[d]);
+    }
+    for (int i = 0; i < threads; ++i)
+      delete workers[i];
+  }
+
+  void Report(ostream &out) const {
+    out << setprecision(4);
+    double total_bytes = 0;
+    vector<double> part_bytes(parts_, 0), part_rows(parts_, 0);
+    for (size_t d = 0; d < tables_.size(); ++d) {
+      const TableSketch &table = tables_[d];
+      HyperLogLog rows(bits_), entries(bits_);
+      for (int p = 0; p < parts_; ++p) {
+        rows.Merge(table.part_rows[p]);
+        entries.Merge(table.part_entries[p]);
+        const double r = table.part_rows[p].Estimate();
+        part_rows[p] += r;
+        part_bytes[p] += r * sizeof(IndexRecord) + table.part_entries[p].Estimate() * sizeof(EntryRecord);
+      }
+      const double bytes = rows.Estimate() * sizeof(IndexRecord) + entries.Estimate() * sizeof(EntryRecord);
+      total_bytes += bytes;
+      out << (directions_[d] ? "reverse " : "") << "table:" << endl
+          << "  src vocab size: " << Round(rows.Estimate()) << endl
+          << "  tgt vocab size: " << Round(table.tgt_vocab.Estimate()) << endl
+          << "  non-null pairs: " << Round(entries.Estimate()) << endl
+          << "  bytes: " << Round(bytes) << " = " << bytes / kMB << " MB" << endl;
+    }
+
+    double largest_part = 0, largest_rows = 0;
+    out << "parts:" << endl;
+    for (int p = 0; p < parts_; ++p) {
+      out << "  " << p << ": " << Round(part_bytes[p]) << " bytes, " << Round(part_rows[p]) << " rows" << endl;
+      largest_part = max(largest_part, part_bytes[p]);
+      largest_rows = max(largest_rows, part_rows[p]);
+    }
+    out << "  largest part " << largest_part * parts_ / max(total_bytes, 1.0) << " times the mean" << endl;
+
+    int64_t corpus_bytes = 0;
+    double output_bytes = 0, largest_pseudo_counts = 0, pseudo_counts_per_byte = 0;
+    out << "mappers:" << endl;
+    for (size_t i = 0; i < splits_.size(); ++i) {
+      const Split &s = splits_[i];
+      const double pseudo_counts = PseudoCountBytes(s.rows, s.entries);
+      out << "  " << s.name << ": " << s.sentences << " sentences, pseudo counts "
+          << pseudo_counts / kMB << " MB, output " << s.output_bytes / kMB << " MB" << endl;
+      corpus_bytes += s.bytes;
+      output_bytes += s.output_bytes;
+      largest_pseudo_counts = max(largest_pseudo_counts, pseudo_counts);
+      if (s.bytes > 0)
+        pseudo_counts_per_byte = max(pseudo_counts_per_byte, pseudo_counts / s.bytes);
     }
+    // Each mapper maps in the whole table besides its pseudo counts
+    out << "  largest: " << (total_bytes + largest_pseudo_counts) / kMB << " MB with the table" << endl
+        << "shuffle: " << output_bytes / kMB << " MB" << endl;
+
+    // Pseudo counts grow slower than the split, so this errs on the
+    // safe side
+    const int maps = max(1, static_cast<int>(ceil(corpus_bytes * pseudo_counts_per_byte / kPseudoCountBytes)));
+    const int reduces = max(1, static_cast<int>(ceil(total_bytes / kPartBytes)));
+    // Reducers keep the index of their part and a few copies of the
+    // longest row, at most the target vocabulary
+    double longest_row = 0;
+    for (size_t d = 0; d < tables_.size(); ++d)
+      longest_row = max(longest_row, tables_[d].tgt_vocab.Estimate());
+    const double reducer_mb = kTaskOverheadMB + (largest_rows * 64 + longest_row * 4 * sizeof(EntryRecord)) / kMB;
+    const int mem = max(1024, static_cast<int>(ceil(reducer_mb / 512)) * 512);
+    out << "suggested: MAPS=" << maps << " REDUCES=" << reduces << " MEM=" << mem << endl;
+  }
+
+ private:
+  struct Worker {
+    Worker(size_t directions, int parts, int bits) : tables(directions, TableSketch(parts, bits)) {}
+
+    vector<TableSketch> tables;
+  };
+
+  static int64_t Round(double x) {
+    return static_cast<int64_t>(x + 0.5);
   }
 
-  cerr << "sizeof(int) = " << kIntSize << endl
-       << "sizeof(long long) = " << kLongLongSize << endl
-       << "sizeof(double) = " << kDoubleSize << endl;
-
-  map<int, set<int> > src_stripes;
-  set<int> tgt_vocab;
-
-  vector<int> src, tgt;
-  string buf;
-  while (getline(cin, buf)) {
-    Tokenize(buf, reverse, &src, &tgt);
-    BOOST_FOREACH(int w, src) {
-      BOOST_FOREACH(int v, tgt) {
-        src_stripes[w].insert(v);
-        tgt_vocab.insert(v);
+  void Work(Worker *worker) {
+    for (;;) {
+      size_t i;
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        if (next_ == inputs_.size())
+          return;
+        i = next_++;
       }
+      Sketch(inputs_[i], worker, &splits_[i]);
     }
   }
 
-  size_t m = src_stripes.size();
-  size_t n = tgt_vocab.size();
-  long long bytes = kIntSize +       // count of index records
-      (m + 1) * (kIntSize + kLongLongSize + kLongLongSize) + // index size
-      n * (kIntSize + kDoubleSize);
-  size_t l = 0;
-
-  typedef pair<int, set<int> > Pair;
-  BOOST_FOREACH(const Pair &p, src_stripes) {
-    bytes += p.second.size() * (kIntSize + kDoubleSize);
-    l += p.second.size();
+  void Sketch(const string &input, Worker *worker, Split *split) const {
+    boost::scoped_ptr<ifstream> file;
+    istream *in = &cin;
+    if (input != "-") {
+      file.reset(new ifstream(input.c_str()));
+      if (!*file)
+        LOG(FATAL) << "Cannot open " << input << ": " << strerror(errno);
+      in = file.get();
+    }
+    split->name = input;
+    vector<HyperLogLog> rows(directions_.size(), HyperLogLog(bits_)), entries(rows);
+    int64_t tokens[2] = {0, 0}, digits[2] = {0, 0};
+    string line;
+    size_t id;
+    vector<WordId> sides[2];
+    while (getline(*in, line)) {
+      MapperSource::Parse(line, &id, &sides[0], &sides[1]);
+      ++split->sentences;
+      split->bytes += line.size() + 1;
+      for (int k = 0; k < 2; ++k) {
+        tokens[k] += sides[k].size();
+        for (size_t j = 0; j < sides[k].size(); ++j)
+          digits[k] += Digits(sides[k][j]);
+      }
+      for (size_t d = 0; d < directions_.size(); ++d) {
+        const vector<WordId> &src = sides[directions_[d]], &tgt = sides[!directions_[d]];
+        TableSketch &table = worker->tables[d];
+        for (size_t j = 0; j < tgt.size(); ++j) {
+          table.tgt_vocab.Add(HashWord(tgt[j]));
+          if (!opts_.no_null_word)
+            Add(kNull, tgt[j], &table, &rows[d], &entries[d]);
+          for (size_t i = 0; i < src.size(); ++i)
+            Add(src[i], tgt[j], &table, &rows[d], &entries[d]);
+        }
+      }
+    }
+    // A mapper writes each pseudo count row as a line of "src\t" and
+    // " tgt count" pairs, the count as a 19-digit int64
+    for (size_t d = 0; d < directions_.size(); ++d) {
+      const int src_side = directions_[d], tgt_side = !directions_[d];
+      const double src_digits = tokens[src_side] ? static_cast<double>(digits[src_side]) / tokens[src_side] : 1;
+      const double tgt_digits = tokens[tgt_side] ? static_cast<double>(digits[tgt_side]) / tokens[tgt_side] : 1;
+      const double r = rows[d].Estimate(), e = entries[d].Estimate();
+      split->rows += r;
+      split->entries += e;
+      split->output_bytes += r * (src_digits + 2 + (d > 0 ? 2 : 0)) + e * (tgt_digits + 21);
+    }
+  }
+
+  void Add(WordId src, WordId tgt, TableSketch *table, HyperLogLog *rows, HyperLogLog *entries) const {
+    const int part = map_.EntryPart(src, tgt);
+    const uint64_t row_hash = HashWord(src), entry_hash = HashPair(src, tgt);
+    table->part_rows[part].Add(row_hash);
+    table->part_entries[part].Add(entry_hash);
+    rows->Add(row_hash);
+    entries->Add(entry_hash);
   }
 
-  double mb = bytes / (1024.0 * 1024.0);
-  double gb = bytes / (1024.0 * 1024.0 * 1024.0);
+  const Options opts_;
+  const PartitionMap &map_;
+  const int parts_, bits_;
+  // Whether each table swaps the sides of the input
+  vector<int> directions_;
 
-  cout << "src vocab size: " << m << endl
-       << "tgt vocab size: " << n << endl
-       << "non-null pairs: " << l << endl
-       << "sparse: " << bytes << " bytes = " << setprecision(2) << mb << " MB = " << gb << " GB" << endl;
+  vector<string> inputs_;
+  vector<Split> splits_;
+  boost::mutex mutex_;
+  size_t next_;
+  vector<TableSketch> tables_;
+};
+
+void Usage(const char *prog) {
+  cerr << "Usage: " << prog << " [-j THREADS] [-b BITS] [--reverse] [FILE...]" << endl;
+  exit(1);
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+  Options opts = Options::FromEnv(1);
+  int threads = 1, bits = 12;
+  static const struct option long_options[] = {
+    {"reverse", no_argument, NULL, 'r'},
+    {NULL, 0, NULL, 0},
+  };
+  int c;
+  while ((c = getopt_long(argc, argv, "j:b:r", long_options, NULL)) != -1) {
+    switch (c) {
+      case 'j': threads = atoi(optarg); break;
+      case 'b': bits = atoi(optarg); break;
+      case 'r': opts.reverse = true; break;
+      default: Usage(argv[0]);
+    }
+  }
+  if (bits < 4 || bits > 20)
+    Usage(argv[0]);
+  PartitionMap map(opts.ttable_parts);
+  if (!opts.partition_map.empty() && (!map.Load(opts.partition_map) || map.Parts() != opts.ttable_parts))
+    LOG(FATAL) << "Cannot read a partition map for " << opts.ttable_parts << " parts from " << opts.partition_map;
 
+  vector<string> inputs(argv + optind, argv + argc);
+  if (inputs.empty())
+    inputs.push_back("-");
+  Estimator estimator(opts, map, opts.ttable_parts, bits);
+  estimator.Run(inputs, threads);
+  estimator.Report(cout);
   return 0;
 }
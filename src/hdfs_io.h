@@ -0,0 +1,212 @@
+#ifndef _PARALIGN_HDFS_IO_H_
+#define _PARALIGN_HDFS_IO_H_
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include <boost/utility.hpp>
+
+#include "contrib/log.h"
+
+namespace paralign {
+// Splits `output_dir`, which is either a plain path, a file: URI or an
+// hdfs: URI, into the namenode of the latter (empty for local paths)
+// and the path within its file system.
+inline void ParseOutputDir(const std::string &output_dir, std::string *namenode, std::string *path) {
+  std::string protocol = "file";
+  namenode->clear();
+  *path = output_dir;
+  size_t colon_pos = path->find(':');
+  if (colon_pos != std::string::npos) {
+    protocol = path->substr(0, colon_pos);
+    path->erase(0, colon_pos + 1);
+  }
+  if (protocol == "hdfs") {
+    size_t not_slash_pos = path->find_first_not_of('/');
+    if (not_slash_pos == std::string::npos)
+      LOG(FATAL) << "Ill-formed path: " << *path;
+    path->erase(0, not_slash_pos);
+    size_t slash_pos = path->find('/');
+    *namenode = "hdfs://" + path->substr(0, slash_pos);
+    path->erase(0, slash_pos);
+  } else if (protocol == "file") {
+    // file:///a/b and file:/a/b are both /a/b
+    size_t not_slash_pos = path->find_first_not_of('/');
+    if (colon_pos != std::string::npos && not_slash_pos != std::string::npos && not_slash_pos > 0)
+      path->erase(0, not_slash_pos - 1);
+  } else {
+    LOG(FATAL) << "Unknown protocol: " << protocol;
+  }
+  if (path->empty())
+    LOG(FATAL) << "Empty path in " << output_dir;
+}
+
+// libhdfs, loaded on first use so that only tasks that actually write
+// to HDFS start a JVM; these need the environment set up by pa-env.sh.
+// The types of the few functions used are those of hdfs.h, declared
+// here so that building needs no Hadoop headers.
+class Libhdfs : boost::noncopyable {
+ public:
+  typedef struct hdfs_internal *FS;
+  typedef struct hdfsFile_internal *File;
+  typedef uint16_t Port;
+  typedef int32_t Size;
+
+  static const Libhdfs &Get() {
+    static Libhdfs lib;
+    return lib;
+  }
+
+  FS (*ConnectAsUser)(const char *, Port, const char *);
+  int (*Disconnect)(FS);
+  File (*OpenFile)(FS, const char *, int, int, short, Size);
+  int (*CloseFile)(FS, File);
+  Size (*Write)(FS, File, const void *, Size);
+
+ private:
+  Libhdfs() : handle_(dlopen("libhdfs.so", RTLD_NOW | RTLD_GLOBAL)) {
+    if (handle_ == NULL)
+      LOG(FATAL) << "Cannot load libhdfs (run through pa-env.sh?): " << dlerror();
+    Load("hdfsConnectAsUser", &ConnectAsUser);
+    Load("hdfsDisconnect", &Disconnect);
+    Load("hdfsOpenFile", &OpenFile);
+    Load("hdfsCloseFile", &CloseFile);
+    Load("hdfsWrite", &Write);
+  }
+
+  template <typename F>
+  void Load(const char *name, F *f) {
+    void *symbol = dlsym(handle_, name);
+    if (symbol == NULL)
+      LOG(FATAL) << "Cannot find " << name << " in libhdfs: " << dlerror();
+    *f = reinterpret_cast<F>(symbol);
+  }
+
+  void *handle_;
+};
+
+// Connects to `namenode` (see `ParseOutputDir`) as $USER
+inline Libhdfs::FS HdfsConnect(const std::string &namenode) {
+  const char *env_user = getenv("USER");
+  if (env_user == NULL)
+    LOG(FATAL) << "Cannot read USER from env";
+  std::string user(env_user);
+
+  LOG(INFO) << "namenode: " << namenode;
+  LOG(INFO) << "user: " << user;
+
+  Libhdfs::FS fs = Libhdfs::Get().ConnectAsUser(namenode.c_str(), 0, user.c_str());
+  if (fs == NULL)
+    LOG(FATAL) << "Cannot connect to file system: " << namenode;
+  return fs;
+}
+
+// A buffered output stream to a new file `name` under `output_dir`
+// (see `ParseOutputDir`). Local paths are written directly, HDFS ones
+// through libhdfs. Used for side outputs of streaming tasks, which
+// Hadoop commits along with the task when written to
+// `mapreduce_task_output_dir`.
+class FileOutputStream : public std::ostream, boost::noncopyable {
+ public:
+  FileOutputStream(const std::string &output_dir, const std::string &name)
+      : std::ostream(NULL), buf_(output_dir, name) {
+    rdbuf(&buf_);
+  }
+
+ private:
+  class Buf : public std::streambuf {
+   public:
+    Buf(const std::string &output_dir, const std::string &name)
+        : fd_(-1), fs_(NULL), file_(NULL), data_(1 << 16) {
+      std::string namenode;
+      ParseOutputDir(output_dir, &namenode, &path_);
+      path_ += "/" + name;
+      LOG(INFO) << "out file: " << namenode << path_;
+      if (namenode.empty()) {
+        fd_ = ::open(path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd_ < 0)
+          LOG(FATAL) << "Cannot open file for write: " << path_ << ": " << std::strerror(errno);
+      } else {
+        fs_ = HdfsConnect(namenode);
+        file_ = Libhdfs::Get().OpenFile(fs_, path_.c_str(), O_WRONLY, 0, 0, 0);
+        if (file_ == NULL)
+          LOG(FATAL) << "Cannot open file for write: " << namenode << path_;
+      }
+      setp(&data_[0], &data_[0] + data_.size());
+    }
+
+    ~Buf() {
+      sync();
+      if (fd_ >= 0 && ::close(fd_) != 0)
+        LOG(FATAL) << "Failed to close " << path_ << ": " << std::strerror(errno);
+      if (fs_) {
+        Libhdfs::Get().CloseFile(fs_, file_);
+        Libhdfs::Get().Disconnect(fs_);
+      }
+    }
+
+   protected:
+    int_type overflow(int_type c) {
+      if (sync() != 0)
+        return traits_type::eof();
+      if (!traits_type::eq_int_type(c, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+      }
+      return traits_type::not_eof(c);
+    }
+
+    std::streamsize xsputn(const char *s, std::streamsize n) {
+      // Large writes skip the buffer
+      if (n < static_cast<std::streamsize>(data_.size()))
+        return std::streambuf::xsputn(s, n);
+      sync();
+      WriteRaw(s, n);
+      return n;
+    }
+
+    int sync() {
+      WriteRaw(pbase(), pptr() - pbase());
+      setp(&data_[0], &data_[0] + data_.size());
+      return 0;
+    }
+
+   private:
+    void WriteRaw(const char *p, std::streamsize n) {
+      while (n > 0) {
+        std::streamsize r;
+        if (fs_)
+          r = Libhdfs::Get().Write(fs_, file_, static_cast<const void *>(p), std::min<std::streamsize>(n, 1 << 30));
+        else
+          r = ::write(fd_, p, n);
+        if (r < 0 && errno != EINTR)
+          LOG(FATAL) << "Failed to write " << path_ << ": " << std::strerror(errno);
+        if (r > 0) {
+          p += r;
+          n -= r;
+        }
+      }
+    }
+
+    std::string path_;
+    int fd_;
+    Libhdfs::FS fs_;
+    Libhdfs::File file_;
+    std::vector<char> data_;
+  };
+
+  Buf buf_;
+};
+} // namespace paralign
+
+#endif  // _PARALIGN_HDFS_IO_H_
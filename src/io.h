@@ -1,7 +1,10 @@
 #ifndef _PARALIGN_IO_H_
 #define _PARALIGN_IO_H_
 
+#include <cerrno>
+#include <cstdlib>
 #include <iostream>
+#include <limits>
 #include <string>
 #include <sstream>
 #include <vector>
@@ -18,6 +21,53 @@ const WordId kSizeCountsKey = -2;
 const WordId kEmpFeatKey = -3;
 const WordId kToksKey = -4;
 const WordId kLogLikelihoodKey = -5;
+// Partial totals of rows sharded by the partition map
+const WordId kRowTotalKey = -6;
+// How far the rows of a reducer moved from the previous table
+const WordId kTableChangeKey = -7;
+
+// In bidirectional training, both directions share the stream: the
+// statistics keys of the reverse direction are shifted by
+// `kReverseKeyOffset` and its ttable rows are tagged with
+// `kReverseTag` in front of the value.
+enum Direction {
+  kForwardDirection = 0,
+  kReverseDirection = 1,
+};
+
+const WordId kReverseKeyOffset = -10;
+const char kReverseTag = 'r';
+
+// Ttable entries with float counts (see `WriteFloat`) are tagged with
+// `kFloatTag`, after any direction tag
+const char kFloatTag = 'f';
+
+inline WordId StatKey(WordId key, Direction dir) {
+  return dir == kReverseDirection ? key + kReverseKeyOffset : key;
+}
+
+inline Direction StatKeyDirection(WordId key) {
+  return key <= kReverseKeyOffset ? kReverseDirection : kForwardDirection;
+}
+
+// Inverse of `StatKey`
+inline WordId ForwardStatKey(WordId key) {
+  return key <= kReverseKeyOffset ? key - kReverseKeyOffset : key;
+}
+
+// Index of the current Hadoop task
+inline std::string GetTaskPartition() {
+  const char *env = getenv("mapred_task_partition");
+  if (env == NULL) env = getenv("mapreduce_task_partition");
+  if (env == NULL) LOG(FATAL) << "Cannot find partition!";
+  return std::string(env);
+}
+
+// Increments a Hadoop streaming counter, which is picked up from
+// stderr.
+inline void ReportCounter(const std::string &name, int64_t amount) {
+  std::cerr << "reporter:counter:paralign," << name << ',' << std::dec << amount << std::endl;
+}
 
 // Reads from an input stream; the input records of the mapper is just
 // lines, where each line is a tab-delimited integerized sentence
@@ -37,22 +87,41 @@ class MapperSource {
   }
 
   void Read(size_t *id, std::vector<WordId> *src, std::vector<WordId> *tgt) const {
-    std::string::size_type sep0 = buf_.find('\t');
+    Parse(buf_, id, src, tgt);
+    ++counter_;
+  }
+
+  // Parses a single input line
+  static void Parse(const std::string &line, size_t *id, std::vector<WordId> *src, std::vector<WordId> *tgt) {
+    std::string::size_type sep0 = line.find('\t');
     if (sep0 == std::string::npos)
-      LOG(FATAL) << "Invalid input line: " << buf_;
-    *id = boost::lexical_cast<size_t>(buf_.substr(0, sep0));
-    std::string::size_type sep1 = buf_.find('\t', sep0 + 1);
+      LOG(FATAL) << "Invalid input line: " << line;
+    *id = boost::lexical_cast<size_t>(line.substr(0, sep0));
+    std::string::size_type sep1 = line.find('\t', sep0 + 1);
     if (sep1 == std::string::npos)
-      LOG(FATAL) << "Invalid input line: " << buf_;
+      LOG(FATAL) << "Invalid input line: " << line;
     {
-      std::istringstream strm(buf_.substr(sep0 + 1, sep1 - sep0 - 1));
+      std::istringstream strm(line.substr(sep0 + 1, sep1 - sep0 - 1));
       PushWords(strm, src);
     }
     {
-      std::istringstream strm(buf_.substr(sep1 + 1));
+      std::istringstream strm(line.substr(sep1 + 1));
       PushWords(strm, tgt);
     }
-    ++counter_;
+  }
+
+  // Like `Parse`, but returns false instead of dying when the line is
+  // not a sentence id and two tab-separated lists of word ids, or when
+  // an id is out of range
+  static bool TryParse(const std::string &line, size_t *id, std::vector<WordId> *src, std::vector<WordId> *tgt) {
+    const char *p = line.c_str();
+    unsigned long long value;
+    if (!ReadNumber(&p, std::numeric_limits<size_t>::max(), &value) || *p++ != '\t')
+      return false;
+    *id = value;
+    if (!ReadWords(&p, src) || *p++ != '\t')
+      return false;
+    return ReadWords(&p, tgt) && p == line.c_str() + line.size();
   }
 
   void Next() {
@@ -62,7 +131,7 @@ class MapperSource {
   }
 
  private:
-  void PushWords(std::istringstream &strm, std::vector<WordId> *out) const {
+  static void PushWords(std::istringstream &strm, std::vector<WordId> *out) {
     WordId tok;
     out->clear();
     while (strm >> tok)
@@ -71,6 +140,36 @@ class MapperSource {
       LOG(FATAL) << "Failed to read input words! Are they integers?";
   }
 
+  // Reads the decimal number at `*p` if it is at most `max`, and moves
+  // `*p` past it
+  static bool ReadNumber(const char **p, unsigned long long max, unsigned long long *value) {
+    if (**p < '0' || **p > '9')
+      return false;
+    char *end;
+    errno = 0;
+    *value = strtoull(*p, &end, 10);
+    if (errno == ERANGE || *value > max)
+      return false;
+    *p = end;
+    return true;
+  }
+
+  // Reads space-separated word ids up to the next tab or the end
+  static bool ReadWords(const char **p, std::vector<WordId> *out) {
+    out->clear();
+    for (;;) {
+      while (**p == ' ')
+        ++*p;
+      if (**p == '\t' || **p == '\0')
+        return true;
+      unsigned long long value;
+      if (!ReadNumber(p, std::numeric_limits<WordId>::max(), &value) ||
+          (**p != ' ' && **p != '\t' && **p != '\0'))
+        return false;
+      out->push_back(value);
+    }
+  }
+
   std::istream &in_;
   bool done_;
   std::string buf_;
@@ -100,16 +199,45 @@ class ReducerSource {
   }
 
   void Read(TTableEntry *entry) const {
-    std::istringstream strm(buf_);
-    strm >> *entry;
+    ParseEntry(buf_, entry);
     ++counter_;
   }
 
+  // Direction of the ttable entry in the current value
+  Direction EntryDirection() const {
+    return ValueDirection(buf_);
+  }
+
+  static Direction ValueDirection(const std::string &value) {
+    return !value.empty() && value[0] == kReverseTag ? kReverseDirection : kForwardDirection;
+  }
+
+  // Parses a ttable entry value, with or without the direction and
+  // float tags; counts are doubles either way
+  static void ParseEntry(const std::string &value, TTableEntry *entry) {
+    std::istringstream strm(value);
+    if (ValueDirection(value) == kReverseDirection)
+      strm.ignore(1);
+    strm >> std::ws;
+    if (strm.peek() == kFloatTag) {
+      strm.ignore(1);
+      ReadFloat(strm, *entry);
+    } else {
+      strm >> *entry;
+    }
+  }
+
   void Read(double *dest) const {
     *dest = DoubleFromInt64(boost::lexical_cast<int64_t>(buf_));
     ++counter_;
   }
 
+  // Raw value, for deferring the parsing to somewhere else
+  void Read(std::string *dest) const {
+    *dest = buf_;
+    ++counter_;
+  }
+
   void Next() {
     if (done_)
       LOG(FATAL) << "Iterator has reached the end";
@@ -136,22 +264,35 @@ class ReducerSource {
 
 // Writes out key-value pairs for various purposes in textual
 // format. Currently this can be shared between mappers and reducers.
+// Statistics of the reverse direction of bidirectional training are
+// written under their own keys, see `StatKey`. With `float_counts`,
+// ttable entries are written with float counts.
 class Sink {
  public:
-  explicit Sink(std::ostream &output) : out_(output), counter_(0) {}
+  explicit Sink(std::ostream &output, Direction dir = kForwardDirection, bool float_counts = false)
+      : out_(output), dir_(dir), float_counts_(float_counts), counter_(0) {}
 
   ~Sink() {
     LOG(INFO) << "Sink[" << std::hex << this << "] " << std::dec << counter_ << " writes";
   }
 
   void WriteTTableEntry(WordId src, const TTableEntry &entry) {
-    out_ << src << '\t' << entry << '\n';
+    out_ << src << '\t';
+    if (dir_ == kReverseDirection)
+      out_ << kReverseTag << ' ';
+    if (float_counts_) {
+      out_ << kFloatTag << ' ';
+      WriteFloat(out_, entry);
+    } else {
+      out_ << entry;
+    }
+    out_ << '\n';
     ++counter_;
   }
 
   template <class It>
   void WriteSizeCounts(It begin, It end) {
-    out_ << kSizeCountsKey << '\t';
+    out_ << StatKey(kSizeCountsKey, dir_) << '\t';
     bool first = true;
     while (begin != end) {
       if (first)
@@ -166,17 +307,31 @@ class Sink {
   }
 
   void WriteToks(double toks) {
-    out_ << kToksKey << '\t' << DoubleAsInt64(toks) << '\n';
+    out_ << StatKey(kToksKey, dir_) << '\t' << DoubleAsInt64(toks) << '\n';
     ++counter_;
   }
 
   void WriteEmpFeat(double emp_feat) {
-    out_ << kEmpFeatKey << '\t' << DoubleAsInt64(emp_feat) << '\n';
+    out_ << StatKey(kEmpFeatKey, dir_) << '\t' << DoubleAsInt64(emp_feat) << '\n';
     ++counter_;
   }
 
   void WriteLogLikelihood(double log_likelihood) {
-    out_ << kLogLikelihoodKey << '\t' << DoubleAsInt64(log_likelihood) << '\n';
+    out_ << StatKey(kLogLikelihoodKey, dir_) << '\t' << DoubleAsInt64(log_likelihood) << '\n';
+    ++counter_;
+  }
+
+  // Sum and size of the counts of a sharded row in one part, see
+  // `RowScale`
+  void WriteRowTotal(WordId src, double sum, int64_t size) {
+    out_ << StatKey(kRowTotalKey, dir_) << '\t' << src << ' ' << DoubleAsInt64(sum) << ' ' << size << '\n';
+    ++counter_;
+  }
+
+  // Summed change of `rows` rows from the previous table, see
+  // `Reducer::SetPreviousTable`
+  void WriteTableChange(double change, int64_t rows) {
+    out_ << StatKey(kTableChangeKey, dir_) << '\t' << DoubleAsInt64(change) << ' ' << rows << '\n';
     ++counter_;
   }
 
@@ -187,6 +342,8 @@ class Sink {
 
  private:
   std::ostream &out_;
+  const Direction dir_;
+  const bool float_counts_;
   mutable size_t counter_;
 };
 
@@ -205,6 +362,26 @@ class ViterbiSink {
   template <class It>
   void WriteAlignment(size_t id, It begin, It end) {
     out_ << id << '\t';
+    WritePoints(begin, end);
+    out_ << '\n';
+    ++counter_;
+  }
+
+  // Both directions of bidirectional training on one line, both with
+  // points given as (source, target) of the forward direction
+  template <class It>
+  void WriteAlignments(size_t id, It forward_begin, It forward_end, It reverse_begin, It reverse_end) {
+    out_ << id << '\t';
+    WritePoints(forward_begin, forward_end);
+    out_ << '\t';
+    WritePoints(reverse_begin, reverse_end);
+    out_ << '\n';
+    ++counter_;
+  }
+
+ private:
+  template <class It>
+  void WritePoints(It begin, It end) {
     bool first = true;
     while (begin != end) {
       if (first)
@@ -214,11 +391,8 @@ class ViterbiSink {
       out_ << FirstSz(*begin) << '-' << SecondSz(*begin);
       ++begin;
     }
-    out_ << '\n';
-    ++counter_;
   }
 
- private:
   std::ostream &out_;
   size_t counter_;
 };
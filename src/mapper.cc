@@ -1,95 +1,362 @@
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <limits>
 #include <map>
 #include <utility>
 #include <vector>
 #include <boost/foreach.hpp>
+#include <boost/format.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/utility.hpp>
 
+#include "counters.h"
+#include "estep.h"
+#include "hdfs_io.h"
 #include "io.h"
 #include "options.h"
+#include "partition.h"
 #include "ttable.h"
 #include "types.h"
-#include "contrib/da.h"
 
 using namespace std;
 
 namespace paralign {
+// A sentence read ahead by `SortBuffer`, with room for its alignments
+struct BufferedSentence {
+  size_t id;
+  vector<WordId> src, tgt;
+  vector<SentSzPair> al, reverse_al;
+};
+
+// Reads windows of input sentences and hands them out grouped by
+// (target length, source length), so that consecutive sentences share
+// the diagonal prior and scratch sizes. Within a group, sentences are
+// ordered by their largest source word id: ids are given out in order
+// of first appearance, so sentences sharing a rare word, and with it
+// table rows, end up next to each other.
+class SortBuffer : boost::noncopyable {
+ public:
+  explicit SortBuffer(size_t size) : sentences_(size), size_(0) {}
+
+  // Reads the next window; false at the end of the input
+  bool Fill(MapperSource *in) {
+    size_ = 0;
+    keys_.clear();
+    for (; size_ < sentences_.size() && !in->Done(); in->Next()) {
+      BufferedSentence &s = sentences_[size_];
+      in->Read(&s.id, &s.src, &s.tgt);
+      Key key;
+      key.tgt_size = s.tgt.size();
+      key.src_size = s.src.size();
+      key.rare = s.src.empty() ? 0 : *max_element(s.src.begin(), s.src.end());
+      key.index = size_++;
+      keys_.push_back(key);
+    }
+    sort(keys_.begin(), keys_.end());
+    return size_ > 0;
+  }
+
+  size_t Size() const {
+    return size_;
+  }
+
+  // The k-th sentence in input order
+  BufferedSentence &operator[](size_t k) {
+    return sentences_[k];
+  }
+
+  // The k-th sentence in processing order
+  BufferedSentence &Sorted(size_t k) {
+    return sentences_[keys_[k].index];
+  }
+
+ private:
+  struct Key {
+    size_t tgt_size, src_size;
+    WordId rare;
+    size_t index;
+
+    bool operator<(const Key &that) const {
+      if (tgt_size != that.tgt_size)
+        return tgt_size < that.tgt_size;
+      if (src_size != that.src_size)
+        return src_size < that.src_size;
+      if (rare != that.rare)
+        return rare < that.rare;
+      return index < that.index;
+    }
+  };
+
+  vector<BufferedSentence> sentences_;
+  vector<Key> keys_;
+  size_t size_;
+};
+
 // For each sentence, the mapper collects the following statistics:
 // 1. size_counts (for computing the gradient of diagonal_tension), key: kSizeCountsKey
 // 2. emp_feat, key: kEmpFeatKey
 // 3. toks, key: kToksKey (denom is just toks)
 // 4. pseudo_count, key: src word id
 // 5. log-likelihood, key: kLogLikelihoodKey
+// With `viterbi_output`, it also finds the Viterbi alignment of each
+// sentence from the same posteriors and, when given a `ViterbiSink`,
+// writes it out. In bidirectional training, one mapper per direction
+// is fed the same sentences via `Process`. With `mapper_sort_buffer`,
+// sentences are processed grouped by length (see `SortBuffer`);
+// alignments are still written in input order. Given enabled
+// `TaskCounters`, it also counts lookups and times its phases. Rows
+// sharded by the partition map given to `SetPartitionMap` are split
+// into their shards' keys. Posteriors are computed in
+// `compute_precision`; counts and the log-likelihood are summed in
+// double, and target words whose likelihood falls below the float
+// range are done in double.
 class Mapper {
  public:
-  Mapper(const Options &opts, const TTable &table, MapperSource *input, MapperSink *output)
-      : opts_(opts), tbl_(table), in_(input), out_(output), pseudo_counts_(),
-        size_counts_(), toks_(0), emp_feat_(0), log_likelihood_(0) {}
+  Mapper(const Options &opts, const TTable &table, MapperSource *input, MapperSink *output,
+         ViterbiSink *viterbi = NULL, TaskCounters *counters = NULL)
+      : opts_(opts), tbl_(table), in_(input), out_(output), viterbi_(viterbi), map_(NULL), pseudo_counts_(),
+        size_counts_(), toks_(0), emp_feat_(0), log_likelihood_(0),
+        budget_bytes_(static_cast<size_t>(opts.mapper_memory_mb) << 20),
+        rows_(0), cells_(0), peak_bytes_(0), peak_cells_(0), flushes_(0), double_fallbacks_(0),
+        counters_(counters), count_lookups_(counters && counters->Enabled()), lookups_(0), misses_(0),
+        parse_time_(counters ? counters->Timer("parse") : NULL),
+        estep_time_(counters ? counters->Timer("estep") : NULL),
+        flush_time_(counters ? counters->Timer("flush") : NULL),
+        map_kernel_(SelectMap(opts)), priors_(opts, true), float_priors_(opts, true) {}
 
   void Run() {
+    size_t sentences = 0;
+    if (opts_.mapper_sort_buffer > 0) {
+      SortBuffer buffer(opts_.mapper_sort_buffer);
+      for (;;) {
+        {
+          PhaseTimer timer(parse_time_);
+          if (!buffer.Fill(in_))
+            break;
+        }
+        PhaseTimer timer(estep_time_);
+        for (size_t k = 0; k < buffer.Size(); ++k) {
+          BufferedSentence &s = buffer.Sorted(k);
+          Process(s.src, s.tgt);
+          if (viterbi_)
+            s.al = al_;
+          if (counters_)
+            counters_->Progress(++sentences, "sentences");
+        }
+        for (size_t k = 0; viterbi_ && k < buffer.Size(); ++k)
+          viterbi_->WriteAlignment(buffer[k].id, buffer[k].al.begin(), buffer[k].al.end());
+      }
+      if (counters_)
+        counters_->Add("sentences", sentences);
+      Finish();
+      return;
+    }
     size_t id;
     vector<WordId> src, tgt;
     for (; !in_->Done(); in_->Next()) {
-      in_->Read(&id, &src, &tgt);
-      if (opts_.reverse) swap(src, tgt);
-      Map(src, tgt);
+      {
+        PhaseTimer timer(parse_time_);
+        in_->Read(&id, &src, &tgt);
+      }
+      {
+        PhaseTimer timer(estep_time_);
+        Process(src, tgt);
+      }
+      if (viterbi_)
+        viterbi_->WriteAlignment(id, al_.begin(), al_.end());
+      if (counters_)
+        counters_->Progress(++sentences, "sentences");
     }
+    if (counters_)
+      counters_->Add("sentences", sentences);
+    Finish();
+  }
+
+  // Partition map of the next table, when it shards rows
+  void SetPartitionMap(const PartitionMap *map) {
+    map_ = map;
+  }
+
+  // Collects statistics of one sentence pair as given in the input,
+  // i.e. before swapping for the reverse direction
+  void Process(const vector<WordId> &src, const vector<WordId> &tgt) {
+    if (opts_.reverse)
+      (this->*map_kernel_)(tgt, src);
+    else
+      (this->*map_kernel_)(src, tgt);
+  }
+
+  // Alignment found by the last `Process` with `viterbi_output`
+  const vector<SentSzPair> &LastAlignment() const {
+    return al_;
+  }
+
+  // Writes out what's left; call once after all sentences
+  void Finish() {
     Flush();
   }
 
  private:
+  template <bool, bool, class> friend struct LinkKernel;
+  typedef void (Mapper::*MapFunction)(const vector<WordId> &, const vector<WordId> &);
+
+  static MapFunction SelectMap(const Options &opts) {
+    if (opts.compute_precision == "float")
+      return SelectMap<float>(opts);
+    return SelectMap<double>(opts);
+  }
+
+  template <class Real>
+  static MapFunction SelectMap(const Options &opts) {
+    if (opts.no_null_word)
+      return opts.favor_diagonal ? &Mapper::Map<false, true, Real> : &Mapper::Map<false, false, Real>;
+    return opts.favor_diagonal ? &Mapper::Map<true, true, Real> : &Mapper::Map<true, false, Real>;
+  }
+
+  template <bool kNullWord, bool kDiagonal, class Real>
   void Map(const vector<WordId> &src, const vector<WordId> &tgt) {
     toks_ += tgt.size();
+    al_.clear();
     ++size_counts_[MkSzPair(tgt.size(), src.size())];
 
-    probs_.resize(src.size() + 1);
-
+    vector<Real> &probs = Probs(Real());
+    BasicCellPriors<Real> &priors = Priors(Real());
+    probs.resize(src.size() + 1);
+    priors.Set(tgt.size(), src.size(), opts_.diagonal_tension);
     for (size_t j = 0; j < tgt.size(); ++j) {
-      const WordId f_j = tgt[j];
-      double sum = 0;
-      double prob_a_i = 1.0 / (src.size() + !opts_.no_null_word);  // uniform (model 1)
-      if (!opts_.no_null_word) {
-        if (opts_.favor_diagonal) prob_a_i = opts_.prob_align_null;
-        probs_[0] = tbl_.Query(kNull, f_j) * prob_a_i;
-        sum += probs_[0];
-      }
-      double az = 0;
-      if (opts_.favor_diagonal)
-        az = DiagonalAlignment::ComputeZ(j+1, tgt.size(), src.size(), opts_.diagonal_tension) / (1 - opts_.prob_align_null);
-      for (unsigned i = 1; i <= src.size(); ++i) {
-        if (opts_.favor_diagonal)
-          prob_a_i = DiagonalAlignment::UnnormalizedProb(j + 1, i, tgt.size(), src.size(), opts_.diagonal_tension) / az;
-        probs_[i] = tbl_.Query(src[i-1], f_j) * prob_a_i;
-        sum += probs_[i];
-      }
-      if (!opts_.no_null_word) {
-        double count = probs_[0] / sum;
-        pseudo_counts_[kNull][f_j] += count;
-      }
-      for (unsigned i = 1; i <= src.size(); ++i) {
-        const double p = probs_[i] / sum;
-        pseudo_counts_[src[i-1]][f_j] += p;
-        emp_feat_ += DiagonalAlignment::Feature(j, i, tgt.size(), src.size()) * p;
-      }
-      log_likelihood_ += log(sum);
+      if (MapWord<kNullWord, kDiagonal>(*this, src, tgt, j, priors, &probs[0]))
+        continue;
+      // Redone in double straight from the table, as the lookups were
+      // counted by the first try
+      probs_.resize(src.size() + 1);
+      priors_.Set(tgt.size(), src.size(), opts_.diagonal_tension);
+      MapWord<kNullWord, kDiagonal>(tbl_, src, tgt, j, priors_, &probs_[0]);
+      ++double_fallbacks_;
     }
-    // We use in-mapper combining and only write at the end.
+    // We use in-mapper combining and only write at the end, unless
+    // that takes more memory than allowed.
+    const size_t bytes = PseudoCountBytes();
+    if (bytes > peak_bytes_)
+      peak_bytes_ = bytes;
+    if (cells_ > peak_cells_)
+      peak_cells_ = cells_;
+    if (budget_bytes_ > 0 && bytes > budget_bytes_) {
+      FlushPseudoCounts();
+      ++flushes_;
+    }
+  }
+
+  // E-step of target word `j` given the `priors` of its sentence and
+  // room for its `probs`, looking up `table`; in float, returns false
+  // without doing anything when its likelihood is below the float range
+  template <bool kNullWord, bool kDiagonal, class Table, class Real>
+  bool MapWord(Table &table, const vector<WordId> &src, const vector<WordId> &tgt, size_t j,
+               const BasicCellPriors<Real> &priors, Real *probs) {
+    typedef LinkKernel<kNullWord, kDiagonal, Real> Kernel;
+    const WordId f_j = tgt[j];
+    const Real sum = Kernel::Joint(table, f_j, src, priors.Prior(j), opts_.prob_align_null, probs);
+    if (sizeof(Real) < sizeof(double) && sum < numeric_limits<Real>::min())
+      return false;
+    Kernel::Expect(probs, sum, f_j, src, priors.Feature(j), this, &emp_feat_);
+    log_likelihood_ += log(static_cast<double>(sum));
+    // Same decision rule as pa-viterbi
+    if (opts_.viterbi_output)
+      AddAlignmentPoint(j, Kernel::Best(probs, src.size()), opts_.reverse, &al_);
+    return true;
+  }
+
+  // Scratch of `Map` in each precision, picked by the type of the tag
+  vector<double> &Probs(double) {
+    return probs_;
+  }
 
-    // TODO: see how much memory this uses and set a buffering limit
-    // for `pseudo_counts_`.
+  vector<float> &Probs(float) {
+    return float_probs_;
+  }
+
+  BasicCellPriors<double> &Priors(double) {
+    return priors_;
+  }
+
+  BasicCellPriors<float> &Priors(float) {
+    return float_priors_;
+  }
+
+  double Query(WordId src, WordId tgt) {
+    const double p = tbl_.Query(src, tgt);
+    if (count_lookups_) {
+      ++lookups_;
+      misses_ += p == kDefaultProbability;
+    }
+    return p;
+  }
+
+  void AddPseudoCount(WordId src, WordId tgt, double count) {
+    pair<map<WordId, map<WordId, double> >::iterator, bool> row =
+        pseudo_counts_.insert(make_pair(src, map<WordId, double>()));
+    rows_ += row.second;
+    pair<map<WordId, double>::iterator, bool> cell = row.first->second.insert(make_pair(tgt, 0.0));
+    cells_ += cell.second;
+    cell.first->second += count;
+  }
+
+  // Rough size of `pseudo_counts_`: each map node carries a key-value
+  // pair plus three pointers and a color, padded by malloc.
+  size_t PseudoCountBytes() const {
+    const size_t kNodeOverhead = 4 * sizeof(void *) + 2 * sizeof(size_t);
+    return rows_ * (sizeof(pair<WordId, map<WordId, double> >) + kNodeOverhead) +
+        cells_ * (sizeof(pair<WordId, double>) + kNodeOverhead);
   }
 
   void Flush() {
     FlushPseudoCounts();
-    out_->WriteSizeCounts(size_counts_.begin(), size_counts_.end());
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    LOG(INFO) << "Mapper: " << flushes_ << " partial flushes, peak pseudo counts "
+              << (peak_bytes_ >> 20) << " MB, peak RSS " << (usage.ru_maxrss >> 10) << " MB";
+    if (opts_.emit_size_counts)
+      out_->WriteSizeCounts(size_counts_.begin(), size_counts_.end());
     out_->WriteToks(toks_);
     out_->WriteEmpFeat(emp_feat_);
     out_->WriteLogLikelihood(log_likelihood_);
+    if (counters_) {
+      counters_->Add("tokens", toks_);
+      counters_->Add("lookups", lookups_);
+      counters_->Add("lookup_misses", misses_);
+      counters_->Add("partial_flushes", flushes_);
+      counters_->Max("peak_pseudo_count_mb", peak_bytes_ >> 20);
+      counters_->Max("peak_pseudo_count_cells", peak_cells_);
+      counters_->Max("peak_rss_mb", usage.ru_maxrss >> 10);
+      counters_->Add("double_fallbacks", double_fallbacks_);
+    }
   }
 
   void FlushPseudoCounts() {
+    PhaseTimer timer(flush_time_);
     typedef pair<WordId, map<WordId, double> > P;
     BOOST_FOREACH(const P &i, pseudo_counts_) {
-      out_->WriteTTableEntry(i.first, TTableEntry(i.second));
+      if (map_ && map_->Sharded(i.first))
+        WriteShards(i.first, i.second);
+      else
+        out_->WriteTTableEntry(i.first, TTableEntry(i.second));
+    }
+    pseudo_counts_.clear();
+    rows_ = cells_ = 0;
+  }
+
+  void WriteShards(WordId src, const map<WordId, double> &row) {
+    size_t first, end;
+    map_->ShardRange(src, &first, &end);
+    map<WordId, double>::const_iterator begin = row.begin();
+    for (size_t i = first; i < end && begin != row.end(); ++i) {
+      map<WordId, double>::const_iterator stop =
+          i + 1 < end ? row.lower_bound(map_->GetShard(i + 1).begin) : row.end();
+      if (begin != stop)
+        out_->WriteTTableEntry(PartitionMap::ShardKey(i), TTableEntry(map<WordId, double>(begin, stop)));
+      begin = stop;
     }
   }
 
@@ -97,6 +364,8 @@ class Mapper {
   const TTable &tbl_;
   MapperSource *in_;
   MapperSink *out_;
+  ViterbiSink *viterbi_;
+  const PartitionMap *map_;
 
   map<WordId, map<WordId, double> > pseudo_counts_;
   map<SentSzPair, int> size_counts_;
@@ -104,7 +373,27 @@ class Mapper {
   double emp_feat_;
   double log_likelihood_;
 
+  // Memory accounting of `pseudo_counts_`
+  const size_t budget_bytes_;
+  size_t rows_, cells_, peak_bytes_, peak_cells_;
+  int flushes_;
+  // Target words `compute_precision` float could not handle
+  int64_t double_fallbacks_;
+
+  TaskCounters *counters_;
+  const bool count_lookups_;
+  int64_t lookups_, misses_;
+  double *parse_time_, *estep_time_, *flush_time_;
+
   vector<double> probs_;
+  vector<float> float_probs_;
+  vector<SentSzPair> al_;
+
+  // Specialization of `Map` for the options
+  const MapFunction map_kernel_;
+  // Diagonal prior and alignment feature of the last sentence lengths
+  CellPriors priors_;
+  BasicCellPriors<float> float_priors_;
 };
 } // namespace paralign
 
@@ -116,11 +405,97 @@ int main() {
   LOG(INFO) << "Options:" << endl
             << opts << endl;
 
-  TTable table(opts.ttable_dir, opts.ttable_parts);
+  TaskCounters counters("mapper", opts.counters);
+  counters.CountBytes(&cin, &cout);
   MapperSource input(cin);
-  MapperSink output(cout);
+  MapperSink output(cout, kForwardDirection, opts.float_counts);
+
+  // Side output named after the task, with the sentences of its split
+  // in input order (see pa-merge-viterbi)
+  boost::scoped_ptr<FileOutputStream> viterbi_stream;
+  boost::scoped_ptr<ViterbiSink> viterbi;
+  if (opts.viterbi_output) {
+    const char *mapreduce_task_output_dir = getenv("mapreduce_task_output_dir");
+    if (mapreduce_task_output_dir == NULL)
+      LOG(FATAL) << "Cannot read mapreduce_task_output_dir from env; are you using hadoop?";
+    string name = (boost::format("viterbi.%05d") % atoi(GetTaskPartition().c_str())).str();
+    viterbi_stream.reset(new FileOutputStream(mapreduce_task_output_dir, name));
+    viterbi.reset(new ViterbiSink(*viterbi_stream));
+  }
 
-  Mapper(opts, table, &input, &output).Run();
+  // Only needed for its shards
+  PartitionMap map(opts.ttable_parts);
+  if (!opts.partition_map.empty() && !map.Load(opts.partition_map))
+    LOG(FATAL) << "Cannot read partition map " << opts.partition_map;
+  const PartitionMap *shard_map = map.NumShards() > 0 ? &map : NULL;
+
+  if (!opts.bidirectional) {
+    TTable table(opts.ttable_dir, opts.ttable_parts);
+    Mapper mapper(opts, table, &input, &output, viterbi.get(), &counters);
+    mapper.SetPartitionMap(shard_map);
+    mapper.Run();
+    counters.Report();
+    return 0;
+  }
+
+  // Both directions from a single read of the input
+  TTable table(opts.ttable_dir, opts.ttable_parts);
+  TTable reverse_table(opts.ttable_dir, opts.ttable_parts, kReversePrefix);
+  MapperSink reverse_output(cout, kReverseDirection, opts.float_counts);
+  Mapper forward(opts, table, &input, &output, NULL, &counters);
+  Mapper reverse(opts.Reversed(), reverse_table, &input, &reverse_output, NULL, &counters);
+  forward.SetPartitionMap(shard_map);
+  reverse.SetPartitionMap(shard_map);
+  double *parse_time = counters.Timer("parse"), *estep_time = counters.Timer("estep");
+  size_t sentences = 0;
+  if (opts.mapper_sort_buffer > 0) {
+    SortBuffer buffer(opts.mapper_sort_buffer);
+    for (;;) {
+      {
+        PhaseTimer timer(parse_time);
+        if (!buffer.Fill(&input))
+          break;
+      }
+      PhaseTimer timer(estep_time);
+      for (size_t k = 0; k < buffer.Size(); ++k) {
+        BufferedSentence &s = buffer.Sorted(k);
+        forward.Process(s.src, s.tgt);
+        reverse.Process(s.src, s.tgt);
+        if (viterbi) {
+          s.al = forward.LastAlignment();
+          s.reverse_al = reverse.LastAlignment();
+        }
+        counters.Progress(++sentences, "sentences");
+      }
+      for (size_t k = 0; viterbi && k < buffer.Size(); ++k) {
+        const BufferedSentence &s = buffer[k];
+        viterbi->WriteAlignments(s.id, s.al.begin(), s.al.end(), s.reverse_al.begin(), s.reverse_al.end());
+      }
+    }
+  } else {
+    size_t id;
+    vector<WordId> src, tgt;
+    for (; !input.Done(); input.Next()) {
+      {
+        PhaseTimer timer(parse_time);
+        input.Read(&id, &src, &tgt);
+      }
+      {
+        PhaseTimer timer(estep_time);
+        forward.Process(src, tgt);
+        reverse.Process(src, tgt);
+      }
+      if (viterbi) {
+        const vector<SentSzPair> &fa = forward.LastAlignment(), &ra = reverse.LastAlignment();
+        viterbi->WriteAlignments(id, fa.begin(), fa.end(), ra.begin(), ra.end());
+      }
+      counters.Progress(++sentences, "sentences");
+    }
+  }
+  counters.Add("sentences", sentences);
+  forward.Finish();
+  reverse.Finish();
+  counters.Report();
 
   return 0;
 }
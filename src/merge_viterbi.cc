@@ -0,0 +1,125 @@
+// pa-merge-viterbi: merges Viterbi alignments written in pieces, e.g.
+// by the map tasks of the Viterbi job, into a single file in sentence
+// order.
+//
+// Usage: pa-merge-viterbi [FILE...]
+//
+// Each FILE (stdin by default) holds `id\t...` lines sorted by id, as
+// pa-viterbi writes them for a split of the corpus. Pieces are taken in
+// order of their first id and copied line by line until another piece
+// comes first, so pieces covering separate id ranges are simply
+// concatenated, in time linear in the output; pieces whose ranges
+// interleave are merged. Empty FILEs (such as `_SUCCESS`) are skipped.
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <queue>
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/utility.hpp>
+
+#include "contrib/log.h"
+
+using namespace std;
+
+namespace paralign {
+// One input file and its current line
+class Piece : boost::noncopyable {
+ public:
+  explicit Piece(const string &name) : name_(name), in_(&cin), id_(0), lines_(0) {
+    if (name != "-") {
+      file_.reset(new ifstream(name.c_str()));
+      if (!*file_)
+        LOG(FATAL) << "Cannot open " << name << ": " << strerror(errno);
+      in_ = file_.get();
+    }
+  }
+
+  // Reads the next line and its id, checking that ids go up; returns
+  // false at the end
+  bool Advance() {
+    if (!getline(*in_, line_))
+      return false;
+    const char *begin = line_.c_str();
+    char *end;
+    errno = 0;
+    unsigned long v = strtoul(begin, &end, 10);
+    if (end == begin || (*end != '\t' && *end != '\0') || errno != 0)
+      LOG(FATAL) << "Invalid line " << lines_ + 1 << " in " << name_ << ": " << line_;
+    if (lines_ > 0 && v <= id_)
+      LOG(FATAL) << name_ << " is not sorted by id at line " << lines_ + 1 << " (id " << v << ")";
+    id_ = v;
+    ++lines_;
+    return true;
+  }
+
+  const string &Name() const {
+    return name_;
+  }
+
+  const string &Line() const {
+    return line_;
+  }
+
+  size_t Id() const {
+    return id_;
+  }
+
+ private:
+  string name_;
+  boost::scoped_ptr<ifstream> file_;
+  istream *in_;
+  string line_;
+  size_t id_;
+  size_t lines_;
+};
+} // namespace paralign
+
+using namespace paralign;
+
+int main(int argc, char *argv[]) {
+  ios::sync_with_stdio(false);
+  vector<string> inputs(argv + 1, argv + argc);
+  if (inputs.empty())
+    inputs.push_back("-");
+
+  // Current id and index of each piece not yet done, smallest id first
+  typedef pair<size_t, size_t> Head;
+  priority_queue<Head, vector<Head>, greater<Head> > heads;
+  boost::ptr_vector<Piece> pieces;
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    pieces.push_back(new Piece(inputs[i]));
+    if (pieces.back().Advance())
+      heads.push(Head(pieces.back().Id(), i));
+  }
+
+  size_t lines = 0, runs = 0, last_id = 0;
+  while (!heads.empty()) {
+    const size_t index = heads.top().second;
+    Piece &piece = pieces[index];
+    heads.pop();
+    ++runs;
+    bool more;
+    do {
+      if (lines > 0 && piece.Id() <= last_id)
+        LOG(FATAL) << "Id " << piece.Id() << " of " << piece.Name() << " is also in another input";
+      cout << piece.Line() << '\n';
+      last_id = piece.Id();
+      ++lines;
+    } while ((more = piece.Advance()) && (heads.empty() || piece.Id() < heads.top().first));
+    if (more)
+      heads.push(Head(piece.Id(), index));
+  }
+  cout.flush();
+  if (!cout)
+    LOG(FATAL) << "Cannot write the merged alignments";
+  LOG(INFO) << "pa-merge-viterbi: " << lines << " lines from " << inputs.size() << " inputs in " << runs
+            << " runs";
+  return 0;
+}
@@ -0,0 +1,401 @@
+// pa-online: trains a model on a single machine with stepwise online
+// EM (Liang and Klein, 2009) instead of full-corpus passes.
+//
+// Usage: pa-online [-p PASSES] [-b BATCH] [-k REFRESH] [-a POWER] [-j THREADS] OUTPUT_DIR FILE...
+//
+// Sentences (in the pa-mapper input format) are read from the FILEs in
+// mini-batches of BATCH. The expected counts of the k-th batch are
+// interpolated into running statistics with step size
+// `(k + 2)^-POWER`, 0.5 < POWER <= 1, and the table used by the E-step
+// is rebuilt from them every REFRESH batches and at the end of each
+// pass. Each batch is split among THREADS workers. The likelihood of
+// each pass is logged as pa-diagonal does for batch EM. With
+// `pa_favor_diagonal` and `pa_optimize_tension`, the tension is
+// re-optimized at every refresh but the first.
+//
+// The final table is written to OUTPUT_DIR in `pa_ttable_parts` parts
+// (plus `counts.` files with `pa_save_counts`, and laid out by
+// `pa_partition_map` if set), and the final tension
+// to stdout, so both can be used like the output of a Hadoop run. The
+// corpus should be shuffled, as batches are taken in file order.
+#include <unistd.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/utility.hpp>
+
+#include "estep.h"
+#include "io.h"
+#include "options.h"
+#include "partition.h"
+#include "pipeline.h"
+#include "tension.h"
+#include "ttable.h"
+#include "types.h"
+#include "contrib/log.h"
+
+using namespace std;
+
+namespace paralign {
+typedef map<WordId, map<WordId, double> > CountMap;
+
+// Expected counts of a slice of a batch
+struct BatchStats {
+  BatchStats() : toks(0), emp_feat(0), log_likelihood(0) {}
+
+  void AddPseudoCount(WordId src, WordId tgt, double count) {
+    counts[src][tgt] += count;
+  }
+
+  CountMap counts;
+  map<SentSzPair, int> size_counts;
+  double toks;
+  double emp_feat;
+  double log_likelihood;
+};
+
+class OnlineEM : boost::noncopyable {
+ public:
+  OnlineEM(const Options &opts, int threads, double power)
+      : opts_(opts), threads_(threads), power_(power), tension_(opts.diagonal_tension),
+        scale_(1), emp_feat_(0), toks_(0), steps_(0), refreshes_(0), corpus_size_(0),
+        first_pass_(true), total_toks_(0), map_kernel_(SelectMap(opts)) {}
+
+  // Interpolates the statistics of one batch of `lines` into the
+  // running ones; the table stays as it is
+  void Step(const vector<string> &lines, BatchStats *pass) {
+    vector<BatchStats> stats(threads_);
+    if (threads_ == 1) {
+      EStep(&lines, 0, lines.size(), &stats[0]);
+    } else {
+      boost::thread_group workers;
+      for (int i = 0; i < threads_; ++i)
+        workers.create_thread(boost::bind(&OnlineEM::EStep, this, &lines, lines.size() * i / threads_,
+                                          lines.size() * (i + 1) / threads_, &stats[i]));
+      workers.join_all();
+    }
+
+    // Running statistics are kept per sentence, as `scale_` times
+    // `counts_` so that decaying them is free
+    const double eta = pow(steps_ + 2.0, -power_);
+    ++steps_;
+    scale_ *= 1 - eta;
+    const double weight = eta / (scale_ * lines.size());
+    double emp_feat = 0, toks = 0;
+    BOOST_FOREACH(BatchStats &s, stats) {
+      typedef pair<const WordId, map<WordId, double> > Row;
+      BOOST_FOREACH(Row &row, s.counts) {
+        map<WordId, double> &dest = counts_[row.first];
+        typedef pair<const WordId, double> Cell;
+        BOOST_FOREACH(Cell &cell, row.second)
+          dest[cell.first] += weight * cell.second;
+      }
+      emp_feat += s.emp_feat;
+      toks += s.toks;
+      pass->toks += s.toks;
+      pass->log_likelihood += s.log_likelihood;
+      if (first_pass_) {
+        typedef pair<const SentSzPair, int> P;
+        BOOST_FOREACH(const P &p, s.size_counts)
+          size_counts_[p.first] += p.second;
+        total_toks_ += s.toks;
+      }
+    }
+    emp_feat_ = (1 - eta) * emp_feat_ + eta * emp_feat / lines.size();
+    toks_ = (1 - eta) * toks_ + eta * toks / lines.size();
+    if (scale_ < 1e-100)
+      Rescale();
+  }
+
+  // Rebuilds the table from the running statistics, which stand for
+  // `sentences` sentences
+  void Refresh(size_t sentences) {
+    corpus_size_ = sentences;
+    table_.clear();
+    TTableEntry entry;
+    BOOST_FOREACH(const CountMap::value_type &row, counts_) {
+      Counts(row.second, &entry);
+      if (opts_.variational_bayes)
+        entry.NormalizeVB(opts_.alpha);
+      else
+        entry.Normalize();
+      table_[row.first].Swap(entry);
+    }
+    if (opts_.favor_diagonal && opts_.optimize_tension && refreshes_ > 0 && toks_ > 0) {
+      // Like batch EM, which skips the first iteration, as the
+      // posteriors of the initial uniform table say little
+      TensionOptimizer optimizer(size_counts_, total_toks_, threads_);
+      tension_ = optimizer.Optimize(emp_feat_ / toks_, tension_);
+    }
+    ++refreshes_;
+    LOG(INFO) << "Refreshed the table: " << table_.size() << " rows after " << steps_
+              << " batches, tension " << tension_;
+  }
+
+  // Refreshes the table after a pass of `sentences`; the length
+  // histogram is complete after the first one
+  void EndPass(size_t sentences) {
+    Refresh(sentences);
+    first_pass_ = false;
+  }
+
+  // Writes the table, and with `save_counts` the counts behind it
+  void Write(const string &output_dir) const {
+    PartitionMap map(opts_.ttable_parts);
+    if (!opts_.partition_map.empty()) {
+      if (!map.Load(opts_.partition_map) || map.Parts() != opts_.ttable_parts)
+        LOG(FATAL) << "Cannot read a partition map for " << opts_.ttable_parts << " parts from "
+                   << opts_.partition_map;
+      FileOutputStream out(output_dir, kPartitionMapName);
+      map.Write(out);
+      WriteUnitRowScales(map, output_dir, "");
+    }
+    for (int part = 0; part < opts_.ttable_parts; ++part) {
+      const string name = boost::lexical_cast<string>(part);
+      TTableWriter writer(output_dir, name);
+      boost::scoped_ptr<TTableWriter> counts_writer;
+      if (opts_.save_counts)
+        counts_writer.reset(new TTableWriter(output_dir, name, kCountsPrefix));
+      TTableEntry counts, shard;
+      BOOST_FOREACH(const CountMap::value_type &row, counts_) {
+        const TTableEntry &entry = table_.find(row.first)->second;
+        if (map.Sharded(row.first)) {
+          // Already normalized, hence the unit row scales
+          if (Shard(map, row.first, part, entry, &shard))
+            writer.Write(row.first, shard);
+          if (counts_writer) {
+            Counts(row.second, &counts);
+            if (Shard(map, row.first, part, counts, &shard))
+              counts_writer->Write(row.first, shard);
+          }
+          continue;
+        }
+        if (map.Part(row.first) != part)
+          continue;
+        writer.Write(row.first, entry);
+        if (counts_writer) {
+          Counts(row.second, &counts);
+          counts_writer->Write(row.first, counts);
+        }
+      }
+      writer.WriteIndex();
+      if (counts_writer)
+        counts_writer->WriteIndex();
+    }
+  }
+
+  double Tension() const {
+    return tension_;
+  }
+
+  // Same as `TTable::Query`, on the last refreshed table
+  double Query(WordId src, WordId tgt) const {
+    map<WordId, TTableEntry>::const_iterator row = table_.find(src);
+    if (row == table_.end() || row->second.Empty())
+      return kDefaultProbability;
+    const EntryRecord *record = LookUp(tgt, &row->second[0], row->second.Size());
+    if (record == NULL)
+      return kDefaultProbability;
+    return record->v;
+  }
+
+ private:
+  // The entries of sharded row `src` that `part` holds; false if none
+  static bool Shard(const PartitionMap &map, WordId src, int part, const TTableEntry &entry, TTableEntry *shard) {
+    vector<EntryRecord> records;
+    for (size_t i = 0; i < entry.Size(); ++i)
+      if (map.EntryPart(src, entry[i].k) == part)
+        records.push_back(entry[i]);
+    if (records.empty())
+      return false;
+    shard->Assign(&records[0], &records[0] + records.size());
+    return true;
+  }
+
+  // Counts of a row for the whole corpus seen so far
+  void Counts(const map<WordId, double> &row, TTableEntry *entry) const {
+    TTableEntry(row).Swap(*entry);
+    entry->Scale(scale_ * corpus_size_);
+  }
+
+  void Rescale() {
+    BOOST_FOREACH(CountMap::value_type &row, counts_) {
+      typedef pair<const WordId, double> Cell;
+      BOOST_FOREACH(Cell &cell, row.second)
+        cell.second *= scale_;
+    }
+    scale_ = 1;
+  }
+
+  void EStep(const vector<string> *lines, size_t begin, size_t end, BatchStats *stats) const {
+    size_t id;
+    vector<WordId> src, tgt;
+    vector<double> probs;
+    CellPriors priors(opts_, true);
+    for (size_t k = begin; k < end; ++k) {
+      MapperSource::Parse((*lines)[k], &id, &src, &tgt);
+      if (opts_.reverse)
+        swap(src, tgt);
+      (this->*map_kernel_)(src, tgt, &priors, &probs, stats);
+    }
+  }
+
+  typedef void (OnlineEM::*MapFunction)(const vector<WordId> &, const vector<WordId> &, CellPriors *,
+                                        vector<double> *, BatchStats *) const;
+
+  static MapFunction SelectMap(const Options &opts) {
+    if (opts.no_null_word)
+      return opts.favor_diagonal ? &OnlineEM::Map<false, true> : &OnlineEM::Map<false, false>;
+    return opts.favor_diagonal ? &OnlineEM::Map<true, true> : &OnlineEM::Map<true, false>;
+  }
+
+  // Same E-step as the mapper's
+  template <bool kNullWord, bool kDiagonal>
+  void Map(const vector<WordId> &src, const vector<WordId> &tgt, CellPriors *priors, vector<double> *probs,
+           BatchStats *stats) const {
+    typedef LinkKernel<kNullWord, kDiagonal> Kernel;
+    stats->toks += tgt.size();
+    ++stats->size_counts[MkSzPair(tgt.size(), src.size())];
+    probs->resize(src.size() + 1);
+    priors->Set(tgt.size(), src.size(), tension_);
+    for (size_t j = 0; j < tgt.size(); ++j) {
+      const double sum = Kernel::Joint(*this, tgt[j], src, priors->Prior(j), opts_.prob_align_null, &(*probs)[0]);
+      Kernel::Expect(&(*probs)[0], sum, tgt[j], src, priors->Feature(j), stats, &stats->emp_feat);
+      stats->log_likelihood += log(sum);
+    }
+  }
+
+  const Options opts_;
+  const int threads_;
+  const double power_;
+  double tension_;
+
+  // Running statistics per sentence
+  CountMap counts_;
+  double scale_, emp_feat_, toks_;
+  int steps_, refreshes_;
+
+  // Length histogram of the first pass, for the tension
+  size_t corpus_size_;
+  bool first_pass_;
+  map<SentSzPair, int> size_counts_;
+  double total_toks_;
+
+  map<WordId, TTableEntry> table_;
+
+  // Specialization of `Map` for the options
+  const MapFunction map_kernel_;
+};
+
+// Reads the lines of all inputs, one after another
+class CorpusReader : boost::noncopyable {
+ public:
+  explicit CorpusReader(const vector<string> &inputs) : inputs_(inputs), next_(0) {}
+
+  bool Read(string *line) {
+    for (;;) {
+      if (in_ && getline(*in_, *line))
+        return true;
+      if (next_ == inputs_.size())
+        return false;
+      in_.reset(new ifstream(inputs_[next_].c_str(), ios::binary));
+      if (!*in_)
+        LOG(FATAL) << "Cannot open " << inputs_[next_];
+      ++next_;
+    }
+  }
+
+ private:
+  const vector<string> inputs_;
+  size_t next_;
+  boost::scoped_ptr<ifstream> in_;
+};
+
+// Same report as pa-diagonal
+inline void ReportPass(int pass, const BatchStats &stats) {
+  const double base2_log_likelihood = stats.log_likelihood / std::log(2);
+  LOG(INFO) << "Pass " << pass << ":";
+  LOG(INFO) << "  log_e likelihood: " << stats.log_likelihood;
+  LOG(INFO) << "  log_2 likelihood: " << base2_log_likelihood;
+  LOG(INFO) << "     cross entropy: " << -base2_log_likelihood / stats.toks;
+  LOG(INFO) << "        perplexity: " << std::pow(2.0, -base2_log_likelihood / stats.toks);
+}
+} // namespace paralign
+
+using namespace paralign;
+
+static void Usage(const char *prog) {
+  cerr << "Usage: " << prog << " [-p PASSES] [-b BATCH] [-k REFRESH] [-a POWER] [-j THREADS] OUTPUT_DIR FILE..." << endl;
+  exit(1);
+}
+
+int main(int argc, char *argv[]) {
+  int passes = 1, batch_size = 10000, refresh = 1, threads = boost::thread::hardware_concurrency();
+  double power = 0.7;
+  int c;
+  while ((c = getopt(argc, argv, "p:b:k:a:j:")) != -1) {
+    switch (c) {
+      case 'p': passes = atoi(optarg); break;
+      case 'b': batch_size = atoi(optarg); break;
+      case 'k': refresh = atoi(optarg); break;
+      case 'a': power = atof(optarg); break;
+      case 'j': threads = atoi(optarg); break;
+      default: Usage(argv[0]);
+    }
+  }
+  if (threads <= 0)
+    threads = 1;
+  if (passes <= 0 || batch_size <= 0 || refresh <= 0 || !(power > 0.5 && power <= 1) ||
+      argc - optind < 2)
+    Usage(argv[0]);
+
+  Options opts = Options::FromEnv();
+  if (opts.bidirectional)
+    LOG(FATAL) << "pa-online trains one direction at a time; unset pa_bidirectional";
+  LOG(INFO) << "Options:" << endl
+            << opts << endl;
+  const string output_dir = argv[optind];
+  vector<string> inputs(argv + optind + 1, argv + argc);
+
+  const double start = WallTime();
+  OnlineEM em(opts, threads, power);
+  size_t sentences = 0;
+  for (int pass = 1; pass <= passes; ++pass) {
+    BatchStats stats;
+    CorpusReader reader(inputs);
+    vector<string> lines(batch_size);
+    int batches = 0;
+    size_t seen = 0, n;
+    do {
+      for (n = 0; n < lines.size() && reader.Read(&lines[n]); ++n) {}
+      if (n == 0)
+        break;
+      lines.resize(n);
+      em.Step(lines, &stats);
+      seen += n;
+      // Before the end of the first pass, the statistics only stand for
+      // what has been seen so far
+      if (++batches % refresh == 0)
+        em.Refresh(max(sentences, seen));
+    } while (n == static_cast<size_t>(batch_size));
+    sentences = seen;
+    em.EndPass(sentences);
+    ReportPass(pass, stats);
+    LOG(INFO) << "  " << batches << " batches of " << sentences << " sentences, "
+              << WallTime() - start << "s";
+  }
+  em.Write(output_dir);
+  cout << em.Tension() << endl;
+  return 0;
+}
@@ -3,6 +3,7 @@
 #include <cstdlib>
 #include <cstring>
 #include <ostream>
+#include <utility>
 #include <boost/lexical_cast.hpp>
 
 #include "contrib/log.h"
@@ -48,29 +49,73 @@ static inline void SetStringFromEnv(const char *name, string *dest) {
 
 namespace paralign {
 
-Options Options::FromEnv() {
+Options Options::FromEnv(int default_ttable_parts) {
   Options ret;
+  ret.ttable_parts = default_ttable_parts;
   SetBooleanFromEnv("pa_reverse", &ret.reverse);
   SetBooleanFromEnv("pa_favor_diagonal", &ret.favor_diagonal);
   SetNumberFromEnv("pa_prob_align_null", &ret.prob_align_null);
   SetNumberFromEnv("pa_diagonal_tension", &ret.diagonal_tension);
+  SetNumberFromEnv("pa_reverse_diagonal_tension", &ret.reverse_diagonal_tension);
   SetBooleanFromEnv("pa_optimize_tension", &ret.optimize_tension);
+  SetBooleanFromEnv("pa_bidirectional", &ret.bidirectional);
   SetBooleanFromEnv("pa_variational_bayes", &ret.variational_bayes);
   SetNumberFromEnv("pa_alpha", &ret.alpha);
   SetBooleanFromEnv("pa_no_null_word", &ret.no_null_word);
   SetStringFromEnv("pa_ttable_dir", &ret.ttable_dir);
   SetNumberFromEnv("pa_ttable_parts", &ret.ttable_parts);
+  SetStringFromEnv("pa_ttable_output_dir", &ret.ttable_output_dir);
+  SetStringFromEnv("pa_partition_map", &ret.partition_map);
+  SetNumberFromEnv("pa_reducer_threads", &ret.reducer_threads);
+  SetBooleanFromEnv("pa_emit_size_counts", &ret.emit_size_counts);
+  SetNumberFromEnv("pa_mapper_memory_mb", &ret.mapper_memory_mb);
+  SetNumberFromEnv("pa_mapper_sort_buffer", &ret.mapper_sort_buffer);
+  SetBooleanFromEnv("pa_viterbi_output", &ret.viterbi_output);
+  SetStringFromEnv("pa_size_counts_file", &ret.size_counts_file);
+  SetStringFromEnv("pa_row_scale_dir", &ret.row_scale_dir);
+  SetBooleanFromEnv("pa_save_counts", &ret.save_counts);
+  SetStringFromEnv("pa_prior_counts_dir", &ret.prior_counts_dir);
+  SetNumberFromEnv("pa_prior_counts_decay", &ret.prior_counts_decay);
+  SetBooleanFromEnv("pa_counters", &ret.counters);
+  SetBooleanFromEnv("pa_float_counts", &ret.float_counts);
+  SetBooleanFromEnv("pa_check_float_counts", &ret.check_float_counts);
+  SetStringFromEnv("pa_compute_precision", &ret.compute_precision);
+  SetBooleanFromEnv("pa_tension_stats", &ret.tension_stats);
+  SetBooleanFromEnv("pa_table_change", &ret.table_change);
+  SetStringFromEnv("pa_convergence_file", &ret.convergence_file);
   ret.Check();
   return ret;
 }
 
+Options Options::Reversed() const {
+  Options ret(*this);
+  ret.reverse = !reverse;
+  std::swap(ret.diagonal_tension, ret.reverse_diagonal_tension);
+  ret.bidirectional = false;
+  return ret;
+}
+
 void Options::Check() const {
   if (favor_diagonal && (prob_align_null < 0 || prob_align_null > 1))
     LOG(FATAL) << "prob_align_null must be probability: " << prob_align_null;
+  if (bidirectional && reverse)
+    LOG(FATAL) << "bidirectional already trains the reverse direction; do not set reverse";
   if (variational_bayes && (alpha <= 0))
     LOG(FATAL) << "alpha must be positive: " << alpha;
   if (ttable_parts <= 0)
     LOG(FATAL) << "ttable_parts not given or invalid: " << ttable_parts;
+  if (reducer_threads <= 0)
+    LOG(FATAL) << "reducer_threads must be positive: " << reducer_threads;
+  if (mapper_memory_mb < 0)
+    LOG(FATAL) << "mapper_memory_mb must be non-negative: " << mapper_memory_mb;
+  if (mapper_sort_buffer < 0)
+    LOG(FATAL) << "mapper_sort_buffer must be non-negative: " << mapper_sort_buffer;
+  if (prior_counts_decay < 0)
+    LOG(FATAL) << "prior_counts_decay must be non-negative: " << prior_counts_decay;
+  if (float_counts && check_float_counts)
+    LOG(FATAL) << "check_float_counts compares against exact counts; do not set float_counts";
+  if (compute_precision != "double" && compute_precision != "float")
+    LOG(FATAL) << "compute_precision must be double or float: " << compute_precision;
 }
 
 ostream &operator<<(ostream &output, const Options &opts) {
@@ -78,12 +123,33 @@ ostream &operator<<(ostream &output, const Options &opts) {
          << "favor_diagonal = " << opts.favor_diagonal << endl
          << "prob_align_null = " << opts.prob_align_null << endl
          << "diagonal_tension = " << opts.diagonal_tension << endl
+         << "reverse_diagonal_tension = " << opts.reverse_diagonal_tension << endl
          << "optimize_tension = " << opts.optimize_tension << endl
+         << "bidirectional = " << opts.bidirectional << endl
          << "variational_bayes = " << opts.variational_bayes << endl
          << "alpha = " << opts.alpha << endl
          << "no_null_word = " << opts.no_null_word << endl
          << "ttable_dir = " << opts.ttable_dir << endl
-         << "ttable_parts = " << opts.ttable_parts << endl;
+         << "ttable_parts = " << opts.ttable_parts << endl
+         << "ttable_output_dir = " << opts.ttable_output_dir << endl
+         << "partition_map = " << opts.partition_map << endl
+         << "reducer_threads = " << opts.reducer_threads << endl
+         << "emit_size_counts = " << opts.emit_size_counts << endl
+         << "mapper_memory_mb = " << opts.mapper_memory_mb << endl
+         << "mapper_sort_buffer = " << opts.mapper_sort_buffer << endl
+         << "viterbi_output = " << opts.viterbi_output << endl
+         << "size_counts_file = " << opts.size_counts_file << endl
+         << "row_scale_dir = " << opts.row_scale_dir << endl
+         << "save_counts = " << opts.save_counts << endl
+         << "prior_counts_dir = " << opts.prior_counts_dir << endl
+         << "prior_counts_decay = " << opts.prior_counts_decay << endl
+         << "counters = " << opts.counters << endl
+         << "float_counts = " << opts.float_counts << endl
+         << "check_float_counts = " << opts.check_float_counts << endl
+         << "compute_precision = " << opts.compute_precision << endl
+         << "tension_stats = " << opts.tension_stats << endl
+         << "table_change = " << opts.table_change << endl
+         << "convergence_file = " << opts.convergence_file << endl;
   return output;
 }
 } // namespace paralign
@@ -15,8 +15,13 @@ struct Options {
   double prob_align_null;
   // How sharp or flat around the diagonal is the alignment distribution (<1 = flat >1 = sharp)
   double diagonal_tension;
+  // Diagonal tension of the reverse direction in bidirectional training
+  double reverse_diagonal_tension;
   // Optimize diagonal tension during EM
   bool optimize_tension;
+  // Train both directions at once, the reverse one with the "reverse."
+  // translation table
+  bool bidirectional;
   // Infer VB estimate of parameters under a symmetric Dirichlet prior
   bool variational_bayes;
   // Hyperparameter for optional Dirichlet prior
@@ -27,15 +32,85 @@ struct Options {
   std::string ttable_dir;
   // Number of translation table pieces
   int ttable_parts;
+  // Where pa-reducer writes its translation table piece; a plain path
+  // or file: URI needs no JVM. Empty = `mapreduce_task_output_dir`.
+  std::string ttable_output_dir;
+  // Partition map (see `PartitionMap`) the rows given to pa-reducer
+  // were partitioned with, or pa-online writes its table with; the
+  // mapper splits the rows it shards. Empty = `src % ttable_parts`.
+  std::string partition_map;
+  // Threads used by pa-reducer and pa-combiner; more than one runs
+  // reading, merging and writing as a pipeline. pa-diagonal uses
+  // them to optimize tension.
+  int reducer_threads;
+  // Whether the mapper outputs the sentence length histogram
+  bool emit_size_counts;
+  // Memory budget of the mapper's accumulated counts in MB; when
+  // exceeded, the counts are written out and cleared. 0 = no limit.
+  int mapper_memory_mb;
+  // Number of sentences the mapper reads ahead and processes grouped
+  // by length and vocabulary (alignments keep the input order). 0 =
+  // input order.
+  int mapper_sort_buffer;
+  // Have the mapper also write Viterbi alignments as a side output
+  bool viterbi_output;
+  // Where pa-diagonal persists the sentence length histogram; when
+  // set, it is saved if present in the input and loaded otherwise
+  std::string size_counts_file;
+  // Directory pa-diagonal writes the scales of rows sharded by the
+  // partition map to (see `kRowScaleName`), normally that of the table
+  std::string row_scale_dir;
+  // Have the reducer also save the summed counts before normalization
+  // (the "counts." table)
+  bool save_counts;
+  // Directory of counts saved by an earlier model; when set, the
+  // reducer adds them to the new counts (warm start)
+  std::string prior_counts_dir;
+  // Weight of the prior counts
+  double prior_counts_decay;
+  // Report Hadoop counters and status lines (see `TaskCounters`)
+  bool counters;
+  // Have the mapper and combiner send expected counts to the reducer
+  // as floats, which roughly halves the shuffle
+  bool float_counts;
+  // Have the reducer report the largest change in normalized
+  // probabilities that `float_counts` would cause
+  bool check_float_counts;
+  // Precision pa-mapper computes posteriors in, "double" or "float"
+  // (see `LinkKernel`); the log-likelihood is summed in double either
+  // way
+  std::string compute_precision;
+  // Have pa-reducer write its statistics for pa-diagonal to a binary
+  // `tension.N` next to its table piece instead of its output
+  bool tension_stats;
+  // Have the reducer measure how far its rows moved from the table in
+  // `ttable_dir` (see `Reducer::SetPreviousTable`)
+  bool table_change;
+  // Where pa-diagonal writes the convergence record of the iteration:
+  // a header line, then per direction its log-likelihood, tokens,
+  // perplexity and mean table change per row ("-" if not measured)
+  std::string convergence_file;
 
   // Default values
   Options()
       : reverse(false), favor_diagonal(true), prob_align_null(0.08),
-        diagonal_tension(4.0), optimize_tension(true), variational_bayes(true),
-        alpha(0.01), no_null_word(false), ttable_dir("."), ttable_parts(0) {}
+        diagonal_tension(4.0), reverse_diagonal_tension(4.0), optimize_tension(true),
+        bidirectional(false), variational_bayes(true),
+        alpha(0.01), no_null_word(false), ttable_dir("."), ttable_parts(0),
+        ttable_output_dir(), partition_map(),
+        reducer_threads(1), emit_size_counts(true),
+        mapper_memory_mb(0), mapper_sort_buffer(0), viterbi_output(false), size_counts_file(), row_scale_dir(),
+        save_counts(false), prior_counts_dir(), prior_counts_decay(1.0),
+        counters(false), float_counts(false), check_float_counts(false), compute_precision("double"),
+        tension_stats(false), table_change(false), convergence_file() {}
 
-  // Construct from environment variables
-  static Options FromEnv();
+  // Construct from environment variables; `ttable_parts` is
+  // `default_ttable_parts` when `pa_ttable_parts` is unset, for tools
+  // that read no table
+  static Options FromEnv(int default_ttable_parts = 0);
+
+  // Options for the reverse direction of bidirectional training
+  Options Reversed() const;
 
   // Show options
   friend std::ostream &operator<<(std::ostream &, const Options &);
@@ -0,0 +1,170 @@
+// pa-partition: plans a partition map that balances the rows of a
+// translation table over the reducers of the next iterations.
+//
+// Usage: pa-partition -n PARTS [FILE...]
+//        pa-partition -n PARTS -d DIR [-s SHARE]
+//
+// Reads the index files of a table (concatenated, e.g. the forward and
+// reverse `index.*` of one iteration, from the FILEs or stdin) and
+// writes a `PartitionMap` for PARTS parts to stdout. Rows with the
+// same key in several files, e.g. a word's forward and reverse rows,
+// go to the same reducer and are counted together.
+//
+// With `-d`, reads the forward and (if present) reverse table in DIR
+// instead, and also shards the rows larger than SHARE (default 0.5)
+// of a part's fair share into about that size, up to PARTS shards, cut
+// where the target ids of both directions split evenly. `-s 0` turns
+// sharding off.
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/lexical_cast.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include "partition.h"
+#include "ttable.h"
+#include "contrib/log.h"
+
+using namespace std;
+using namespace paralign;
+
+static void Usage(const char *prog) {
+  cerr << "Usage: " << prog << " -n PARTS [FILE...]" << endl
+       << "       " << prog << " -n PARTS -d DIR [-s SHARE]" << endl;
+  exit(1);
+}
+
+// Largest over mean part size
+static double Skew(const vector<int64_t> &loads) {
+  int64_t total = 0, largest = 0;
+  for (size_t i = 0; i < loads.size(); ++i) {
+    total += loads[i];
+    largest = max(largest, loads[i]);
+  }
+  return total == 0 ? 1 : static_cast<double>(largest) * loads.size() / total;
+}
+
+// Reducer work is about one unit per entry plus one per row
+static void ReadIndexes(const vector<string> &inputs, map<WordId, int64_t> *row_sizes) {
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    boost::scoped_ptr<ifstream> file;
+    istream *in = &cin;
+    if (inputs[i] != "-") {
+      file.reset(new ifstream(inputs[i].c_str(), ios::binary));
+      if (!*file)
+        LOG(FATAL) << "Cannot open " << inputs[i] << ": " << strerror(errno);
+      in = file.get();
+    }
+    IndexRecord record;
+    while (in->read(reinterpret_cast<char *>(&record), sizeof(record)))
+      (*row_sizes)[record.k] += record.v.v + 1;
+    if (in->gcount() != 0)
+      LOG(FATAL) << "Truncated index record in " << inputs[i];
+  }
+}
+
+// All parts of the forward and reverse table in `dir`
+static void LoadTables(const string &dir, boost::ptr_vector<PartialTTable> *tables) {
+  const string prefixes[] = {"", kReversePrefix};
+  for (int p = 0; p < 2; ++p) {
+    for (int part = 0;; ++part) {
+      const string name = boost::lexical_cast<string>(part);
+      const string index = dir + "/" + prefixes[p] + "index." + name;
+      if (access(index.c_str(), R_OK) != 0)
+        break;
+      tables->push_back(new PartialTTable);
+      tables->back().Load(index, dir + "/" + prefixes[p] + "entry." + name);
+    }
+  }
+  if (tables->empty())
+    LOG(FATAL) << "No translation table in " << dir;
+}
+
+// Begins of at most `shards` shards of row `src` with about as many
+// target ids each
+static vector<WordId> ShardBegins(const boost::ptr_vector<PartialTTable> &tables, WordId src, int shards) {
+  vector<WordId> tgts;
+  TTableEntry entry;
+  for (size_t t = 0; t < tables.size(); ++t) {
+    const size_t row = tables[t].FindRow(src);
+    if (row == tables[t].NumRows())
+      continue;
+    tables[t].ReadRow(row, &entry);
+    for (size_t i = 0; i < entry.Size(); ++i)
+      tgts.push_back(entry[i].k);
+  }
+  sort(tgts.begin(), tgts.end());
+  vector<WordId> begins;
+  for (int i = 0; i < shards && !tgts.empty(); ++i) {
+    const WordId begin = tgts[tgts.size() * i / shards];
+    if (begins.empty() || begin > begins.back())
+      begins.push_back(begin);
+  }
+  return begins;
+}
+
+int main(int argc, char *argv[]) {
+  int parts = 0;
+  string dir;
+  double share = 0.5;
+  int c;
+  while ((c = getopt(argc, argv, "n:d:s:")) != -1) {
+    switch (c) {
+      case 'n': parts = atoi(optarg); break;
+      case 'd': dir = optarg; break;
+      case 's': share = atof(optarg); break;
+      default: Usage(argv[0]);
+    }
+  }
+  if (parts <= 0 || parts > 32767 || share < 0 || (!dir.empty() && optind != argc))
+    Usage(argv[0]);
+
+  map<WordId, int64_t> row_sizes;
+  boost::ptr_vector<PartialTTable> tables;
+  if (dir.empty()) {
+    vector<string> inputs(argv + optind, argv + argc);
+    if (inputs.empty())
+      inputs.push_back("-");
+    ReadIndexes(inputs, &row_sizes);
+  } else {
+    LoadTables(dir, &tables);
+    for (size_t t = 0; t < tables.size(); ++t)
+      for (size_t row = 0; row < tables[t].NumRows(); ++row)
+        row_sizes[tables[t].RowKey(row)] += tables[t].RowSize(row) + 1;
+  }
+
+  vector<pair<WordId, int64_t> > sizes(row_sizes.begin(), row_sizes.end());
+  vector<int64_t> before(parts, 0), after;
+  int64_t total = 0;
+  for (size_t i = 0; i < sizes.size(); ++i) {
+    before[PartitionMap::DefaultPart(sizes[i].first, parts)] += sizes[i].second;
+    total += sizes[i].second;
+  }
+  map<WordId, vector<WordId> > shard_begins;
+  const double shard_size = share * total / parts;
+  for (size_t i = 0; !tables.empty() && parts > 1 && shard_size > 0 && i < sizes.size(); ++i) {
+    if (sizes[i].first < 0 || sizes[i].second <= shard_size)
+      continue;
+    const int shards = min<int>(parts, static_cast<int>(ceil(sizes[i].second / shard_size)));
+    vector<WordId> begins = ShardBegins(tables, sizes[i].first, shards);
+    if (begins.size() > 1)
+      shard_begins[sizes[i].first].swap(begins);
+  }
+  PartitionMap map = PartitionMap::Balance(sizes, parts, &after, &shard_begins);
+  map.Write(cout);
+  LOG(INFO) << "pa-partition: " << sizes.size() << " rows, " << map.Overrides() << " moved, "
+            << shard_begins.size() << " sharded into " << map.NumShards() << "; largest part "
+            << Skew(before) << " -> " << Skew(after) << " times the mean";
+  return 0;
+}
@@ -0,0 +1,331 @@
+#ifndef _PARALIGN_PARTITION_H_
+#define _PARALIGN_PARTITION_H_
+
+#include <algorithm>
+#include <fstream>
+#include <istream>
+#include <map>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "types.h"
+#include "contrib/log.h"
+
+namespace paralign {
+// Name of the partition map stored next to the translation table it
+// describes (shared by the forward and reverse tables)
+const char kPartitionMapName[] = "partition.map";
+
+// Assigns translation table rows, i.e. shuffle keys, to parts. Rows
+// listed in the map go to their part and all others to `src % parts`,
+// so an empty map is the plain modulo partitioning. Lookups index a
+// dense array by word id.
+//
+// A row too large for one reducer (e.g. that of the null word) can
+// instead be split into shards by target word id, each with its own
+// part. The mapper sends the entries of shard i under the shuffle key
+// `ShardKey(i)`; the reducers keep its counts unnormalized and report
+// the partial row total, from which pa-diagonal derives the factor
+// readers scale the row by (see `RowScale`). The shards of a row are
+// on different parts.
+//
+// The file format, also read by `paralign.Partitioner1/2`, is a
+// "parts N" line followed by "src part" lines and "shard src begin
+// part" lines, the latter in order of shard and of begin within a row.
+// A shard takes the target ids from its begin up to the next one's;
+// the first also takes those below its begin.
+class PartitionMap {
+ public:
+  struct Shard {
+    WordId src, begin;
+    int part;
+  };
+
+  // Shuffle key of the first shard; the others count down from here,
+  // well below the stat keys
+  static const WordId kFirstShardKey = -1000;
+
+  explicit PartitionMap(int parts = 1) : parts_(parts), overrides_(0) {}
+
+  int Parts() const {
+    return parts_;
+  }
+
+  // Number of rows not in their modulo part
+  size_t Overrides() const {
+    return overrides_;
+  }
+
+  size_t NumShards() const {
+    return shards_.size();
+  }
+
+  const Shard &GetShard(size_t i) const {
+    return shards_[i];
+  }
+
+  static bool IsShardKey(WordId key) {
+    return key <= kFirstShardKey;
+  }
+
+  static WordId ShardKey(size_t i) {
+    return kFirstShardKey - static_cast<WordId>(i);
+  }
+
+  static size_t ShardOfKey(WordId key) {
+    return kFirstShardKey - key;
+  }
+
+  // Part of a shuffle key; that of a sharded row itself is its first
+  // shard's, and shard keys not in the map go by modulo
+  int Part(WordId key) const {
+    if (key >= 0 && static_cast<size_t>(key) < part_of_.size()) {
+      if (part_of_[key] >= 0)
+        return part_of_[key];
+      if (part_of_[key] == kShardedRow)
+        return shards_[row_shards_.find(key)->second.first].part;
+    } else if (IsShardKey(key) && ShardOfKey(key) < shards_.size()) {
+      return shards_[ShardOfKey(key)].part;
+    }
+    return DefaultPart(key, parts_);
+  }
+
+  bool Sharded(WordId src) const {
+    return src >= 0 && static_cast<size_t>(src) < part_of_.size() && part_of_[src] == kShardedRow;
+  }
+
+  // Shards [`first`, `end`) of a sharded row
+  void ShardRange(WordId src, size_t *first, size_t *end) const {
+    std::map<WordId, std::pair<size_t, size_t> >::const_iterator it = row_shards_.find(src);
+    if (it == row_shards_.end())
+      LOG(FATAL) << "Row " << src << " is not sharded";
+    *first = it->second.first;
+    *end = it->second.second;
+  }
+
+  // Shard of a sharded row that holds `tgt`
+  size_t ShardOf(WordId src, WordId tgt) const {
+    size_t first, end;
+    ShardRange(src, &first, &end);
+    // Last shard whose begin is at most `tgt`, or the first
+    while (end - first > 1) {
+      const size_t mid = first + (end - first) / 2;
+      if (shards_[mid].begin <= tgt)
+        first = mid;
+      else
+        end = mid;
+    }
+    return first;
+  }
+
+  // Part that holds the entry (`src`, `tgt`) of the table
+  int EntryPart(WordId src, WordId tgt) const {
+    return Sharded(src) ? shards_[ShardOf(src, tgt)].part : Part(src);
+  }
+
+  void Assign(WordId src, int part) {
+    if (src < 0 || part < 0 || part >= parts_)
+      LOG(FATAL) << "Cannot assign row " << src << " to part " << part << " of " << parts_;
+    if (Sharded(src))
+      LOG(FATAL) << "Cannot assign sharded row " << src << " to a single part";
+    if (part == DefaultPart(src, parts_)) {
+      if (static_cast<size_t>(src) < part_of_.size() && part_of_[src] >= 0) {
+        part_of_[src] = -1;
+        --overrides_;
+      }
+      return;
+    }
+    if (static_cast<size_t>(src) >= part_of_.size())
+      part_of_.resize(src + 1, -1);
+    if (part_of_[src] < 0)
+      ++overrides_;
+    part_of_[src] = part;
+  }
+
+  // Appends the next shard of `src`, which replaces any assignment of
+  // the row. Shards of a row must be added together, by begin.
+  void AddShard(WordId src, WordId begin, int part) {
+    if (src < 0 || part < 0 || part >= parts_)
+      LOG(FATAL) << "Cannot assign a shard of row " << src << " to part " << part << " of " << parts_;
+    if (Sharded(src)) {
+      std::pair<size_t, size_t> &range = row_shards_[src];
+      if (range.second != shards_.size() || shards_.back().begin >= begin)
+        LOG(FATAL) << "Shards of row " << src << " are not together and by begin";
+      for (size_t i = range.first; i < range.second; ++i)
+        if (shards_[i].part == part)
+          LOG(FATAL) << "Two shards of row " << src << " on part " << part;
+      ++range.second;
+    } else {
+      Assign(src, DefaultPart(src, parts_));
+      if (static_cast<size_t>(src) >= part_of_.size())
+        part_of_.resize(src + 1, -1);
+      part_of_[src] = kShardedRow;
+      row_shards_[src] = std::make_pair(shards_.size(), shards_.size() + 1);
+    }
+    Shard shard = { src, begin, part };
+    shards_.push_back(shard);
+  }
+
+  // Loads `path`; returns false if it does not exist
+  bool Load(const std::string &path) {
+    std::ifstream in(path.c_str());
+    if (!in)
+      return false;
+    Read(in, path);
+    return true;
+  }
+
+  void Read(std::istream &in, const std::string &name = "partition map") {
+    std::string tag;
+    if (!(in >> tag >> parts_) || tag != "parts" || parts_ <= 0 || parts_ > 32767)
+      LOG(FATAL) << "Missing \"parts N\" header in " << name;
+    part_of_.clear();
+    overrides_ = 0;
+    shards_.clear();
+    row_shards_.clear();
+    std::string line;
+    std::getline(in, line);
+    size_t line_no = 1;
+    while (std::getline(in, line)) {
+      ++line_no;
+      std::istringstream strm(line);
+      WordId src, begin;
+      int part;
+      if (line.compare(0, 6, "shard ") == 0) {
+        strm.ignore(6);
+        if (!(strm >> src >> begin >> part))
+          LOG(FATAL) << "Invalid line " << line_no << " in " << name;
+        AddShard(src, begin, part);
+      } else if (strm >> src >> part) {
+        Assign(src, part);
+      } else if (line.find_first_not_of(" \t") != std::string::npos) {
+        LOG(FATAL) << "Invalid line " << line_no << " in " << name;
+      }
+    }
+  }
+
+  void Write(std::ostream &out) const {
+    out << "parts " << parts_ << '\n';
+    for (size_t src = 0; src < part_of_.size(); ++src)
+      if (part_of_[src] >= 0)
+        out << src << ' ' << part_of_[src] << '\n';
+    for (size_t i = 0; i < shards_.size(); ++i)
+      out << "shard " << shards_[i].src << ' ' << shards_[i].begin << ' ' << shards_[i].part << '\n';
+  }
+
+  // A map that balances rows of the given sizes (e.g. entries in the
+  // last table) over `parts`. The rows larger than 1/`kHeadShare` of
+  // a part are placed largest first on the least loaded part, on top
+  // of the modulo placement of all smaller rows, which keeps the map
+  // small. Rows in `shard_begins` are split into shards of equal size
+  // at the given target ids (at most `parts` of them, the first
+  // ignored), each placed like a head row but on a part of its own.
+  // `loads`, when given, receives the resulting size of each part.
+  static const int kHeadShare = 256;
+
+  static PartitionMap Balance(std::vector<std::pair<WordId, int64_t> > sizes, int parts,
+                              std::vector<int64_t> *loads = NULL,
+                              const std::map<WordId, std::vector<WordId> > *shard_begins = NULL) {
+    PartitionMap map(parts);
+    std::vector<int64_t> load(parts, 0);
+    int64_t total = 0;
+    for (size_t i = 0; i < sizes.size(); ++i)
+      total += sizes[i].second;
+    const int64_t head_size = total / (static_cast<int64_t>(parts) * kHeadShare);
+    // Head items are rows, or shards (index in the row, size) of rows
+    std::vector<std::pair<WordId, int64_t> > head;
+    std::vector<int> shard_of_item;
+    std::map<WordId, std::vector<int> > shard_parts;
+    for (size_t i = 0; i < sizes.size(); ++i) {
+      const WordId src = sizes[i].first;
+      const std::vector<WordId> *begins = NULL;
+      if (shard_begins && shard_begins->count(src))
+        begins = &shard_begins->find(src)->second;
+      if (src >= 0 && begins && begins->size() > 1) {
+        const int n = std::min<int>(begins->size(), parts);
+        shard_parts[src].resize(n, -1);
+        for (int j = 0; j < n; ++j) {
+          head.push_back(std::make_pair(src, sizes[i].second / n + (j < sizes[i].second % n)));
+          shard_of_item.push_back(j);
+        }
+      } else if (src >= 0 && sizes[i].second > head_size) {
+        head.push_back(sizes[i]);
+        shard_of_item.push_back(-1);
+      } else {
+        load[DefaultPart(src, parts)] += sizes[i].second;
+      }
+    }
+    std::vector<size_t> order(head.size());
+    for (size_t i = 0; i < order.size(); ++i)
+      order[i] = i;
+    std::sort(order.begin(), order.end(), LargerFirst(head, shard_of_item));
+    for (size_t k = 0; k < order.size(); ++k) {
+      const size_t i = order[k];
+      const WordId src = head[i].first;
+      int part = -1;
+      for (int p = 0; p < parts; ++p) {
+        if (shard_of_item[i] >= 0) {
+          const std::vector<int> &taken = shard_parts[src];
+          if (std::find(taken.begin(), taken.end(), p) != taken.end())
+            continue;
+        }
+        if (part < 0 || load[p] < load[part])
+          part = p;
+      }
+      if (shard_of_item[i] >= 0)
+        shard_parts[src][shard_of_item[i]] = part;
+      else
+        map.Assign(src, part);
+      load[part] += head[i].second;
+    }
+    for (std::map<WordId, std::vector<int> >::const_iterator it = shard_parts.begin(); it != shard_parts.end(); ++it)
+      for (size_t j = 0; j < it->second.size(); ++j)
+        map.AddShard(it->first, shard_begins->find(it->first)->second[j], it->second[j]);
+    if (loads)
+      loads->swap(load);
+    return map;
+  }
+
+  static int DefaultPart(WordId src, int parts) {
+    int p = src % parts;
+    if (p < 0) p += parts;
+    return p;
+  }
+
+ private:
+  // Orders head items of `Balance` by size, then row and shard
+  class LargerFirst {
+   public:
+    LargerFirst(const std::vector<std::pair<WordId, int64_t> > &items, const std::vector<int> &shards)
+        : items_(items), shards_(shards) {}
+
+    bool operator()(size_t x, size_t y) const {
+      if (items_[x].second != items_[y].second)
+        return items_[x].second > items_[y].second;
+      if (items_[x].first != items_[y].first)
+        return items_[x].first < items_[y].first;
+      return shards_[x] < shards_[y];
+    }
+
+   private:
+    const std::vector<std::pair<WordId, int64_t> > &items_;
+    const std::vector<int> &shards_;
+  };
+
+  // `part_of_` of sharded rows
+  static const int16_t kShardedRow = -2;
+
+  int parts_;
+  size_t overrides_;
+  // Part of each row by word id, -1 for the default
+  std::vector<int16_t> part_of_;
+  std::vector<Shard> shards_;
+  // Shards [first, second) of each sharded row
+  std::map<WordId, std::pair<size_t, size_t> > row_shards_;
+};
+} // namespace paralign
+
+#endif  // _PARALIGN_PARTITION_H_
@@ -0,0 +1,155 @@
+#ifndef _PARALIGN_PIPELINE_H_
+#define _PARALIGN_PIPELINE_H_
+
+#include <time.h>
+
+#include <deque>
+#include <map>
+#include <string>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/utility.hpp>
+
+#include "contrib/log.h"
+
+namespace paralign {
+// Monotonic wall clock in seconds
+inline double WallTime() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Accumulates how long a pipeline stage spends doing actual work, as
+// opposed to waiting on its neighbours. Each thread owns one of
+// these; merge them with `+=` after joining.
+struct StageStats {
+  StageStats() : busy(0), wall(0), items(0) {}
+
+  StageStats &operator+=(const StageStats &that) {
+    busy += that.busy;
+    wall += that.wall;
+    items += that.items;
+    return *this;
+  }
+
+  // Logs busy time relative to wall time; with multiple threads the
+  // wall time is summed over threads.
+  void Report(const std::string &name, int threads) const {
+    LOG(INFO) << "stage " << name << " x" << threads << ": " << items << " items, busy "
+              << busy << "s of " << wall << "s (" << (wall > 0 ? 100 * busy / wall : 0) << "%)";
+  }
+
+  double busy;
+  double wall;
+  size_t items;
+};
+
+// A blocking FIFO queue with bounded capacity. `Pop` returns false
+// once the queue is closed and drained.
+template <class T>
+class BoundedQueue : boost::noncopyable {
+ public:
+  explicit BoundedQueue(size_t capacity) : capacity_(capacity), closed_(false) {
+    if (capacity_ == 0)
+      LOG(FATAL) << "BoundedQueue capacity must be positive";
+  }
+
+  void Push(const T &item) {
+    boost::unique_lock<boost::mutex> lock(mu_);
+    while (items_.size() >= capacity_)
+      not_full_.wait(lock);
+    items_.push_back(item);
+    not_empty_.notify_one();
+  }
+
+  bool Pop(T *item) {
+    boost::unique_lock<boost::mutex> lock(mu_);
+    while (items_.empty() && !closed_)
+      not_empty_.wait(lock);
+    if (items_.empty())
+      return false;
+    *item = items_.front();
+    items_.pop_front();
+    not_full_.notify_one();
+    return true;
+  }
+
+  void Close() {
+    boost::lock_guard<boost::mutex> lock(mu_);
+    closed_ = true;
+    not_empty_.notify_all();
+  }
+
+ private:
+  const size_t capacity_;
+  bool closed_;
+  std::deque<T> items_;
+  boost::mutex mu_;
+  boost::condition_variable not_full_, not_empty_;
+};
+
+// Restores sequence order after an unordered worker pool. The
+// producer takes a sequence number with `Reserve` (blocking while
+// `capacity` items are in flight), workers hand finished items back
+// with `Put` in any order, and the consumer gets them in order from
+// `Take`, which returns false once closed and drained.
+template <class T>
+class ReorderBuffer : boost::noncopyable {
+ public:
+  explicit ReorderBuffer(size_t capacity)
+      : capacity_(capacity), next_in_(0), next_out_(0), closed_(false) {
+    if (capacity_ == 0)
+      LOG(FATAL) << "ReorderBuffer capacity must be positive";
+  }
+
+  size_t Reserve() {
+    boost::unique_lock<boost::mutex> lock(mu_);
+    while (next_in_ - next_out_ >= capacity_)
+      not_full_.wait(lock);
+    return next_in_++;
+  }
+
+  void Put(size_t seq, const T &item) {
+    boost::lock_guard<boost::mutex> lock(mu_);
+    ready_[seq] = item;
+    if (seq == next_out_)
+      changed_.notify_all();
+  }
+
+  bool Take(T *item) {
+    boost::unique_lock<boost::mutex> lock(mu_);
+    for (;;) {
+      typename std::map<size_t, T>::iterator it = ready_.find(next_out_);
+      if (it != ready_.end()) {
+        *item = it->second;
+        ready_.erase(it);
+        ++next_out_;
+        not_full_.notify_one();
+        return true;
+      }
+      if (closed_ && next_out_ == next_in_)
+        return false;
+      changed_.wait(lock);
+    }
+  }
+
+  // No more `Reserve` after this
+  void Close() {
+    boost::lock_guard<boost::mutex> lock(mu_);
+    closed_ = true;
+    changed_.notify_all();
+  }
+
+ private:
+  const size_t capacity_;
+  size_t next_in_, next_out_;
+  bool closed_;
+  std::map<size_t, T> ready_;
+  boost::mutex mu_;
+  boost::condition_variable not_full_, changed_;
+};
+} // namespace paralign
+
+#endif  // _PARALIGN_PIPELINE_H_
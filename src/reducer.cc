@@ -1,8 +1,11 @@
 #include <cstdlib>
 #include <iostream>
 #include <string>
+#include <boost/scoped_ptr.hpp>
 
+#include "counters.h"
 #include "io.h"
+#include "partition.h"
 #include "reducer.h"
 #include "ttable.h"
 #include "contrib/log.h"
@@ -11,23 +14,88 @@
 using namespace std;
 using namespace paralign;
 
-static string GetPartition() {
-  char *env = getenv("mapred_task_partition");
-  if (env == NULL) env = getenv("mapreduce_task_partition");
-  if (env == NULL) LOG(FATAL) << "Cannot find partition!";
-  return string(env);
+// Prior counts only line up with this run's rows when both use the same
+// partitioning, down to the entries of sharded rows
+static void CheckPartition(const PartialTTable &table, const PartitionMap &map, int part) {
+  TTableEntry entry;
+  for (size_t row = 0; row < table.NumRows(); ++row) {
+    const WordId src = table.RowKey(row);
+    bool misplaced = false;
+    if (map.Sharded(src)) {
+      table.ReadRow(row, &entry);
+      for (size_t i = 0; i < entry.Size(); ++i)
+        misplaced = misplaced || map.EntryPart(src, entry[i].k) != part;
+    } else {
+      misplaced = map.Part(src) != part;
+    }
+    if (misplaced)
+      LOG(FATAL) << "Prior counts have row " << src << " in part " << part
+                 << "; were they trained with " << map.Parts() << " parts and the same partition map?";
+  }
 }
 
 int main() {
   Options opts = Options::FromEnv();
-  const char *mapreduce_task_output_dir = getenv("mapreduce_task_output_dir");
-  if (mapreduce_task_output_dir == NULL)
-    LOG(FATAL) << "Cannot read mapreduce_task_output_dir from env; are you using hadoop?";
-  TTableWriter writer(mapreduce_task_output_dir, GetPartition());
+  string output_dir = opts.ttable_output_dir;
+  if (output_dir.empty()) {
+    const char *mapreduce_task_output_dir = getenv("mapreduce_task_output_dir");
+    if (mapreduce_task_output_dir == NULL)
+      LOG(FATAL) << "Cannot read mapreduce_task_output_dir from env; are you using hadoop?";
+    output_dir = mapreduce_task_output_dir;
+  }
+  TTableWriter writer(output_dir, GetTaskPartition());
+  TaskCounters counters("reducer", opts.counters);
+  counters.CountBytes(&cin, &cout);
   ReducerSource input(cin);
   ReducerSink output(cout);
+  boost::scoped_ptr<TTableWriter> reverse_writer;
+  boost::scoped_ptr<ReducerSink> reverse_output;
+  if (opts.bidirectional) {
+    reverse_writer.reset(new TTableWriter(output_dir, GetTaskPartition(), kReversePrefix));
+    reverse_output.reset(new ReducerSink(cout, kReverseDirection));
+  }
 
-  Reducer(opts, &writer, &input, &output, Reducer::kReducer).Run();
+  Reducer reducer(opts, &writer, &input, &output, Reducer::kReducer,
+                  reverse_writer.get(), reverse_output.get());
+
+  PartitionMap map(opts.ttable_parts);
+  if (!opts.partition_map.empty() && !map.Load(opts.partition_map))
+    LOG(FATAL) << "Cannot read partition map " << opts.partition_map;
+
+  // Counts saved by this run and added from an earlier one, per direction
+  boost::scoped_ptr<TTableWriter> counts_writer[2];
+  PartialTTable prior[2];
+  for (int dir = 0; dir < (opts.bidirectional ? 2 : 1); ++dir) {
+    const string prefix = string(dir == kReverseDirection ? kReversePrefix : "") + kCountsPrefix;
+    if (opts.save_counts) {
+      counts_writer[dir].reset(new TTableWriter(output_dir, GetTaskPartition(), prefix));
+      reducer.SetCountsWriter(static_cast<Direction>(dir), counts_writer[dir].get());
+    }
+    if (!opts.prior_counts_dir.empty()) {
+      const string path = opts.prior_counts_dir + "/" + prefix;
+      prior[dir].Load(path + "index." + GetTaskPartition(), path + "entry." + GetTaskPartition());
+      CheckPartition(prior[dir], map, atoi(GetTaskPartition().c_str()));
+      reducer.SetPriorCounts(static_cast<Direction>(dir), &prior[dir], opts.prior_counts_decay);
+    }
+  }
+
+  // The table of the last iteration, which the mappers read too
+  boost::scoped_ptr<TTable> previous[2];
+  for (int dir = 0; opts.table_change && dir < (opts.bidirectional ? 2 : 1); ++dir) {
+    previous[dir].reset(new TTable(opts.ttable_dir, opts.ttable_parts, dir == kReverseDirection ? kReversePrefix : ""));
+    reducer.SetPreviousTable(static_cast<Direction>(dir), previous[dir].get());
+  }
+
+  if (map.NumShards() > 0)
+    reducer.SetPartitionMap(&map);
+  boost::scoped_ptr<FileOutputStream> stats;
+  if (opts.tension_stats) {
+    stats.reset(new FileOutputStream(output_dir, kTensionStatsPrefix + GetTaskPartition()));
+    reducer.SetStatsOutput(stats.get());
+  }
+  reducer.SetCounters(&counters);
+  reducer.Run();
+  counters.Report();
 
   return 0;
 }
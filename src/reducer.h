@@ -1,11 +1,24 @@
 #ifndef _PARALIGN_REDUCER_H_
 #define _PARALIGN_REDUCER_H_
 
+#include <algorithm>
 #include <cmath>
+#include <fstream>
+#include <iomanip>
 #include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
 
+#include "counters.h"
 #include "io.h"
 #include "options.h"
+#include "partition.h"
+#include "pipeline.h"
+#include "tension.h"
 #include "ttable.h"
 #include "types.h"
 #include "contrib/da.h"
@@ -18,6 +31,19 @@ namespace paralign {
 // 3. Sum of toks
 // 4. Sum of log-likelihood
 // These values will be used to compute the update for `diagonal_tension`
+// In bidirectional training, each of the above is kept per direction and
+// reverse rows go to their own writer and sink. A reducer can also save
+// the summed counts before normalization, and add those of an earlier
+// model (see `SetPriorCounts`) to warm-start training on new data.
+// Given `TaskCounters`, it counts rows and times its phases. Shards of
+// rows split by the partition map (see `SetPartitionMap`) are written
+// unnormalized along with their partial row totals, from which
+// pa-diagonal writes the row scales. The statistics can also go to a
+// binary file (see `SetStatsOutput`). With `check_float_counts`, it also
+// sums the counts as rounded by `float_counts` and logs how far that
+// moves the normalized rows (sharded rows are not checked). Given the
+// previous table (see `SetPreviousTable`), it sums how far its rows
+// moved, which pa-diagonal writes to the convergence record.
 class Reducer {
  public:
   enum Mode {
@@ -26,74 +52,519 @@ class Reducer {
     kTension,
   };
 
-  Reducer(const Options &opts, TTableWriter *writer, ReducerSource *input, ReducerSink *output, Mode mode)
-      : opts_(opts), tbl_writer_(writer), in_(input), out_(output),
-        size_counts_(), toks_(0), emp_feat_(0), log_likelihood_(0), mode_(mode) {
+  Reducer(const Options &opts, TTableWriter *writer, ReducerSource *input, ReducerSink *output, Mode mode,
+          TTableWriter *reverse_writer = NULL, ReducerSink *reverse_output = NULL)
+      : opts_(opts), in_(input), stats_out_(NULL), prior_decay_(1), map_(NULL), mode_(mode), counters_(NULL),
+        rows_(0), values_(0) {
+    for (int dir = 0; dir < 2; ++dir) {
+      max_change_[dir] = 0;
+      max_change_row_[dir] = kNoKey;
+      previous_[dir] = NULL;
+      table_change_[dir] = 0;
+      changed_rows_[dir] = 0;
+    }
+    for (int phase = 0; phase < kNumPhases; ++phase)
+      time_[phase] = NULL;
+    tbl_writer_[kForwardDirection] = writer;
+    tbl_writer_[kReverseDirection] = reverse_writer;
+    out_[kForwardDirection] = output;
+    out_[kReverseDirection] = reverse_output;
+    for (int dir = 0; dir < 2; ++dir) {
+      counts_writer_[dir] = NULL;
+      prior_[dir] = NULL;
+    }
     if (mode == kReducer) {
     } else if (mode == kCombiner || mode == kTension) {
-      if (writer)
+      if (writer || reverse_writer)
         LOG(FATAL) << "Running in combiner mode but given a TTableWriter!";
     } else {
       LOG(FATAL) << "Unknown mode: " << mode;
     }
   }
 
+  // Also writes the summed counts of `dir` before normalization to
+  // `writer`
+  void SetCountsWriter(Direction dir, TTableWriter *writer) {
+    if (mode_ != kReducer)
+      LOG(FATAL) << "Only a reducer can save counts";
+    counts_writer_[dir] = writer;
+  }
+
+  // Adds `decay` times the rows of `prior`, counts saved by an earlier
+  // run, to the counts of `dir` before normalization. Rows only found
+  // in `prior` are carried over.
+  void SetPriorCounts(Direction dir, const PartialTTable *prior, double decay) {
+    if (mode_ != kReducer)
+      LOG(FATAL) << "Only a reducer can add prior counts";
+    prior_[dir] = prior;
+    prior_decay_ = decay;
+    prior_seen_[dir].assign(prior->NumRows(), 0);
+  }
+
+  // Sums the L1 distance of each normalized row of `dir` from the same
+  // row of `previous`, the table of the last iteration, over the
+  // entries of the new row. Sharded rows are not measured.
+  void SetPreviousTable(Direction dir, const TTable *previous) {
+    if (mode_ != kReducer)
+      LOG(FATAL) << "Only a reducer can measure the table change";
+    previous_[dir] = previous;
+  }
+
+  // Partition map the input was shuffled with, when it shards rows
+  void SetPartitionMap(const PartitionMap *map) {
+    map_ = map;
+  }
+
+  // Writes the statistics for pa-diagonal to `out` with
+  // `SaveTensionStats` instead of the output sinks
+  void SetStatsOutput(std::ostream *out) {
+    if (mode_ != kReducer)
+      LOG(FATAL) << "Only a reducer can write tension statistics";
+    stats_out_ = out;
+  }
+
+  // Adds statistics saved by reducers with `SetStatsOutput`
+  void LoadStats(std::istream &in, const std::string &name) {
+    if (mode_ != kTension)
+      LOG(FATAL) << "Only pa-diagonal can load tension statistics";
+    LoadTensionStats(in, name, stats_, row_totals_);
+  }
+
+  // Reports to `counters` from now on
+  void SetCounters(TaskCounters *counters) {
+    static const char *names[kNumPhases] = {"parse", "merge", "normalize", "write", "optimize"};
+    counters_ = counters;
+    for (int phase = 0; phase < kNumPhases; ++phase)
+      time_[phase] = counters->Timer(names[phase]);
+  }
+
   void Run() {
+    if (opts_.reducer_threads > 1 && mode_ != kTension) {
+      RunPipelined();
+      return;
+    }
     while (!in_->Done()) {
+      if (counters_)
+        counters_->Progress(rows_, "rows");
       WordId key = in_->Key();
-      if (key >= 0) {
+      if (key >= 0 || PartitionMap::IsShardKey(key)) {
         if (mode_ == kReducer || mode_ == kCombiner)
           ReduceTTableEntry(key);
         else
           LOG(FATAL) << "Got ttable entry but not under reducer or combiner mode";
-      } else if (key == kSizeCountsKey)
-        ReduceSizeCounts();
-      else if (key == kEmpFeatKey)
-        ReduceDoubleValue(key, &emp_feat_);
-      else if (key == kToksKey)
-        ReduceDoubleValue(key, &toks_);
-      else if (key == kLogLikelihoodKey)
-        ReduceDoubleValue(key, &log_likelihood_);
-      else
-        LOG(FATAL) << "Unrecognized key type: " << key;
+      } else {
+        ReduceNonEntry(key);
+      }
     }
     Flush();
   }
 
  private:
+  // Phases timed with `TaskCounters`
+  enum Phase {
+    kParse,
+    kMerge,
+    kNormalize,
+    kWrite,
+    kOptimize,
+    kNumPhases,
+  };
+
+  bool Checking() const {
+    return mode_ == kReducer && opts_.check_float_counts;
+  }
+
   void ReduceTTableEntry(WordId key) {
-    // before this call, `entry_[0]` and `entry_[1]` should be both empty
-    int src = 0, dst = 1, val = 2;
+    // before this call, all of `entry_` should be empty; rows of each
+    // direction are summed separately
+    int src[2] = {0, 0};
+    bool seen[2] = {false, false};
+    ++rows_;
     for (; !in_->Done() && in_->Key() == key; in_->Next()) {
-      in_->Read(&entry_[val]);
-      PlusEq(entry_[val], entry_[src], &entry_[dst]);
-      std::swap(src, dst);
+      Direction dir = in_->EntryDirection();
+      {
+        PhaseTimer timer(time_[kParse]);
+        in_->Read(&val_);
+      }
+      PhaseTimer timer(time_[kMerge]);
+      PlusEq(val_, entry_[dir][src[dir]], &entry_[dir][1 - src[dir]]);
+      if (Checking())
+        PlusEqRounded(val_, check_[dir][src[dir]], &check_[dir][1 - src[dir]]);
+      src[dir] = 1 - src[dir];
+      seen[dir] = true;
+      ++values_;
+    }
+    // `entry_[dir][src[dir]]` now holds the sum
+    for (int dir = 0; dir < 2; ++dir) {
+      if (seen[dir]) {
+        TTableEntry &result = entry_[dir][src[dir]];
+        RowTotal total;
+        double change = 0, table_change;
+        {
+          PhaseTimer timer(time_[kNormalize]);
+          Finish(static_cast<Direction>(dir), key, &result, &counts_, &total,
+                 Checking() ? &check_[dir][src[dir]] : NULL, &change, &table_change);
+        }
+        PhaseTimer timer(time_[kWrite]);
+        Emit(static_cast<Direction>(dir), key, result, counts_, total, change, table_change);
+      }
+      for (int i = 0; i < 2; ++i) {
+        entry_[dir][i].Clear();
+        check_[dir][i].Clear();
+      }
+    }
+    val_.Clear();
+  }
+
+  // `PlusEq` with `x` rounded as with `float_counts`
+  static void PlusEqRounded(const TTableEntry &x, const TTableEntry &y, TTableEntry *z) {
+    TTableEntry rounded(x);
+    rounded.RoundToFloat();
+    PlusEq(rounded, y, z);
+  }
+
+  // Largest difference between the items of two rows
+  static double MaxChange(const TTableEntry &x, const TTableEntry &y) {
+    double change = 0;
+    size_t i = 0, j = 0;
+    while (i < x.Size() || j < y.Size()) {
+      if (j == y.Size() || (i < x.Size() && x[i].k < y[j].k)) {
+        change = std::max(change, std::fabs(x[i++].v));
+      } else if (i == x.Size() || y[j].k < x[i].k) {
+        change = std::max(change, std::fabs(y[j++].v));
+      } else {
+        change = std::max(change, std::fabs(x[i++].v - y[j++].v));
+      }
     }
-    // `entry_[src]` now holds the sum
-    TTableEntry &result = entry_[src];
+    return change;
+  }
+
+  // L1 distance of a normalized row from the same row of `previous`,
+  // over the entries of `row`
+  static double TableChange(const TTableEntry &row, const TTable &previous, WordId src) {
+    double change = 0;
+    for (size_t i = 0; i < row.Size(); ++i)
+      change += std::fabs(row[i].v - previous.Query(src, row[i].k));
+    return change;
+  }
+
+  // Row of a shuffle key
+  WordId RowOf(WordId key) const {
+    if (!PartitionMap::IsShardKey(key))
+      return key;
+    if (map_ == NULL || PartitionMap::ShardOfKey(key) >= map_->NumShards())
+      LOG(FATAL) << "Got row shard " << key << " but no partition map with it";
+    return map_->GetShard(PartitionMap::ShardOfKey(key)).src;
+  }
+
+  bool Sharded(WordId src) const {
+    return map_ && map_->Sharded(src);
+  }
+
+  // Normalizes the summed entry when running as a reducer, after adding
+  // prior counts and keeping a copy in `counts` if they are saved. A
+  // shard of a row is only brought as far as its `total` allows. Given
+  // the `check` sum of rounded counts, normalizes it too and sets
+  // `change` to the largest difference. Sets `table_change` to the
+  // change from the previous table, or -1 if not measured.
+  void Finish(Direction dir, WordId key, TTableEntry *result, TTableEntry *counts, RowTotal *total,
+              TTableEntry *check = NULL, double *change = NULL, double *table_change = NULL) {
+    if (table_change)
+      *table_change = -1;
     if (mode_ == kReducer) {
-      if (opts_.variational_bayes)
-        result.NormalizeVB(opts_.alpha);
-      else
-        result.Normalize();
-      tbl_writer_->Write(key, result);
+      const WordId src = RowOf(key);
+      AddPriorCounts(dir, src, result);
+      if (counts_writer_[dir])
+        *counts = *result;
+      if (Sharded(src)) {
+        *total = RowTotal(result->Sum(), result->Size());
+        if (opts_.variational_bayes)
+          result->NumeratorsVB(opts_.alpha);
+        return;
+      }
+      Normalize(result);
+      if (table_change && previous_[dir])
+        *table_change = TableChange(*result, *previous_[dir], src);
+      if (check) {
+        AddPriorCounts(dir, src, check);
+        Normalize(check);
+        *change = MaxChange(*result, *check);
+      }
+    }
+  }
+
+  void Normalize(TTableEntry *entry) const {
+    if (opts_.variational_bayes)
+      entry->NormalizeVB(opts_.alpha);
+    else
+      entry->Normalize();
+  }
+
+  void Emit(Direction dir, WordId key, const TTableEntry &result, const TTableEntry &counts,
+            const RowTotal &total, double change = 0, double table_change = -1) {
+    if (mode_ == kReducer) {
+      const WordId src = RowOf(key);
+      Writer(dir)->Write(src, result);
+      if (counts_writer_[dir])
+        counts_writer_[dir]->Write(src, counts);
+      if (Sharded(src)) {
+        RowTotal &sum = row_totals_[dir][src];
+        sum.first += total.first;
+        sum.second += total.second;
+      }
+      if (change > max_change_[dir]) {
+        max_change_[dir] = change;
+        max_change_row_[dir] = src;
+      }
+      if (table_change >= 0) {
+        table_change_[dir] += table_change;
+        ++changed_rows_[dir];
+      }
     } else if (mode_ == kCombiner) {
-      out_->WriteTTableEntry(key, result);
+      Output(dir)->WriteTTableEntry(key, result);
     } else {
       LOG(FATAL) << "How did you get here if you are not a reducer or a combiner?";
     }
-    entry_[0].Clear();
-    entry_[1].Clear();
-    entry_[2].Clear();
   }
 
-  void ReduceSizeCounts() {
-    for (; !in_->Done() && in_->Key() == kSizeCountsKey; in_->Next()) {
+  void AddPriorCounts(Direction dir, WordId key, TTableEntry *result) {
+    if (prior_[dir] == NULL)
+      return;
+    const size_t row = prior_[dir]->FindRow(key);
+    if (row == prior_[dir]->NumRows())
+      return;
+    // Each key comes once, so workers never share a row
+    prior_seen_[dir][row] = 1;
+    TTableEntry prior, sum;
+    prior_[dir]->ReadRow(row, &prior);
+    prior.Scale(prior_decay_);
+    PlusEq(prior, *result, &sum);
+    result->Swap(sum);
+  }
+
+  // Rows of the prior counts that never came up in the input
+  void CarryOverPriorCounts() {
+    TTableEntry result;
+    for (int dir = 0; dir < 2; ++dir) {
+      if (prior_[dir] == NULL)
+        continue;
+      size_t carried = 0;
+      for (size_t row = 0; row < prior_[dir]->NumRows(); ++row) {
+        if (prior_seen_[dir][row])
+          continue;
+        const WordId key = prior_[dir]->RowKey(row);
+        RowTotal total;
+        double table_change;
+        result.Clear();
+        Finish(static_cast<Direction>(dir), key, &result, &counts_, &total, NULL, NULL, &table_change);
+        Emit(static_cast<Direction>(dir), key, result, counts_, total, 0, table_change);
+        ++carried;
+      }
+      LOG(INFO) << std::dec << "Carried over " << carried << " of " << prior_[dir]->NumRows() << " rows of prior counts";
+    }
+  }
+
+  TTableWriter *Writer(Direction dir) const {
+    if (tbl_writer_[dir] == NULL)
+      LOG(FATAL) << "Got reverse ttable entry but not running bidirectional";
+    return tbl_writer_[dir];
+  }
+
+  ReducerSink *Output(Direction dir) const {
+    if (out_[dir] == NULL)
+      LOG(FATAL) << "Got reverse statistics but not running bidirectional";
+    return out_[dir];
+  }
+
+  // All rows of one key, passed along the pipeline
+  struct RowBatch {
+    WordId key;
+    size_t seq;
+    std::vector<std::string> values;
+    TTableEntry result[2];
+    TTableEntry counts[2];
+    RowTotal total[2];
+    double change[2];
+    double table_change[2];
+    bool seen[2];
+  };
+
+  typedef BoundedQueue<RowBatch *> WorkQueue;
+  typedef ReorderBuffer<RowBatch *> DoneQueue;
+
+  // Same as the serial loop of `Run` but with ttable entries going
+  // through three stages: this thread reads rows and groups them by
+  // key; a pool of `reducer_threads - 1` workers parses, sums and
+  // normalizes them; a writer thread emits the results in key order,
+  // so that the output is the same as the serial loop's whatever the
+  // threads' timing: the combiner's stdout stays sorted by key, and
+  // the table pieces are written in the same order. Other keys are
+  // reduced by this thread as usual.
+  void RunPipelined() {
+    const int workers = opts_.reducer_threads - 1;
+    const size_t window = 4 * workers;
+    WorkQueue work(window);
+    DoneQueue done(window);
+    std::vector<StageStats> merge_stats(workers);
+    StageStats read_stats, write_stats;
+
+    boost::thread_group threads;
+    for (int i = 0; i < workers; ++i)
+      threads.create_thread(boost::bind(&Reducer::MergeStage, this, &work, &done, &merge_stats[i]));
+    boost::thread writer(boost::bind(&Reducer::WriteStage, this, &done, &write_stats));
+
+    const double start = WallTime();
+    while (!in_->Done()) {
+      double busy_start = WallTime();
+      WordId key = in_->Key();
+      if (key >= 0 || PartitionMap::IsShardKey(key)) {
+        RowBatch *batch = new RowBatch;
+        batch->key = key;
+        for (; !in_->Done() && in_->Key() == key; in_->Next()) {
+          batch->values.push_back(std::string());
+          in_->Read(&batch->values.back());
+        }
+        ++rows_;
+        values_ += batch->values.size();
+        if (counters_)
+          counters_->Progress(rows_, "rows");
+        read_stats.busy += WallTime() - busy_start;
+        ++read_stats.items;
+        batch->seq = done.Reserve();
+        work.Push(batch);
+      } else {
+        ReduceNonEntry(key);
+        read_stats.busy += WallTime() - busy_start;
+      }
+    }
+    work.Close();
+    threads.join_all();
+    done.Close();
+    writer.join();
+    read_stats.wall = WallTime() - start;
+
+    StageStats merge_total;
+    for (int i = 0; i < workers; ++i)
+      merge_total += merge_stats[i];
+    read_stats.Report("read", 1);
+    merge_total.Report("merge", workers);
+    write_stats.Report("write", 1);
+    // Busy time of each stage; parsing and normalizing happen in the
+    // merge stage
+    if (counters_ && counters_->Enabled()) {
+      *time_[kParse] += read_stats.busy;
+      *time_[kMerge] += merge_total.busy;
+      *time_[kWrite] += write_stats.busy;
+    }
+
+    Flush();
+  }
+
+  void MergeStage(WorkQueue *work, DoneQueue *done, StageStats *stats) {
+    const double start = WallTime();
+    TTableEntry sum[2][2], check[2][2], val;
+    RowBatch *batch;
+    while (work->Pop(&batch)) {
+      double busy_start = WallTime();
+      int src[2] = {0, 0};
+      for (int dir = 0; dir < 2; ++dir) {
+        sum[dir][0].Clear();
+        check[dir][0].Clear();
+        batch->change[dir] = 0;
+        batch->seen[dir] = false;
+      }
+      for (size_t i = 0; i < batch->values.size(); ++i) {
+        Direction dir = ReducerSource::ValueDirection(batch->values[i]);
+        ReducerSource::ParseEntry(batch->values[i], &val);
+        PlusEq(val, sum[dir][src[dir]], &sum[dir][1 - src[dir]]);
+        if (Checking())
+          PlusEqRounded(val, check[dir][src[dir]], &check[dir][1 - src[dir]]);
+        src[dir] = 1 - src[dir];
+        batch->seen[dir] = true;
+      }
+      std::vector<std::string>().swap(batch->values);
+      for (int dir = 0; dir < 2; ++dir) {
+        if (batch->seen[dir]) {
+          std::swap(batch->result[dir], sum[dir][src[dir]]);
+          Finish(static_cast<Direction>(dir), batch->key, &batch->result[dir], &batch->counts[dir],
+                 &batch->total[dir], Checking() ? &check[dir][src[dir]] : NULL, &batch->change[dir],
+                 &batch->table_change[dir]);
+        }
+      }
+      stats->busy += WallTime() - busy_start;
+      ++stats->items;
+      done->Put(batch->seq, batch);
+    }
+    stats->wall = WallTime() - start;
+  }
+
+  void WriteStage(DoneQueue *done, StageStats *stats) {
+    const double start = WallTime();
+    RowBatch *batch;
+    while (done->Take(&batch)) {
+      double busy_start = WallTime();
+      for (int dir = 0; dir < 2; ++dir) {
+        if (batch->seen[dir])
+          Emit(static_cast<Direction>(dir), batch->key, batch->result[dir], batch->counts[dir],
+               batch->total[dir], batch->change[dir], batch->table_change[dir]);
+      }
+      delete batch;
+      stats->busy += WallTime() - busy_start;
+      ++stats->items;
+    }
+    stats->wall = WallTime() - start;
+  }
+
+  void ReduceNonEntry(WordId key) {
+    TensionStats &stats = stats_[StatKeyDirection(key)];
+    const WordId forward_key = ForwardStatKey(key);
+    if (forward_key == kSizeCountsKey)
+      ReduceSizeCounts(key, &stats.size_counts);
+    else if (forward_key == kEmpFeatKey)
+      ReduceDoubleValue(key, &stats.emp_feat);
+    else if (forward_key == kToksKey)
+      ReduceDoubleValue(key, &stats.toks);
+    else if (forward_key == kLogLikelihoodKey)
+      ReduceDoubleValue(key, &stats.log_likelihood);
+    else if (forward_key == kRowTotalKey && mode_ == kTension)
+      ReduceRowTotals(key, &row_totals_[StatKeyDirection(key)]);
+    else if (forward_key == kTableChangeKey && mode_ == kTension)
+      ReduceTableChange(key, &stats);
+    else
+      LOG(FATAL) << "Unrecognized key type: " << key;
+  }
+
+  void ReduceSizeCounts(WordId key, std::map<SentSzPair, int> *size_counts) {
+    for (; !in_->Done() && in_->Key() == key; in_->Next()) {
       std::istringstream strm(in_->Value());
       SentSzPair p;
       int c;
       while (strm >> p >> c)
-        size_counts_[p] += c;
+        (*size_counts)[p] += c;
+    }
+  }
+
+  void ReduceRowTotals(WordId key, std::map<WordId, RowTotal> *totals) {
+    for (; !in_->Done() && in_->Key() == key; in_->Next()) {
+      std::istringstream strm(in_->Value());
+      WordId src;
+      int64_t sum, size;
+      if (!(strm >> src >> sum >> size))
+        LOG(FATAL) << "Invalid row total: " << in_->Value();
+      RowTotal &total = (*totals)[src];
+      total.first += DoubleFromInt64(sum);
+      total.second += size;
+    }
+  }
+
+  void ReduceTableChange(WordId key, TensionStats *stats) {
+    for (; !in_->Done() && in_->Key() == key; in_->Next()) {
+      std::istringstream strm(in_->Value());
+      int64_t change, rows;
+      if (!(strm >> change >> rows))
+        LOG(FATAL) << "Invalid table change: " << in_->Value();
+      stats->table_change += DoubleFromInt64(change);
+      stats->changed_rows += rows;
     }
   }
 
@@ -106,61 +577,183 @@ class Reducer {
   }
 
   void Flush() {
-    if (mode_ == kReducer)
-      tbl_writer_->WriteIndex();
-    if (mode_ == kReducer || mode_ == kCombiner) {
-      if (!size_counts_.empty())
-        out_->WriteSizeCounts(size_counts_.begin(), size_counts_.end());
-      if (toks_ != 0)
-        out_->WriteToks(toks_);
-      if (emp_feat_ != 0)
-        out_->WriteEmpFeat(emp_feat_);
-      if (log_likelihood_ != 0)
-        out_->WriteLogLikelihood(log_likelihood_);
+    if (counters_) {
+      counters_->Add("rows", rows_);
+      counters_->Add("values", values_);
+    }
+    if (mode_ == kReducer) {
+      CarryOverPriorCounts();
+      for (int dir = 0; Checking() && dir < 2; ++dir) {
+        if (tbl_writer_[dir])
+          LOG(INFO) << "Float counts change " << (dir == kReverseDirection ? "reverse " : "")
+                    << "probabilities by at most " << max_change_[dir] << " (row " << max_change_row_[dir] << ")";
+      }
+      for (int dir = 0; dir < 2; ++dir) {
+        if (previous_[dir] == NULL)
+          continue;
+        stats_[dir].table_change += table_change_[dir];
+        stats_[dir].changed_rows += changed_rows_[dir];
+        LOG(INFO) << std::dec << changed_rows_[dir] << (dir == kReverseDirection ? " reverse" : "")
+                  << " rows moved by " << table_change_[dir] / std::max<int64_t>(changed_rows_[dir], 1)
+                  << " on average from the previous table";
+      }
+      PhaseTimer timer(time_[kWrite]);
+      for (int dir = 0; dir < 2; ++dir) {
+        if (tbl_writer_[dir])
+          tbl_writer_[dir]->WriteIndex();
+        if (counts_writer_[dir])
+          counts_writer_[dir]->WriteIndex();
+      }
+    }
+    if (stats_out_) {
+      SaveTensionStats(*stats_out_, stats_, row_totals_);
+      if (!*stats_out_)
+        LOG(FATAL) << "Failed to write tension statistics";
+    } else if (mode_ == kReducer || mode_ == kCombiner) {
+      for (int dir = 0; dir < 2; ++dir) {
+        const TensionStats &stats = stats_[dir];
+        if (stats.Empty())
+          continue;
+        ReducerSink *out = Output(static_cast<Direction>(dir));
+        if (!stats.size_counts.empty())
+          out->WriteSizeCounts(stats.size_counts.begin(), stats.size_counts.end());
+        if (stats.toks != 0)
+          out->WriteToks(stats.toks);
+        if (stats.emp_feat != 0)
+          out->WriteEmpFeat(stats.emp_feat);
+        if (stats.log_likelihood != 0)
+          out->WriteLogLikelihood(stats.log_likelihood);
+        if (stats.changed_rows != 0)
+          out->WriteTableChange(stats.table_change, stats.changed_rows);
+      }
+      for (int dir = 0; dir < 2; ++dir) {
+        for (std::map<WordId, RowTotal>::const_iterator it = row_totals_[dir].begin(); it != row_totals_[dir].end();
+             ++it)
+          Output(static_cast<Direction>(dir))->WriteRowTotal(it->first, it->second.first, it->second.second);
+      }
     }
     if (mode_ == kTension) {
-      emp_feat_ /= toks_;
-      const double base2_log_likelihood = log_likelihood_ / std::log(2);
-      LOG(INFO) << "  log_e likelihood: " << log_likelihood_;
-      LOG(INFO) << "  log_2 likelihood: " << base2_log_likelihood;
-      LOG(INFO) << "     cross entropy: " << -base2_log_likelihood / toks_;
-      LOG(INFO) << "        perplexity: " << std::pow(2.0, -base2_log_likelihood / toks_);
-      LOG(INFO) << " posterior al-feat: " << emp_feat_;
-      LOG(INFO) << "       size counts: " << size_counts_.size();
-      if (opts_.favor_diagonal && opts_.optimize_tension) {
-        double diagonal_tension = opts_.diagonal_tension;
-        for (int ii = 0; ii < 8; ++ii) {
-          double mod_feat = 0;
-          std::map<SentSzPair, int>::const_iterator it = size_counts_.begin();
-          for(; it != size_counts_.end(); ++it) {
-            SentSzPair p = it->first;
-            for (int j = 1; j <= FirstSz(p); ++j)
-              mod_feat += it->second * DiagonalAlignment::ComputeDLogZ(j, FirstSz(p), SecondSz(p), diagonal_tension);
-          }
-          mod_feat /= toks_;
-          LOG(INFO) << "  " << ii + 1 << "  model al-feat: " << mod_feat << " (tension=" << diagonal_tension << ")";
-          diagonal_tension += (emp_feat_ - mod_feat) * 20.0;
-          if (diagonal_tension <= 0.1) diagonal_tension = 0.1;
-          if (diagonal_tension > 14) diagonal_tension = 14;
-        }
-        LOG(INFO) << "     final tension: " << diagonal_tension;
-        out_->WriteTension(diagonal_tension);
+      // One line per direction, forward first
+      FlushTension(kForwardDirection, opts_);
+      if (opts_.bidirectional)
+        FlushTension(kReverseDirection, opts_.Reversed());
+      else if (!stats_[kReverseDirection].Empty() || !row_totals_[kReverseDirection].empty())
+        LOG(FATAL) << "Got reverse statistics but not running bidirectional";
+      if (!opts_.convergence_file.empty())
+        SaveConvergence();
+    }
+  }
+
+  static double Perplexity(const TensionStats &stats) {
+    return std::pow(2.0, -stats.log_likelihood / std::log(2) / stats.toks);
+  }
+
+  // Writes the convergence record (see `Options::convergence_file`)
+  void SaveConvergence() const {
+    std::ofstream out(opts_.convergence_file.c_str());
+    out << "direction\tlog_likelihood\ttoks\tperplexity\ttable_change\n" << std::setprecision(17);
+    for (int dir = 0; dir < (opts_.bidirectional ? 2 : 1); ++dir) {
+      const TensionStats &stats = stats_[dir];
+      out << (dir == kReverseDirection ? "reverse" : "forward") << '\t' << stats.log_likelihood << '\t'
+          << stats.toks << '\t' << Perplexity(stats) << '\t';
+      if (stats.changed_rows > 0)
+        out << stats.table_change / stats.changed_rows << '\n';
+      else
+        out << "-\n";
+    }
+    if (!out)
+      LOG(FATAL) << "Cannot write the convergence record to " << opts_.convergence_file;
+    LOG(INFO) << "Saved the convergence record to " << opts_.convergence_file;
+  }
+
+  void FlushTension(Direction dir, const Options &opts) {
+    TensionStats &stats = stats_[dir];
+    stats.emp_feat /= stats.toks;
+    const double base2_log_likelihood = stats.log_likelihood / std::log(2);
+    if (opts_.bidirectional)
+      LOG(INFO) << "Direction: " << (dir == kReverseDirection ? "reverse" : "forward");
+    LOG(INFO) << "  log_e likelihood: " << stats.log_likelihood;
+    LOG(INFO) << "  log_2 likelihood: " << base2_log_likelihood;
+    LOG(INFO) << "     cross entropy: " << -base2_log_likelihood / stats.toks;
+    LOG(INFO) << "        perplexity: " << Perplexity(stats);
+    LOG(INFO) << " posterior al-feat: " << stats.emp_feat;
+    if (stats.changed_rows > 0)
+      LOG(INFO) << "      table change: " << stats.table_change / stats.changed_rows;
+    if (!opts.size_counts_file.empty()) {
+      std::string path = opts.size_counts_file;
+      if (dir == kReverseDirection)
+        path += ".reverse";
+      if (stats.size_counts.empty()) {
+        LoadSizeCounts(path, &stats.size_counts);
+        LOG(INFO) << "Loaded size counts from " << path;
+      } else {
+        SaveSizeCounts(path, stats.size_counts);
+        LOG(INFO) << "Saved size counts to " << path;
       }
     }
+    LOG(INFO) << "       size counts: " << stats.size_counts.size();
+    if (!row_totals_[dir].empty())
+      SaveRowScales(dir, opts);
+    if (opts.favor_diagonal && opts.optimize_tension) {
+      if (stats.size_counts.empty())
+        LOG(FATAL) << "No size counts to optimize tension with";
+      PhaseTimer timer(time_[kOptimize]);
+      TensionOptimizer optimizer(stats.size_counts, stats.toks, opts.reducer_threads);
+      double diagonal_tension = optimizer.Optimize(stats.emp_feat, opts.diagonal_tension);
+      LOG(INFO) << "     final tension: " << diagonal_tension;
+      out_[kForwardDirection]->WriteTension(diagonal_tension);
+    }
+  }
+
+  // Writes the `RowScale` of each sharded row to `row_scale_dir`
+  void SaveRowScales(Direction dir, const Options &opts) {
+    if (opts.row_scale_dir.empty())
+      LOG(FATAL) << "Got totals of sharded rows but no row_scale_dir to save their scales to";
+    const std::string path =
+        opts.row_scale_dir + "/" + (dir == kReverseDirection ? kReversePrefix : "") + kRowScaleName;
+    std::ofstream out(path.c_str());
+    out << std::setprecision(17);
+    for (std::map<WordId, RowTotal>::const_iterator it = row_totals_[dir].begin(); it != row_totals_[dir].end(); ++it)
+      out << it->first << ' ' << RowScale(it->second.first, it->second.second, opts.variational_bayes, opts.alpha)
+          << '\n';
+    if (!out)
+      LOG(FATAL) << "Cannot write row scales to " << path;
+    LOG(INFO) << "Saved scales of " << row_totals_[dir].size() << " sharded rows to " << path;
   }
 
   const Options opts_;
-  TTableWriter *tbl_writer_;
+  // Indexed by `Direction`
+  TTableWriter *tbl_writer_[2];
   ReducerSource *in_;
-  ReducerSink *out_;
+  ReducerSink *out_[2];
+  std::ostream *stats_out_;
+
+  TTableEntry entry_[2][2], val_, counts_;
+  TensionStats stats_[2];
+  // Rounded sums and the largest change they make with
+  // `check_float_counts`, indexed by `Direction`
+  TTableEntry check_[2][2];
+  double max_change_[2];
+  WordId max_change_row_[2];
+  // Totals of sharded rows, indexed by `Direction`
+  std::map<WordId, RowTotal> row_totals_[2];
+  // Previous table and the change from it, indexed by `Direction`
+  const TTable *previous_[2];
+  double table_change_[2];
+  int64_t changed_rows_[2];
 
-  TTableEntry entry_[3];
-  std::map<SentSzPair, int> size_counts_;
-  double toks_;
-  double emp_feat_;
-  double log_likelihood_;
+  // Saving and adding counts, indexed by `Direction`
+  TTableWriter *counts_writer_[2];
+  const PartialTTable *prior_[2];
+  double prior_decay_;
+  std::vector<char> prior_seen_[2];
 
+  const PartitionMap *map_;
   Mode mode_;
+
+  TaskCounters *counters_;
+  double *time_[kNumPhases];
+  int64_t rows_, values_;
 };
 } // namespace paralign
 
@@ -0,0 +1,312 @@
+// pa-shuffle: a local stand-in for the Hadoop shuffle. Reads
+// tab-delimited key-value lines (from the given files or stdin),
+// assigns each line to partition `key % N` like `paralign.Partitioner1`
+// (or as the partition map `-m` says) and sorts each partition by numeric key, breaking ties by the raw
+// line as `LC_ALL=C sort` does so that sums come out the same.
+//
+// Usage: pa-shuffle [-n PARTS] [-m MAP] [-o PATTERN] [-j THREADS] [-S MB] [-T DIR] [FILE...]
+//
+// Without `-o`, all partitions go to stdout one after another (which
+// only makes sense with a single partition, e.g. to pipe into
+// pa-combiner or pa-reducer); otherwise partition i is written to
+// `PATTERN` with `%d` replaced by i. Partitions that do not fit into
+// their share of the `-S` memory budget are sorted in runs that are
+// spilled to `-T` and merged at the end.
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <queue>
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/utility.hpp>
+
+#include "partition.h"
+#include "pipeline.h"
+#include "types.h"
+#include "contrib/log.h"
+
+using namespace std;
+
+namespace paralign {
+// Parses the key before the first tab
+inline WordId ParseKey(const string &line) {
+  const char *begin = line.c_str();
+  char *end;
+  errno = 0;
+  long key = strtol(begin, &end, 10);
+  if (end == begin || *end != '\t' || errno != 0)
+    LOG(FATAL) << "Invalid input line: " << line;
+  return key;
+}
+
+// Sorts the lines of one partition in memory, spilling sorted runs to
+// disk when they outgrow `budget` bytes.
+class PartitionSorter : boost::noncopyable {
+ public:
+  PartitionSorter(size_t budget, int threads, const string &tmp_dir)
+      : budget_(budget), threads_(threads), tmp_dir_(tmp_dir), bytes_(0), lines_(0) {}
+
+  ~PartitionSorter() {
+    for (size_t i = 0; i < runs_.size(); ++i)
+      unlink(runs_[i].c_str());
+  }
+
+  void Add(WordId key, const string &line) {
+    Record r;
+    r.key = key;
+    r.offset = arena_.size();
+    r.length = line.size();
+    arena_ += line;
+    records_.push_back(r);
+    bytes_ += line.size() + sizeof(Record);
+    ++lines_;
+    if (bytes_ > budget_)
+      Spill();
+  }
+
+  // Writes out everything in order; can only be called once
+  void Finish(ostream &out) {
+    if (runs_.empty()) {
+      SortChunk();
+      WriteChunk(out);
+    } else {
+      if (!records_.empty())
+        Spill();
+      MergeRuns(out);
+    }
+    LOG(INFO) << "pa-shuffle: " << lines_ << " lines, " << runs_.size() << " spilled runs";
+  }
+
+ private:
+  struct Record {
+    WordId key;
+    size_t offset;
+    size_t length;
+  };
+
+  struct RecordLess {
+    explicit RecordLess(const string &arena) : arena(arena) {}
+
+    bool operator()(const Record &x, const Record &y) const {
+      if (x.key != y.key)
+        return x.key < y.key;
+      int c = memcmp(arena.data() + x.offset, arena.data() + y.offset, min(x.length, y.length));
+      if (c != 0)
+        return c < 0;
+      return x.length < y.length;
+    }
+
+    const string &arena;
+  };
+
+  void SortRange(size_t begin, size_t end) {
+    sort(records_.begin() + begin, records_.begin() + end, RecordLess(arena_));
+  }
+
+  // Sorts pieces of the chunk in parallel, then merges them pairwise
+  void SortChunk() {
+    const size_t n = records_.size();
+    size_t pieces = threads_;
+    if (pieces > n / 4096 + 1)
+      pieces = n / 4096 + 1;
+    vector<size_t> bounds;
+    for (size_t i = 0; i <= pieces; ++i)
+      bounds.push_back(n * i / pieces);
+    if (pieces == 1) {
+      SortRange(0, n);
+      return;
+    }
+    boost::thread_group threads;
+    for (size_t i = 0; i < pieces; ++i)
+      threads.create_thread(boost::bind(&PartitionSorter::SortRange, this, bounds[i], bounds[i + 1]));
+    threads.join_all();
+    for (size_t width = 1; width < pieces; width *= 2) {
+      for (size_t i = 0; i + width < pieces; i += 2 * width) {
+        size_t last = min(i + 2 * width, pieces);
+        inplace_merge(records_.begin() + bounds[i], records_.begin() + bounds[i + width],
+                      records_.begin() + bounds[last], RecordLess(arena_));
+      }
+    }
+  }
+
+  void WriteChunk(ostream &out) const {
+    for (size_t i = 0; i < records_.size(); ++i) {
+      out.write(arena_.data() + records_[i].offset, records_[i].length);
+      out.put('\n');
+    }
+  }
+
+  void Spill() {
+    SortChunk();
+    string path = tmp_dir_ + "/pa-shuffle.XXXXXX";
+    vector<char> buf(path.begin(), path.end());
+    buf.push_back('\0');
+    int fd = mkstemp(&buf[0]);
+    if (fd < 0)
+      LOG(FATAL) << "Cannot create temporary file under " << tmp_dir_ << ": " << strerror(errno);
+    close(fd);
+    path = &buf[0];
+    runs_.push_back(path);
+    ofstream out(path.c_str(), ios::binary);
+    WriteChunk(out);
+    if (!out)
+      LOG(FATAL) << "Failed to write run " << path;
+    arena_.clear();
+    records_.clear();
+    bytes_ = 0;
+  }
+
+  // Head line of a run in the k-way merge; the top of the queue is the
+  // smallest
+  struct Head {
+    WordId key;
+    string line;
+    size_t run;
+
+    bool operator<(const Head &that) const {
+      if (key != that.key)
+        return key > that.key;
+      return line > that.line;
+    }
+  };
+
+  void MergeRuns(ostream &out) {
+    vector<ifstream *> in(runs_.size());
+    priority_queue<Head> heads;
+    for (size_t i = 0; i < runs_.size(); ++i) {
+      in[i] = new ifstream(runs_[i].c_str(), ios::binary);
+      Push(in[i], i, &heads);
+    }
+    while (!heads.empty()) {
+      Head top = heads.top();
+      heads.pop();
+      out << top.line << '\n';
+      Push(in[top.run], top.run, &heads);
+    }
+    for (size_t i = 0; i < in.size(); ++i)
+      delete in[i];
+  }
+
+  static void Push(ifstream *in, size_t run, priority_queue<Head> *heads) {
+    Head h;
+    if (getline(*in, h.line)) {
+      h.key = ParseKey(h.line);
+      h.run = run;
+      heads->push(h);
+    }
+  }
+
+  const size_t budget_;
+  const int threads_;
+  const string tmp_dir_;
+  string arena_;
+  vector<Record> records_;
+  size_t bytes_, lines_;
+  vector<string> runs_;
+};
+
+// Output of a single partition
+inline void FinishPartition(PartitionSorter *sorter, const string &path) {
+  ofstream out(path.c_str(), ios::binary);
+  if (!out)
+    LOG(FATAL) << "Cannot open " << path << " for write: " << strerror(errno);
+  sorter->Finish(out);
+  if (!out)
+    LOG(FATAL) << "Failed to write " << path;
+}
+
+inline string PartitionPath(const string &pattern, int part) {
+  string path = pattern;
+  size_t pos = path.find("%d");
+  if (pos == string::npos)
+    LOG(FATAL) << "Output pattern has no %d: " << pattern;
+  return path.replace(pos, 2, boost::lexical_cast<string>(part));
+}
+} // namespace paralign
+
+using namespace paralign;
+
+static void Usage(const char *prog) {
+  cerr << "Usage: " << prog << " [-n PARTS] [-m MAP] [-o PATTERN] [-j THREADS] [-S MB] [-T DIR] [FILE...]" << endl;
+  exit(1);
+}
+
+int main(int argc, char *argv[]) {
+  int parts = 1, threads = boost::thread::hardware_concurrency(), mb = 512;
+  string pattern, map_path;
+  const char *tmp_dir = getenv("TMPDIR");
+  if (tmp_dir == NULL) tmp_dir = "/tmp";
+  int c;
+  while ((c = getopt(argc, argv, "n:m:o:j:S:T:")) != -1) {
+    switch (c) {
+      case 'n': parts = atoi(optarg); break;
+      case 'm': map_path = optarg; break;
+      case 'o': pattern = optarg; break;
+      case 'j': threads = atoi(optarg); break;
+      case 'S': mb = atoi(optarg); break;
+      case 'T': tmp_dir = optarg; break;
+      default: Usage(argv[0]);
+    }
+  }
+  if (parts <= 0 || mb <= 0)
+    Usage(argv[0]);
+  if (threads <= 0)
+    threads = 1;
+  PartitionMap map(parts);
+  if (!map_path.empty() && (!map.Load(map_path) || map.Parts() != parts))
+    LOG(FATAL) << "Cannot read a partition map for " << parts << " parts from " << map_path;
+
+  ios::sync_with_stdio(false);
+  const double start = WallTime();
+  const size_t budget = (static_cast<size_t>(mb) << 20) / parts;
+  vector<PartitionSorter *> sorters(parts);
+  for (int i = 0; i < parts; ++i)
+    sorters[i] = new PartitionSorter(budget, threads, tmp_dir);
+
+  vector<string> inputs(argv + optind, argv + argc);
+  if (inputs.empty())
+    inputs.push_back("-");
+  string line;
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    boost::scoped_ptr<ifstream> file;
+    istream *in = &cin;
+    if (inputs[i] != "-") {
+      file.reset(new ifstream(inputs[i].c_str(), ios::binary));
+      if (!*file)
+        LOG(FATAL) << "Cannot open " << inputs[i] << ": " << strerror(errno);
+      in = file.get();
+    }
+    while (getline(*in, line)) {
+      WordId key = ParseKey(line);
+      sorters[map.Part(key)]->Add(key, line);
+    }
+  }
+
+  if (pattern.empty()) {
+    for (int i = 0; i < parts; ++i)
+      sorters[i]->Finish(cout);
+  } else {
+    // Up to `threads` partitions at a time
+    for (int i = 0; i < parts; i += threads) {
+      boost::thread_group group;
+      for (int j = i; j < parts && j < i + threads; ++j)
+        group.create_thread(boost::bind(FinishPartition, sorters[j], PartitionPath(pattern, j)));
+      group.join_all();
+    }
+  }
+  for (int i = 0; i < parts; ++i)
+    delete sorters[i];
+  LOG(INFO) << "pa-shuffle: " << parts << " partitions in " << WallTime() - start << "s";
+  return 0;
+}
@@ -0,0 +1,88 @@
+#ifndef _PARALIGN_SKETCH_H_
+#define _PARALIGN_SKETCH_H_
+
+#include <cmath>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "types.h"
+#include "contrib/log.h"
+
+namespace paralign {
+// Mixes the bits of `x` (the splitmix64 finalizer)
+inline uint64_t MixBits(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+inline uint64_t HashWord(WordId w) {
+  return MixBits(static_cast<uint32_t>(w) + 0x9e3779b97f4a7c15ULL);
+}
+
+inline uint64_t HashPair(WordId src, WordId tgt) {
+  return MixBits(static_cast<uint64_t>(static_cast<uint32_t>(src)) << 32 | static_cast<uint32_t>(tgt));
+}
+
+// HyperLogLog distinct counter (Flajolet et al., 2007) over 64-bit
+// hashes, with linear counting for small cardinalities. Uses
+// 2^`bits` bytes; the relative error is about 1.04 / sqrt(2^`bits`).
+// Sketches with the same `bits` merge into that of the union.
+class HyperLogLog {
+ public:
+  explicit HyperLogLog(int bits = 14) : bits_(bits) {
+    if (bits < 4 || bits > 20)
+      LOG(FATAL) << "HyperLogLog needs 4 to 20 bits, not " << bits;
+    registers_.resize(static_cast<size_t>(1) << bits);
+  }
+
+  void Add(uint64_t hash) {
+    const size_t index = hash >> (64 - bits_);
+    // The guard bit caps the rank at 65 - bits
+    const uint64_t rest = hash << bits_ | static_cast<uint64_t>(1) << (bits_ - 1);
+    const uint8_t rank = __builtin_clzll(rest) + 1;
+    if (rank > registers_[index])
+      registers_[index] = rank;
+  }
+
+  void Merge(const HyperLogLog &that) {
+    if (that.bits_ != bits_)
+      LOG(FATAL) << "Cannot merge HyperLogLog sketches of " << bits_ << " and " << that.bits_ << " bits";
+    for (size_t i = 0; i < registers_.size(); ++i)
+      if (that.registers_[i] > registers_[i])
+        registers_[i] = that.registers_[i];
+  }
+
+  double Estimate() const {
+    const double m = registers_.size();
+    double sum = 0;
+    size_t zeros = 0;
+    for (size_t i = 0; i < registers_.size(); ++i) {
+      sum += std::ldexp(1.0, -registers_[i]);
+      zeros += registers_[i] == 0;
+    }
+    const double alpha = m >= 128 ? 0.7213 / (1 + 1.079 / m) : m >= 64 ? 0.709 : m >= 32 ? 0.697 : 0.673;
+    const double estimate = alpha * m * m / sum;
+    if (estimate <= 2.5 * m && zeros > 0)
+      return m * std::log(m / zeros);
+    return estimate;
+  }
+
+ private:
+  int bits_;
+  std::vector<uint8_t> registers_;
+};
+// Bytes of the pseudo counts of a mapper with `rows` rows and `cells`
+// cells in all, estimated like `Mapper::PseudoCountBytes`
+inline double PseudoCountBytes(double rows, double cells) {
+  const double kNodeOverhead = 4 * sizeof(void *) + 2 * sizeof(size_t);
+  return rows * (sizeof(std::pair<WordId, std::map<WordId, double> >) + kNodeOverhead) +
+      cells * (sizeof(std::pair<WordId, double>) + kNodeOverhead);
+}
+} // namespace paralign
+
+#endif  // _PARALIGN_SKETCH_H_
@@ -0,0 +1,301 @@
+// pa-split: cuts a corpus into the input splits of the map tasks by the
+// work they take and the memory they need, rather than by their bytes.
+//
+// Usage: pa-split [-n SPLITS] [-m MB] [-l LINES] [-b BITS] [--reverse] OUT_DIR FILE...
+//
+// The E-step of a sentence pair takes time in proportion to its cells,
+// the target words times the source words and the null word, in every
+// direction pa-mapper trains (by `pa_reverse` or `--reverse`,
+// `pa_bidirectional` and `pa_no_null_word`); a mapper keeps a pseudo
+// count for every distinct pair in its split. pa-split reads the FILEs
+// once, in blocks of LINES sentences (default 1000), or fewer when they
+// are longer than the mean so far, and keeps the cells of each block
+// and `HyperLogLog` sketches of 2^BITS bytes (default 8) of its rows and
+// pairs. It then cuts the corpus at block boundaries into SPLITS
+// pieces, the largest with as few cells as it can, and cuts again any
+// piece whose pseudo counts, estimated like pa-estimate does, would
+// outgrow MB megabytes (default 1024, 0 for no cap). Where the cap needs
+// more pieces than SPLITS, or without -n, the cells are balanced over
+// as many as it needs.
+//
+// The pieces go to OUT_DIR as `split-NNNNN`, with consecutive sentences
+// in input order, so the Viterbi alignments of the map tasks simply
+// concatenate (see pa-merge-viterbi). `_SPLITS` lists them, a
+// tab-separated line each with its sentences, bytes, cells and pseudo
+// count megabytes; Hadoop skips it as input, and pa-hadoop.bash runs a
+// map task per piece when INPUT holds it.
+#include <getopt.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "io.h"
+#include "options.h"
+#include "sketch.h"
+#include "ttable.h"
+#include "types.h"
+#include "contrib/log.h"
+
+using namespace std;
+using namespace paralign;
+
+namespace {
+const double kMB = 1024.0 * 1024.0;
+
+// Consecutive sentences, which pieces are made of
+struct Block {
+  explicit Block(int bits) : sentences(0), bytes(0), cells(0), rows(bits), pairs(bits) {}
+
+  int64_t sentences, bytes;
+  double cells;
+  HyperLogLog rows, pairs;
+};
+
+// One input split
+struct Piece {
+  Piece() : blocks(0), sentences(0), bytes(0), cells(0), pseudo_count_bytes(0) {}
+
+  size_t blocks;
+  int64_t sentences, bytes;
+  double cells, pseudo_count_bytes;
+};
+
+class Planner {
+ public:
+  Planner(const Options &opts, int lines, int bits) : opts_(opts), lines_(lines), bits_(bits), cells_(0) {
+    directions_.push_back(opts.reverse);
+    if (opts.bidirectional)
+      directions_.push_back(!opts.reverse);
+  }
+
+  void Scan(const vector<string> &inputs) {
+    string line;
+    size_t id;
+    vector<WordId> sides[2];
+    int64_t sentences = 0;
+    for (size_t f = 0; f < inputs.size(); ++f) {
+      ifstream in(inputs[f].c_str());
+      if (!in)
+        LOG(FATAL) << "Cannot open " << inputs[f] << ": " << strerror(errno);
+      while (getline(in, line)) {
+        MapperSource::Parse(line, &id, &sides[0], &sides[1]);
+        // A block also ends at the cells of LINES sentences of mean
+        // length, so that runs of long sentences are cut as finely
+        if (blocks_.empty() || blocks_.back().sentences == lines_ ||
+            blocks_.back().cells * sentences >= cells_ * lines_)
+          blocks_.push_back(Block(bits_));
+        Block &block = blocks_.back();
+        ++block.sentences;
+        ++sentences;
+        block.bytes += line.size() + 1;
+        for (size_t d = 0; d < directions_.size(); ++d) {
+          const vector<WordId> &src = sides[directions_[d]], &tgt = sides[!directions_[d]];
+          const double cells = static_cast<double>(tgt.size()) * (src.size() + !opts_.no_null_word);
+          block.cells += cells;
+          cells_ += cells;
+          if (!opts_.no_null_word)
+            Add(d, kNull, tgt, &block);
+          for (size_t i = 0; i < src.size(); ++i)
+            Add(d, src[i], tgt, &block);
+        }
+      }
+    }
+  }
+
+  // Cuts the blocks into pieces in order, each as long as it stays
+  // within `limit` cells and `cap` bytes of pseudo counts (when not 0)
+  vector<Piece> Plan(double limit, double cap) const {
+    vector<Piece> pieces;
+    size_t b = 0;
+    while (b < blocks_.size()) {
+      Piece piece;
+      HyperLogLog rows(bits_), pairs(bits_);
+      for (; b < blocks_.size(); ++b) {
+        const Block &block = blocks_[b];
+        if (piece.blocks > 0 && piece.cells + block.cells > limit)
+          break;
+        double bytes = 0;
+        if (cap > 0) {
+          HyperLogLog more_rows(rows), more_pairs(pairs);
+          more_rows.Merge(block.rows);
+          more_pairs.Merge(block.pairs);
+          bytes = PseudoCountBytes(more_rows.Estimate(), more_pairs.Estimate());
+          if (piece.blocks > 0 && bytes > cap)
+            break;
+          rows = more_rows;
+          pairs = more_pairs;
+        }
+        ++piece.blocks;
+        piece.sentences += block.sentences;
+        piece.bytes += block.bytes;
+        piece.cells += block.cells;
+        piece.pseudo_count_bytes = bytes;
+      }
+      pieces.push_back(piece);
+    }
+    return pieces;
+  }
+
+  // Balances the cells over `splits` pieces, or as many as `cap` needs
+  // at least, then cuts pieces that go over `cap`
+  vector<Piece> Balance(int splits, double cap) const {
+    if (cap > 0)
+      splits = max<int>(splits, Plan(cells_, cap).size());
+    // The least cells per piece that packs into `splits` pieces lie
+    // above the mean and the largest block
+    double low = cells_ / max(splits, 1), high = cells_;
+    for (size_t b = 0; b < blocks_.size(); ++b)
+      low = max(low, blocks_[b].cells);
+    if (low >= high)
+      high = low;
+    while (high - low > high * 1e-3) {
+      const double mid = (low + high) / 2;
+      if (static_cast<int>(Plan(mid, 0).size()) <= splits)
+        high = mid;
+      else
+        low = mid;
+    }
+    vector<Piece> pieces = Plan(high, cap);
+    if (cap == 0) {
+      // Also estimated for the report
+      for (size_t p = 0, b = 0; p < pieces.size(); b += pieces[p++].blocks) {
+        HyperLogLog rows(bits_), pairs(bits_);
+        for (size_t k = b; k < b + pieces[p].blocks; ++k) {
+          rows.Merge(blocks_[k].rows);
+          pairs.Merge(blocks_[k].pairs);
+        }
+        pieces[p].pseudo_count_bytes = PseudoCountBytes(rows.Estimate(), pairs.Estimate());
+      }
+    }
+    return pieces;
+  }
+
+  double Cells() const {
+    return cells_;
+  }
+
+ private:
+  // Rows and pairs of each direction are counted apart
+  void Add(size_t d, WordId src, const vector<WordId> &tgt, Block *block) const {
+    block->rows.Add(MixBits(HashWord(src) + d));
+    for (size_t j = 0; j < tgt.size(); ++j)
+      block->pairs.Add(MixBits(HashPair(src, tgt[j]) + d));
+  }
+
+  const Options opts_;
+  const int64_t lines_;
+  const int bits_;
+  // Whether each table swaps the sides of the input
+  vector<int> directions_;
+  vector<Block> blocks_;
+  double cells_;
+};
+
+// Copies the sentences of each piece from the inputs, in order
+void Write(const vector<string> &inputs, const vector<Piece> &pieces, const string &out_dir) {
+  size_t f = 0;
+  ifstream in;
+  string line;
+  for (size_t p = 0; p < pieces.size(); ++p) {
+    char name[32];
+    snprintf(name, sizeof(name), "split-%05d", static_cast<int>(p));
+    const string path = out_dir + "/" + name;
+    ofstream out(path.c_str());
+    if (!out)
+      LOG(FATAL) << "Cannot write " << path << ": " << strerror(errno);
+    for (int64_t s = 0; s < pieces[p].sentences; ++s) {
+      while (!getline(in, line)) {
+        if (f == inputs.size())
+          LOG(FATAL) << "Inputs changed while splitting them";
+        in.close();
+        in.clear();
+        in.open(inputs[f++].c_str());
+        if (!in)
+          LOG(FATAL) << "Cannot open " << inputs[f-1] << ": " << strerror(errno);
+      }
+      out << line << '\n';
+    }
+    out.close();
+    if (!out)
+      LOG(FATAL) << "Cannot write " << path;
+  }
+
+  const string path = out_dir + "/_SPLITS";
+  ofstream manifest(path.c_str());
+  manifest << "split\tsentences\tbytes\tcells\tpseudo_count_mb" << endl << fixed << setprecision(1);
+  for (size_t p = 0; p < pieces.size(); ++p) {
+    const Piece &piece = pieces[p];
+    manifest << "split-" << setw(5) << setfill('0') << p << setfill(' ') << '\t' << piece.sentences << '\t'
+             << piece.bytes << '\t' << setprecision(0) << piece.cells << '\t' << setprecision(1)
+             << piece.pseudo_count_bytes / kMB << endl;
+  }
+  manifest.close();
+  if (!manifest)
+    LOG(FATAL) << "Cannot write " << path;
+}
+
+void Usage(const char *prog) {
+  cerr << "Usage: " << prog << " [-n SPLITS] [-m MB] [-l LINES] [-b BITS] [--reverse] OUT_DIR FILE..." << endl;
+  exit(1);
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+  ios::sync_with_stdio(false);
+  // Table parts play no part in the plan
+  Options opts = Options::FromEnv(1);
+  int splits = 0, lines = 1000, bits = 8;
+  double cap_mb = 1024;
+  static const struct option long_options[] = {
+    {"reverse", no_argument, NULL, 'r'},
+    {NULL, 0, NULL, 0},
+  };
+  int c;
+  while ((c = getopt_long(argc, argv, "n:m:l:b:r", long_options, NULL)) != -1) {
+    switch (c) {
+      case 'n': splits = atoi(optarg); break;
+      case 'm': cap_mb = atof(optarg); break;
+      case 'l': lines = atoi(optarg); break;
+      case 'b': bits = atoi(optarg); break;
+      case 'r': opts.reverse = true; break;
+      default: Usage(argv[0]);
+    }
+  }
+  if (argc - optind < 2 || splits < 0 || cap_mb < 0 || lines < 1 || bits < 4 || bits > 20)
+    Usage(argv[0]);
+  if (splits == 0 && cap_mb == 0)
+    LOG(FATAL) << "Give the number of splits (-n), the memory cap (-m) or both";
+  const string out_dir = argv[optind];
+  const vector<string> inputs(argv + optind + 1, argv + argc);
+  if (mkdir(out_dir.c_str(), 0777) != 0 && errno != EEXIST)
+    LOG(FATAL) << "Cannot create " << out_dir << ": " << strerror(errno);
+
+  Planner planner(opts, lines, bits);
+  planner.Scan(inputs);
+  const double cap = cap_mb * kMB;
+  const vector<Piece> pieces = planner.Balance(splits, cap);
+  Write(inputs, pieces, out_dir);
+
+  double largest_cells = 0, largest_bytes = 0;
+  for (size_t p = 0; p < pieces.size(); ++p) {
+    largest_cells = max(largest_cells, pieces[p].cells);
+    largest_bytes = max(largest_bytes, pieces[p].pseudo_count_bytes);
+    if (cap > 0 && pieces[p].pseudo_count_bytes > cap)
+      LOG(WARNING) << "split " << p << " needs " << pieces[p].pseudo_count_bytes / kMB
+                   << " MB of pseudo counts in a single block; use fewer LINES";
+  }
+  LOG(INFO) << "pa-split: " << pieces.size() << " splits, the largest with "
+            << largest_cells * pieces.size() / max(planner.Cells(), 1.0) << " times the mean cells and "
+            << largest_bytes / kMB << " MB of pseudo counts";
+  return 0;
+}
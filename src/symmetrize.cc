@@ -0,0 +1,310 @@
+// pa-symmetrize: combines the alignments of both directions, e.g. with
+// grow-diag-final-and.
+//
+// Usage: pa-symmetrize [-a HEURISTIC] [-j THREADS] [-b BATCH] [FORWARD [REVERSE]]
+//
+// With a single input (stdin by default), each line is
+// `id\tforward\treverse` as written with `pa_bidirectional`. With two
+// inputs, each is a pa-viterbi output (`id\talignment`) sorted by id,
+// and lines are joined by id; an id missing from one side gets an empty
+// alignment there. Points of both directions are (source, target) as
+// pa-viterbi writes them, also with `pa_reverse`. Output is
+// `id\talignment` in input order. HEURISTIC is one of union,
+// intersection, grow, grow-diag, grow-diag-final and
+// grow-diag-final-and (the default). Batches of BATCH lines are
+// symmetrized by THREADS workers.
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/utility.hpp>
+
+#include "pipeline.h"
+#include "symmetrize.h"
+#include "types.h"
+#include "contrib/log.h"
+
+using namespace std;
+
+namespace paralign {
+// Lines in the combined `id\tforward\treverse` format; replaced by the
+// output in place
+struct SymmetrizeBatch {
+  size_t seq;
+  size_t first_line;
+  vector<string> lines;
+  string out;
+};
+
+// Reads either a combined input or two inputs to be joined, producing
+// combined lines
+class PairReader : boost::noncopyable {
+ public:
+  explicit PairReader(istream *combined)
+      : combined_(combined), forward_(NULL), reverse_(NULL), last_forward_id_(kNoId),
+        last_reverse_id_(kNoId), forward_ok_(false), reverse_ok_(false), unpaired_(0) {}
+
+  PairReader(istream *forward, istream *reverse)
+      : combined_(NULL), forward_(forward), reverse_(reverse), last_forward_id_(kNoId),
+        last_reverse_id_(kNoId), unpaired_(0) {
+    forward_ok_ = Advance(forward_, &forward_line_, &forward_id_, &last_forward_id_, "forward");
+    reverse_ok_ = Advance(reverse_, &reverse_line_, &reverse_id_, &last_reverse_id_, "reverse");
+  }
+
+  ~PairReader() {
+    if (unpaired_ > 0)
+      LOG(WARNING) << unpaired_ << " ids only found in one of the inputs";
+  }
+
+  bool Read(string *line) {
+    if (combined_) {
+      if (!getline(*combined_, *line))
+        return false;
+      return true;
+    }
+    if (!forward_ok_ && !reverse_ok_)
+      return false;
+    if (forward_ok_ && reverse_ok_ && forward_id_ == reverse_id_) {
+      Join(forward_line_, reverse_line_, line);
+      forward_ok_ = Advance(forward_, &forward_line_, &forward_id_, &last_forward_id_, "forward");
+      reverse_ok_ = Advance(reverse_, &reverse_line_, &reverse_id_, &last_reverse_id_, "reverse");
+    } else if (forward_ok_ && (!reverse_ok_ || forward_id_ < reverse_id_)) {
+      ++unpaired_;
+      Join(forward_line_, string(), line);
+      forward_ok_ = Advance(forward_, &forward_line_, &forward_id_, &last_forward_id_, "forward");
+    } else {
+      ++unpaired_;
+      // Keep the id of the reverse line
+      *line = reverse_line_.substr(0, reverse_line_.find('\t')) + "\t\t" + Points(reverse_line_);
+      reverse_ok_ = Advance(reverse_, &reverse_line_, &reverse_id_, &last_reverse_id_, "reverse");
+    }
+    return true;
+  }
+
+ private:
+  // Everything after the id
+  static string Points(const string &line) {
+    size_t tab = line.find('\t');
+    return tab == string::npos ? string() : line.substr(tab + 1);
+  }
+
+  static void Join(const string &forward, const string &reverse, string *line) {
+    *line = forward;
+    if (forward.find('\t') == string::npos)
+      *line += '\t';
+    *line += '\t';
+    *line += Points(reverse);
+  }
+
+  // Reads the next line and its id, checking that ids go up
+  static bool Advance(istream *in, string *line, size_t *id, size_t *last_id, const char *name) {
+    if (!getline(*in, *line))
+      return false;
+    const char *begin = line->c_str();
+    char *end;
+    errno = 0;
+    unsigned long v = strtoul(begin, &end, 10);
+    if (end == begin || (*end != '\t' && *end != '\0') || errno != 0)
+      LOG(FATAL) << "Invalid " << name << " line: " << *line;
+    if (*last_id != kNoId && v <= *last_id)
+      LOG(FATAL) << "The " << name << " input is not sorted by id at id " << v
+                 << "; sort both inputs with `sort -n` first";
+    *id = *last_id = v;
+    return true;
+  }
+
+  static const size_t kNoId = static_cast<size_t>(-1);
+
+  istream *combined_, *forward_, *reverse_;
+  string forward_line_, reverse_line_;
+  size_t forward_id_, reverse_id_;
+  size_t last_forward_id_, last_reverse_id_;
+  bool forward_ok_, reverse_ok_;
+  size_t unpaired_;
+};
+
+// Reads batches of lines on the calling thread, symmetrizes them on a
+// pool of workers and writes them out in order on another thread
+class SymmetrizePipeline : boost::noncopyable {
+ public:
+  SymmetrizePipeline(Heuristic heuristic, int threads, size_t batch_size)
+      : heuristic_(heuristic), threads_(threads), batch_size_(batch_size),
+        work_(4 * threads), done_(4 * threads) {}
+
+  void Run(PairReader *in, ostream &out) {
+    vector<StageStats> work_stats(threads_);
+    StageStats read_stats, write_stats;
+    boost::thread_group workers;
+    for (int i = 0; i < threads_; ++i)
+      workers.create_thread(boost::bind(&SymmetrizePipeline::Work, this, &work_stats[i]));
+    boost::thread writer(boost::bind(&SymmetrizePipeline::Write, this, boost::ref(out), &write_stats));
+
+    const double start = WallTime();
+    size_t lines = 0;
+    bool more = true;
+    while (more) {
+      double busy_start = WallTime();
+      SymmetrizeBatch *batch = new SymmetrizeBatch;
+      batch->first_line = lines + 1;
+      batch->lines.resize(batch_size_);
+      size_t n = 0;
+      while (n < batch_size_ && (more = in->Read(&batch->lines[n])))
+        ++n;
+      batch->lines.resize(n);
+      lines += n;
+      read_stats.busy += WallTime() - busy_start;
+      if (n == 0) {
+        delete batch;
+        break;
+      }
+      ++read_stats.items;
+      batch->seq = done_.Reserve();
+      work_.Push(batch);
+    }
+    work_.Close();
+    workers.join_all();
+    done_.Close();
+    writer.join();
+    read_stats.wall = WallTime() - start;
+
+    StageStats work_total;
+    for (int i = 0; i < threads_; ++i)
+      work_total += work_stats[i];
+    read_stats.Report("read", 1);
+    work_total.Report("symmetrize", threads_);
+    write_stats.Report("write", 1);
+    LOG(INFO) << "pa-symmetrize: " << lines << " lines in " << read_stats.wall << "s";
+  }
+
+ private:
+  void Work(StageStats *stats) {
+    const double start = WallTime();
+    Symmetrizer symmetrizer(heuristic_);
+    vector<SentSzPair> forward, reverse, al;
+    SymmetrizeBatch *batch;
+    while (work_.Pop(&batch)) {
+      double busy_start = WallTime();
+      batch->out.clear();
+      for (size_t i = 0; i < batch->lines.size(); ++i) {
+        const string &line = batch->lines[i];
+        size_t tab1 = line.find('\t');
+        size_t tab2 = tab1 == string::npos ? string::npos : line.find('\t', tab1 + 1);
+        if (tab2 == string::npos || line.find('\t', tab2 + 1) != string::npos)
+          LOG(FATAL) << "Line " << batch->first_line + i << " is not `id\\tforward\\treverse`: " << line;
+        const char *p = line.data();
+        if (!ParseAlignment(p + tab1 + 1, p + tab2, &forward) ||
+            !ParseAlignment(p + tab2 + 1, p + line.size(), &reverse))
+          LOG(FATAL) << "Invalid alignment on line " << batch->first_line + i << ": " << line;
+        symmetrizer.Symmetrize(forward, reverse, &al);
+        batch->out.append(line, 0, tab1 + 1);
+        for (size_t k = 0; k < al.size(); ++k) {
+          if (k > 0)
+            batch->out += ' ';
+          AppendNumber(FirstSz(al[k]), &batch->out);
+          batch->out += '-';
+          AppendNumber(SecondSz(al[k]), &batch->out);
+        }
+        batch->out += '\n';
+      }
+      vector<string>().swap(batch->lines);
+      stats->busy += WallTime() - busy_start;
+      ++stats->items;
+      done_.Put(batch->seq, batch);
+    }
+    stats->wall = WallTime() - start;
+  }
+
+  void Write(ostream &out, StageStats *stats) {
+    const double start = WallTime();
+    SymmetrizeBatch *batch;
+    while (done_.Take(&batch)) {
+      double busy_start = WallTime();
+      out.write(batch->out.data(), batch->out.size());
+      if (!out)
+        LOG(FATAL) << "Failed to write output";
+      delete batch;
+      stats->busy += WallTime() - busy_start;
+      ++stats->items;
+    }
+    out.flush();
+    stats->wall = WallTime() - start;
+  }
+
+  static void AppendNumber(unsigned v, string *out) {
+    char buf[8];
+    char *p = buf + sizeof(buf);
+    do {
+      *--p = '0' + v % 10;
+      v /= 10;
+    } while (v > 0);
+    out->append(p, buf + sizeof(buf));
+  }
+
+  const Heuristic heuristic_;
+  const int threads_;
+  const size_t batch_size_;
+  BoundedQueue<SymmetrizeBatch *> work_;
+  ReorderBuffer<SymmetrizeBatch *> done_;
+};
+} // namespace paralign
+
+using namespace paralign;
+
+static void Usage(const char *prog) {
+  cerr << "Usage: " << prog << " [-a HEURISTIC] [-j THREADS] [-b BATCH] [FORWARD [REVERSE]]" << endl;
+  exit(1);
+}
+
+static istream *Open(const string &path, boost::scoped_ptr<ifstream> *file) {
+  if (path == "-")
+    return &cin;
+  file->reset(new ifstream(path.c_str(), ios::binary));
+  if (!**file)
+    LOG(FATAL) << "Cannot open " << path << ": " << strerror(errno);
+  return file->get();
+}
+
+int main(int argc, char *argv[]) {
+  Heuristic heuristic = kGrowDiagFinalAnd;
+  int threads = boost::thread::hardware_concurrency(), batch_size = 4096;
+  int c;
+  while ((c = getopt(argc, argv, "a:j:b:")) != -1) {
+    switch (c) {
+      case 'a':
+        if (!ParseHeuristic(optarg, &heuristic))
+          Usage(argv[0]);
+        break;
+      case 'j': threads = atoi(optarg); break;
+      case 'b': batch_size = atoi(optarg); break;
+      default: Usage(argv[0]);
+    }
+  }
+  if (threads <= 0)
+    threads = 1;
+  if (batch_size <= 0 || argc - optind > 2)
+    Usage(argv[0]);
+
+  ios::sync_with_stdio(false);
+  // Only the writer thread may touch cout
+  cin.tie(NULL);
+  boost::scoped_ptr<ifstream> forward_file, reverse_file;
+  boost::scoped_ptr<PairReader> reader;
+  if (argc - optind == 2) {
+    istream *forward = Open(argv[optind], &forward_file);
+    istream *reverse = Open(argv[optind + 1], &reverse_file);
+    reader.reset(new PairReader(forward, reverse));
+  } else {
+    reader.reset(new PairReader(Open(optind < argc ? argv[optind] : "-", &forward_file)));
+  }
+
+  SymmetrizePipeline(heuristic, threads, batch_size).Run(reader.get(), cout);
+  return 0;
+}
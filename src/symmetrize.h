@@ -0,0 +1,210 @@
+#ifndef _PARALIGN_SYMMETRIZE_H_
+#define _PARALIGN_SYMMETRIZE_H_
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "types.h"
+
+namespace paralign {
+// Ways of combining the alignments of both directions
+enum Heuristic {
+  kUnion,
+  kIntersection,
+  kGrow,
+  kGrowDiag,
+  kGrowDiagFinal,
+  kGrowDiagFinalAnd,
+};
+
+// Accepts the usual names, e.g. "grow-diag-final-and"
+inline bool ParseHeuristic(const std::string &name, Heuristic *heuristic) {
+  static const char *names[] = {
+    "union", "intersection", "grow", "grow-diag", "grow-diag-final", "grow-diag-final-and",
+  };
+  for (int i = 0; i < 6; ++i) {
+    if (name == names[i]) {
+      *heuristic = static_cast<Heuristic>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+// Parses alignment points as written by `ViterbiSink`, e.g. "0-0 1-2",
+// from [begin, end). Returns false on malformed input.
+inline bool ParseAlignment(const char *begin, const char *end, std::vector<SentSzPair> *al) {
+  al->clear();
+  const char *p = begin;
+  while (p < end) {
+    if (*p == ' ') {
+      ++p;
+      continue;
+    }
+    unsigned v[2];
+    for (int k = 0; k < 2; ++k) {
+      if (p == end || *p < '0' || *p > '9')
+        return false;
+      v[k] = 0;
+      for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+        v[k] = v[k] * 10 + (*p - '0');
+        if (v[k] > 0xffff)
+          return false;
+      }
+      if (k == 0) {
+        if (p == end || *p != '-')
+          return false;
+        ++p;
+      }
+    }
+    if (p < end && *p != ' ')
+      return false;
+    al->push_back(MkSzPair(v[0], v[1]));
+  }
+  return true;
+}
+
+// Combines a forward and a reverse alignment, both given as (source,
+// target) points, following Koehn et al. (2003) as in Moses: start
+// from the intersection, grow into neighbouring union points that
+// cover an unaligned word, then add the remaining points of each
+// direction (forward first) that cover an unaligned word ("final"),
+// or two unaligned words ("final-and"). Every step only ever picks
+// union points, so they are visited from a sorted list instead of
+// scanning the whole matrix. Keeps scratch space between calls, so
+// use one per thread.
+class Symmetrizer {
+ public:
+  explicit Symmetrizer(Heuristic heuristic) : heuristic_(heuristic), src_size_(0), tgt_size_(0) {}
+
+  // Result points are sorted
+  void Symmetrize(const std::vector<SentSzPair> &forward, const std::vector<SentSzPair> &reverse,
+                  std::vector<SentSzPair> *al) {
+    Reset(forward, reverse);
+    switch (heuristic_) {
+      case kUnion:
+        Select(kForward);
+        Select(kReverse);
+        break;
+      case kIntersection:
+        Select(kForward | kReverse);
+        break;
+      default:
+        Select(kForward | kReverse);
+        Grow(heuristic_ != kGrow);
+        if (heuristic_ == kGrowDiagFinal || heuristic_ == kGrowDiagFinalAnd) {
+          Final(kForward, heuristic_ == kGrowDiagFinalAnd);
+          Final(kReverse, heuristic_ == kGrowDiagFinalAnd);
+        }
+    }
+    al->clear();
+    for (size_t k = 0; k < union_.size(); ++k) {
+      if (Cell(union_[k]) & kSelected)
+        al->push_back(union_[k]);
+    }
+  }
+
+ private:
+  // Bits of a matrix cell
+  enum {
+    kForward = 1,
+    kReverse = 2,
+    kSelected = 4,
+  };
+
+  unsigned char &Cell(size_t i, size_t j) {
+    return grid_[i * tgt_size_ + j];
+  }
+
+  unsigned char &Cell(SentSzPair p) {
+    return Cell(FirstSz(p), SecondSz(p));
+  }
+
+  // Only the bounding box of the union matters
+  void Reset(const std::vector<SentSzPair> &forward, const std::vector<SentSzPair> &reverse) {
+    union_.assign(forward.begin(), forward.end());
+    union_.insert(union_.end(), reverse.begin(), reverse.end());
+    // Row-major order, the order of the matrix scans in Moses
+    std::sort(union_.begin(), union_.end());
+    union_.erase(std::unique(union_.begin(), union_.end()), union_.end());
+    src_size_ = tgt_size_ = 0;
+    for (size_t k = 0; k < union_.size(); ++k) {
+      if (FirstSz(union_[k]) >= src_size_) src_size_ = FirstSz(union_[k]) + 1;
+      if (SecondSz(union_[k]) >= tgt_size_) tgt_size_ = SecondSz(union_[k]) + 1;
+    }
+    grid_.assign(src_size_ * tgt_size_, 0);
+    src_aligned_.assign(src_size_, 0);
+    tgt_aligned_.assign(tgt_size_, 0);
+    for (size_t k = 0; k < forward.size(); ++k)
+      Cell(forward[k]) |= kForward;
+    for (size_t k = 0; k < reverse.size(); ++k)
+      Cell(reverse[k]) |= kReverse;
+  }
+
+  void Add(size_t i, size_t j) {
+    Cell(i, j) |= kSelected;
+    src_aligned_[i] = 1;
+    tgt_aligned_[j] = 1;
+  }
+
+  // Selects union points that have all of `bits`
+  void Select(unsigned char bits) {
+    for (size_t k = 0; k < union_.size(); ++k) {
+      if ((Cell(union_[k]) & bits) == bits)
+        Add(FirstSz(union_[k]), SecondSz(union_[k]));
+    }
+  }
+
+  // Points added behind the current one in row-major order are visited
+  // in the same pass, as in a matrix scan
+  void Grow(bool diag) {
+    static const int di[] = {-1, 0, 1, 0, -1, -1, 1, 1};
+    static const int dj[] = {0, -1, 0, 1, -1, 1, -1, 1};
+    const int neighbours = diag ? 8 : 4;
+    bool added = true;
+    while (added) {
+      added = false;
+      for (size_t k = 0; k < union_.size(); ++k) {
+        const size_t i = FirstSz(union_[k]), j = SecondSz(union_[k]);
+        if (!(Cell(i, j) & kSelected))
+          continue;
+        for (int n = 0; n < neighbours; ++n) {
+          const size_t ni = i + di[n], nj = j + dj[n];
+          // Also catches -1, which wraps around
+          if (ni >= src_size_ || nj >= tgt_size_)
+            continue;
+          const unsigned char c = Cell(ni, nj);
+          if ((c & kSelected) || !(c & (kForward | kReverse)))
+            continue;
+          if (!src_aligned_[ni] || !tgt_aligned_[nj]) {
+            Add(ni, nj);
+            added = true;
+          }
+        }
+      }
+    }
+  }
+
+  void Final(unsigned char bit, bool both_unaligned) {
+    for (size_t k = 0; k < union_.size(); ++k) {
+      const size_t i = FirstSz(union_[k]), j = SecondSz(union_[k]);
+      const unsigned char c = Cell(i, j);
+      if ((c & kSelected) || !(c & bit))
+        continue;
+      const bool ok = both_unaligned ? (!src_aligned_[i] && !tgt_aligned_[j])
+                                     : (!src_aligned_[i] || !tgt_aligned_[j]);
+      if (ok)
+        Add(i, j);
+    }
+  }
+
+  const Heuristic heuristic_;
+  size_t src_size_, tgt_size_;
+  std::vector<SentSzPair> union_;
+  std::vector<unsigned char> grid_;
+  std::vector<unsigned char> src_aligned_, tgt_aligned_;
+};
+} // namespace paralign
+
+#endif  // _PARALIGN_SYMMETRIZE_H_
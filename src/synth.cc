@@ -0,0 +1,69 @@
+// pa-synth: generates synthetic inputs for benchmarks.
+//
+// Usage: pa-synth corpus [-n SENTENCES] [-v VOCAB] [-l LENGTH] [-z EXPONENT] [-s SEED]
+//        pa-synth ttable [-r ROWS] [-c COLUMNS] [-p PARTS] [-z EXPONENT] [-s SEED] DIR
+//
+// `corpus` writes a parallel corpus in the pa-mapper input format to
+// stdout, with Zipfian words from a vocabulary of VOCAB and sentences
+// of LENGTH words on average. `ttable` writes a translation table of
+// ROWS source words with up to COLUMNS entries each to DIR, in PARTS
+// parts as read with `pa_ttable_parts`.
+#include <unistd.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "synth.h"
+#include "ttable.h"
+#include "contrib/log.h"
+
+using namespace std;
+using namespace paralign;
+
+static void Usage(const char *prog) {
+  cerr << "Usage: " << prog << " corpus [-n SENTENCES] [-v VOCAB] [-l LENGTH] [-z EXPONENT] [-s SEED]" << endl
+       << "       " << prog << " ttable [-r ROWS] [-c COLUMNS] [-p PARTS] [-z EXPONENT] [-s SEED] DIR" << endl;
+  exit(1);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2)
+    Usage(argv[0]);
+  const string command = argv[1];
+  long sentences = 100000, vocab = 50000, length = 20, rows = 50000, columns = 100, parts = 1;
+  double exponent = 1.0;
+  unsigned seed = 1;
+  int c;
+  optind = 2;
+  while ((c = getopt(argc, argv, "n:v:l:r:c:p:z:s:")) != -1) {
+    switch (c) {
+      case 'n': sentences = atol(optarg); break;
+      case 'v': vocab = atol(optarg); break;
+      case 'l': length = atol(optarg); break;
+      case 'r': rows = atol(optarg); break;
+      case 'c': columns = atol(optarg); break;
+      case 'p': parts = atol(optarg); break;
+      case 'z': exponent = atof(optarg); break;
+      case 's': seed = atoi(optarg); break;
+      default: Usage(argv[0]);
+    }
+  }
+  if (sentences <= 0 || vocab <= 0 || length <= 0 || rows <= 0 || columns <= 0 || parts <= 0 ||
+      !(exponent > 0))
+    Usage(argv[0]);
+
+  if (command == "corpus" && optind == argc) {
+    ios::sync_with_stdio(false);
+    SynthCorpus(vocab, exponent, length, seed).Write(sentences, cout);
+  } else if (command == "ttable" && optind + 1 == argc) {
+    vector<TTableEntry> table;
+    MakeSynthTTable(rows, columns, exponent, seed, &table);
+    WriteSynthTTable(table, argv[optind], parts);
+  } else {
+    Usage(argv[0]);
+  }
+  return 0;
+}
@@ -0,0 +1,147 @@
+#ifndef _PARALIGN_SYNTH_H_
+#define _PARALIGN_SYNTH_H_
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <boost/lexical_cast.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_01.hpp>
+
+#include "ttable.h"
+#include "types.h"
+#include "contrib/log.h"
+
+namespace paralign {
+typedef boost::mt19937 SynthRng;
+
+// Draws ranks 1..n with probability proportional to rank^-exponent
+class ZipfSampler {
+ public:
+  ZipfSampler(size_t n, double exponent) : cdf_(n) {
+    double sum = 0;
+    for (size_t k = 0; k < n; ++k) {
+      sum += std::pow(k + 1.0, -exponent);
+      cdf_[k] = sum;
+    }
+    for (size_t k = 0; k < n; ++k)
+      cdf_[k] /= sum;
+  }
+
+  WordId Sample(SynthRng *rng) const {
+    const double u = boost::uniform_01<SynthRng &>(*rng)();
+    size_t k = std::lower_bound(cdf_.begin(), cdf_.end(), u) - cdf_.begin();
+    return std::min(k, cdf_.size() - 1) + 1;
+  }
+
+ private:
+  std::vector<double> cdf_;
+};
+
+// A synthetic parallel corpus in the pa-mapper input format. Source
+// words are drawn from a Zipfian distribution; each target word is
+// either the fixed "translation" of a source word of the sentence or
+// drawn from the same distribution, so that there is something to
+// learn.
+class SynthCorpus {
+ public:
+  SynthCorpus(size_t vocab, double exponent, unsigned mean_length, unsigned seed)
+      : zipf_(vocab, exponent), vocab_(vocab), mean_length_(mean_length < 1 ? 1 : mean_length),
+        rng_(seed) {}
+
+  // Fills `src` and `tgt` of the next sentence pair
+  void Next(std::vector<WordId> *src, std::vector<WordId> *tgt) {
+    const unsigned src_size = 1 + Uniform(2 * mean_length_ - 1);
+    const unsigned tgt_size = std::max(1u, src_size + Uniform(src_size / 2 + 1) - src_size / 4);
+    src->resize(src_size);
+    for (unsigned i = 0; i < src_size; ++i)
+      (*src)[i] = zipf_.Sample(&rng_);
+    tgt->resize(tgt_size);
+    for (unsigned j = 0; j < tgt_size; ++j) {
+      if (Uniform(10) < 7)
+        (*tgt)[j] = Translation((*src)[std::min<size_t>(j * src_size / tgt_size, src_size - 1)]);
+      else
+        (*tgt)[j] = zipf_.Sample(&rng_);
+    }
+  }
+
+  // Writes `sentences` lines with ids from 1
+  void Write(size_t sentences, std::ostream &out) {
+    std::vector<WordId> src, tgt;
+    for (size_t n = 1; n <= sentences; ++n) {
+      Next(&src, &tgt);
+      out << n << '\t';
+      WriteWords(src, out);
+      out << '\t';
+      WriteWords(tgt, out);
+      out << '\n';
+    }
+  }
+
+ private:
+  unsigned Uniform(unsigned n) {
+    return rng_() % n;
+  }
+
+  WordId Translation(WordId w) const {
+    return static_cast<WordId>((static_cast<int64_t>(w) * 7919) % vocab_) + 1;
+  }
+
+  static void WriteWords(const std::vector<WordId> &words, std::ostream &out) {
+    for (size_t i = 0; i < words.size(); ++i) {
+      if (i > 0)
+        out << ' ';
+      out << words[i];
+    }
+  }
+
+  const ZipfSampler zipf_;
+  const size_t vocab_;
+  const unsigned mean_length_;
+  SynthRng rng_;
+};
+
+// A synthetic translation table of `rows` source words, each with up
+// to `columns` Zipfian target words, normalized to sum to one
+inline void MakeSynthTTable(size_t rows, size_t columns, double exponent, unsigned seed,
+                            std::vector<TTableEntry> *table) {
+  ZipfSampler zipf(std::max(rows, columns), exponent);
+  SynthRng rng(seed);
+  table->resize(rows);
+  for (size_t r = 0; r < rows; ++r) {
+    std::map<WordId, double> row;
+    for (size_t c = 0; c < columns; ++c)
+      row[zipf.Sample(&rng)] += boost::uniform_01<SynthRng &>(rng)();
+    TTableEntry(row).Swap((*table)[r]);
+    (*table)[r].Normalize();
+  }
+}
+
+// Writes row r of `table` as source word r (row 0 being the null
+// word) to `dir` in the layout of `TTableWriter`, split into `parts`
+// like the reducers do. Only meant for local benchmarks, so it goes
+// straight to the local file system.
+inline void WriteSynthTTable(const std::vector<TTableEntry> &table, const std::string &dir, int parts) {
+  for (int part = 0; part < parts; ++part) {
+    const std::string suffix = boost::lexical_cast<std::string>(part);
+    std::ofstream index((dir + "/index." + suffix).c_str(), std::ios::binary);
+    std::ofstream entry((dir + "/entry." + suffix).c_str(), std::ios::binary);
+    off_t offset = 0;
+    for (size_t r = part; r < table.size(); r += parts) {
+      const IndexRecord record(r, KV<off_t, size_t>(offset, table[r].Size()));
+      index.write(reinterpret_cast<const char *>(&record), sizeof(record));
+      if (table[r].Size() > 0)
+        entry.write(reinterpret_cast<const char *>(&table[r][0]), table[r].Size() * sizeof(EntryRecord));
+      offset += table[r].Size();
+    }
+    if (!index || !entry)
+      LOG(FATAL) << "Failed to write synthetic table part " << part << " to " << dir;
+  }
+}
+} // namespace paralign
+
+#endif  // _PARALIGN_SYNTH_H_
@@ -0,0 +1,271 @@
+#ifndef _PARALIGN_TENSION_H_
+#define _PARALIGN_TENSION_H_
+
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "pipeline.h"
+#include "ttable.h"
+#include "types.h"
+#include "contrib/da.h"
+#include "contrib/log.h"
+
+namespace paralign {
+typedef KV<SentSzPair, int> SizeCountRecord;
+
+// Range of `diagonal_tension` searched by `TensionOptimizer`
+const double kMinTension = 0.1;
+const double kMaxTension = 14;
+
+// Saves the sentence length histogram as raw `SizeCountRecord`s. The
+// histogram only depends on the corpus, so it is enough to collect it
+// once.
+inline void SaveSizeCounts(const std::string &path, const std::map<SentSzPair, int> &size_counts) {
+  std::ofstream out(path.c_str(), std::ios::binary);
+  if (!out)
+    LOG(FATAL) << "Cannot open " << path << " for write: " << std::strerror(errno);
+  for (std::map<SentSzPair, int>::const_iterator it = size_counts.begin(); it != size_counts.end(); ++it) {
+    SizeCountRecord record(it->first, it->second);
+    out.write(reinterpret_cast<const char *>(&record), sizeof(SizeCountRecord));
+  }
+  if (!out)
+    LOG(FATAL) << "Failed to write " << path;
+}
+
+// Reads what's written by `SaveSizeCounts`; counts are added to
+// `size_counts`.
+inline void LoadSizeCounts(const std::string &path, std::map<SentSzPair, int> *size_counts) {
+  std::ifstream in(path.c_str(), std::ios::binary);
+  if (!in)
+    LOG(FATAL) << "Cannot open " << path << " for read: " << std::strerror(errno);
+  SizeCountRecord record;
+  while (in.read(reinterpret_cast<char *>(&record), sizeof(SizeCountRecord)))
+    (*size_counts)[record.k] += record.v;
+  if (in.gcount() != 0)
+    LOG(FATAL) << "Truncated size counts file " << path;
+}
+
+// Prefix of the file a reducer writes its statistics to with
+// `tension_stats`, followed by its task partition
+const char kTensionStatsPrefix[] = "tension.";
+
+// Sum and size of the counts of a row sharded by the partition map,
+// see `RowScale`
+typedef std::pair<double, int64_t> RowTotal;
+typedef KV<WordId, KV<double, int64_t> > RowTotalRecord;
+
+// Sufficient statistics for `diagonal_tension` of one direction
+struct TensionStats {
+  TensionStats() : toks(0), emp_feat(0), log_likelihood(0), table_change(0), changed_rows(0) {}
+
+  bool Empty() const {
+    return size_counts.empty() && toks == 0 && emp_feat == 0 && log_likelihood == 0 && changed_rows == 0;
+  }
+
+  std::map<SentSzPair, int> size_counts;
+  double toks;
+  double emp_feat;
+  double log_likelihood;
+  // Sum of the L1 distances of `changed_rows` rows from the previous
+  // table, see `Reducer::SetPreviousTable`
+  double table_change;
+  int64_t changed_rows;
+};
+
+// Writes the statistics and row totals of both directions (indexed by
+// `Direction`) that a reducer has summed, for pa-diagonal to merge
+// with `LoadTensionStats` instead of sorting the reducers' output. Each
+// non-empty direction is a block of its index, toks, emp_feat,
+// log-likelihood, table change and changed rows, then the counts of
+// `SizeCountRecord`s and of `RowTotalRecord`s, each followed by the
+// records.
+inline void SaveTensionStats(std::ostream &out, const TensionStats stats[2],
+                             const std::map<WordId, RowTotal> row_totals[2]) {
+  for (int32_t dir = 0; dir < 2; ++dir) {
+    if (stats[dir].Empty() && row_totals[dir].empty())
+      continue;
+    const double values[4] = {stats[dir].toks, stats[dir].emp_feat, stats[dir].log_likelihood,
+                              stats[dir].table_change};
+    const uint64_t sizes[2] = {stats[dir].size_counts.size(), row_totals[dir].size()};
+    out.write(reinterpret_cast<const char *>(&dir), sizeof(dir));
+    out.write(reinterpret_cast<const char *>(values), sizeof(values));
+    out.write(reinterpret_cast<const char *>(&stats[dir].changed_rows), sizeof(stats[dir].changed_rows));
+    out.write(reinterpret_cast<const char *>(&sizes[0]), sizeof(sizes[0]));
+    for (std::map<SentSzPair, int>::const_iterator it = stats[dir].size_counts.begin();
+         it != stats[dir].size_counts.end(); ++it) {
+      SizeCountRecord record(it->first, it->second);
+      out.write(reinterpret_cast<const char *>(&record), sizeof(record));
+    }
+    out.write(reinterpret_cast<const char *>(&sizes[1]), sizeof(sizes[1]));
+    for (std::map<WordId, RowTotal>::const_iterator it = row_totals[dir].begin(); it != row_totals[dir].end();
+         ++it) {
+      RowTotalRecord record(it->first, KV<double, int64_t>(it->second.first, it->second.second));
+      out.write(reinterpret_cast<const char *>(&record), sizeof(record));
+    }
+  }
+}
+
+// Adds what's written by `SaveTensionStats` to `stats` and
+// `row_totals`
+inline void LoadTensionStats(std::istream &in, const std::string &name, TensionStats stats[2],
+                             std::map<WordId, RowTotal> row_totals[2]) {
+  int32_t dir;
+  while (in.read(reinterpret_cast<char *>(&dir), sizeof(dir))) {
+    double values[4];
+    int64_t changed_rows;
+    uint64_t size;
+    if (dir < 0 || dir > 1 || !in.read(reinterpret_cast<char *>(values), sizeof(values)) ||
+        !in.read(reinterpret_cast<char *>(&changed_rows), sizeof(changed_rows)) ||
+        !in.read(reinterpret_cast<char *>(&size), sizeof(size)))
+      LOG(FATAL) << "Invalid tension statistics in " << name;
+    stats[dir].toks += values[0];
+    stats[dir].emp_feat += values[1];
+    stats[dir].log_likelihood += values[2];
+    stats[dir].table_change += values[3];
+    stats[dir].changed_rows += changed_rows;
+    SizeCountRecord record;
+    for (uint64_t i = 0; i < size; ++i) {
+      if (!in.read(reinterpret_cast<char *>(&record), sizeof(record)))
+        LOG(FATAL) << "Truncated tension statistics in " << name;
+      stats[dir].size_counts[record.k] += record.v;
+    }
+    if (!in.read(reinterpret_cast<char *>(&size), sizeof(size)))
+      LOG(FATAL) << "Truncated tension statistics in " << name;
+    RowTotalRecord total;
+    for (uint64_t i = 0; i < size; ++i) {
+      if (!in.read(reinterpret_cast<char *>(&total), sizeof(total)))
+        LOG(FATAL) << "Truncated tension statistics in " << name;
+      RowTotal &sum = row_totals[dir][total.k];
+      sum.first += total.v.k;
+      sum.second += total.v.v;
+    }
+  }
+  if (in.gcount() != 0)
+    LOG(FATAL) << "Truncated tension statistics in " << name;
+}
+
+// Fits `diagonal_tension` so that the expected alignment feature under
+// the model matches the empirical (posterior) one. The length-pair
+// histogram is flattened into an array and each evaluation of the
+// model feature is split across threads. Finds the root with damped
+// Newton's method within [kMinTension, kMaxTension], using a central
+// difference for the derivative.
+class TensionOptimizer {
+ public:
+  TensionOptimizer(const std::map<SentSzPair, int> &size_counts, double toks, int threads)
+      : toks_(toks), threads_(threads < 1 ? 1 : threads), evals_(0) {
+    histogram_.reserve(size_counts.size());
+    size_t work = 0;
+    for (std::map<SentSzPair, int>::const_iterator it = size_counts.begin(); it != size_counts.end(); ++it) {
+      histogram_.push_back(SizeCountRecord(it->first, it->second));
+      work += FirstSz(it->first);
+    }
+    // Cut the histogram into chunks of roughly equal work, which is
+    // proportional to the target length
+    bounds_.push_back(0);
+    size_t acc = 0;
+    for (size_t i = 0; i < histogram_.size(); ++i) {
+      acc += FirstSz(histogram_[i].k);
+      if (acc * threads_ >= work * bounds_.size() && bounds_.size() < static_cast<size_t>(threads_))
+        bounds_.push_back(i + 1);
+    }
+    bounds_.push_back(histogram_.size());
+  }
+
+  // Expected alignment feature per token under the model
+  double ModelFeature(double tension) {
+    ++evals_;
+    const size_t chunks = bounds_.size() - 1;
+    std::vector<double> partial(chunks, 0);
+    if (chunks == 1) {
+      SumFeature(tension, 0, &partial[0]);
+    } else {
+      boost::thread_group threads;
+      for (size_t c = 0; c < chunks; ++c)
+        threads.create_thread(boost::bind(&TensionOptimizer::SumFeature, this, tension, c, &partial[c]));
+      threads.join_all();
+    }
+    double sum = 0;
+    for (size_t c = 0; c < chunks; ++c)
+      sum += partial[c];
+    return sum / toks_;
+  }
+
+  // Returns the optimized tension, starting from `tension`
+  double Optimize(double emp_feat, double tension, int max_steps = 20, double tolerance = 1e-8) {
+    const double start = WallTime();
+    const double h = 1e-4;
+    tension = Clamp(tension);
+    double diff = ModelFeature(tension) - emp_feat;
+    int step = 0;
+    bool converged = false;
+    for (; step < max_steps && !converged; ++step) {
+      LOG(INFO) << "  " << step + 1 << "  model al-feat: " << diff + emp_feat << " (tension=" << tension << ")";
+      if (std::fabs(diff) < tolerance) {
+        converged = true;
+        break;
+      }
+      const double a = Clamp(tension - h), b = Clamp(tension + h);
+      const double slope = (ModelFeature(b) - ModelFeature(a)) / (b - a);
+      if (!(std::fabs(slope) > 0) || slope != slope)
+        break;
+      // Backtrack until the step gets closer to the root
+      double delta = -diff / slope, next = Clamp(tension + delta);
+      double next_diff = ModelFeature(next) - emp_feat;
+      for (int i = 0; i < 10 && !(std::fabs(next_diff) < std::fabs(diff)); ++i) {
+        delta /= 2;
+        next = Clamp(tension + delta);
+        next_diff = ModelFeature(next) - emp_feat;
+      }
+      if (!(std::fabs(next_diff) < std::fabs(diff))) {
+        // No progress possible, e.g. the root lies beyond the limits
+        converged = true;
+        break;
+      }
+      converged = std::fabs(next - tension) < tolerance;
+      tension = next;
+      diff = next_diff;
+    }
+    if (!converged)
+      LOG(WARNING) << "Tension optimizer did not converge in " << step << " steps";
+    LOG(INFO) << "  tension optimizer: " << step << " steps, " << evals_
+              << " evaluations over " << histogram_.size() << " length pairs on "
+              << bounds_.size() - 1 << " threads, " << WallTime() - start << "s";
+    return tension;
+  }
+
+ private:
+  static double Clamp(double tension) {
+    return std::min(std::max(tension, kMinTension), kMaxTension);
+  }
+
+  void SumFeature(double tension, size_t chunk, double *out) const {
+    double sum = 0;
+    for (size_t i = bounds_[chunk]; i < bounds_[chunk + 1]; ++i) {
+      const SentSzPair p = histogram_[i].k;
+      double row = 0;
+      for (int j = 1; j <= FirstSz(p); ++j)
+        row += DiagonalAlignment::ComputeDLogZ(j, FirstSz(p), SecondSz(p), tension);
+      sum += histogram_[i].v * row;
+    }
+    *out = sum;
+  }
+
+  std::vector<SizeCountRecord> histogram_;
+  std::vector<size_t> bounds_;
+  double toks_;
+  int threads_;
+  int evals_;
+};
+} // namespace paralign
+
+#endif  // _PARALIGN_TENSION_H_
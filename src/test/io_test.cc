@@ -2,6 +2,7 @@
 #define BOOST_TEST_MODULE io_test
 #include <boost/test/unit_test.hpp>
 
+#include <map>
 #include <string>
 #include <sstream>
 #include <vector>
@@ -47,6 +48,35 @@ BOOST_AUTO_TEST_CASE( MapperSourceMultiLine ) {
   BOOST_CHECK_EQUAL(read, 3);
 }
 
+BOOST_AUTO_TEST_CASE( MapperSourceTryParse ) {
+  size_t id = 0;
+  vector<WordId> v, w;
+  BOOST_REQUIRE(MapperSource::TryParse("12\t1  2\t3", &id, &v, &w));
+  BOOST_CHECK_EQUAL(id, 12);
+  BOOST_CHECK_EQUAL(v.size(), 2);
+  BOOST_CHECK_EQUAL(v[1], 2);
+  BOOST_CHECK_EQUAL(w.size(), 1);
+  BOOST_CHECK_EQUAL(w[0], 3);
+  BOOST_REQUIRE(MapperSource::TryParse("3\t\t2147483647", &id, &v, &w));
+  BOOST_CHECK_EQUAL(v.size(), 0);
+  BOOST_CHECK_EQUAL(w[0], 2147483647);
+
+  // Malformed
+  BOOST_CHECK(!MapperSource::TryParse("", &id, &v, &w));
+  BOOST_CHECK(!MapperSource::TryParse("\t1\t2", &id, &v, &w));
+  BOOST_CHECK(!MapperSource::TryParse("1\t2", &id, &v, &w));
+  BOOST_CHECK(!MapperSource::TryParse("1\t2\t3\t4", &id, &v, &w));
+  BOOST_CHECK(!MapperSource::TryParse("1\t2x\t3", &id, &v, &w));
+  BOOST_CHECK(!MapperSource::TryParse("1\t-2\t3", &id, &v, &w));
+  BOOST_CHECK(!MapperSource::TryParse(" 1\t2\t3", &id, &v, &w));
+  BOOST_CHECK(!MapperSource::TryParse(string("1\t2\0\t3", 6), &id, &v, &w));
+
+  // Overflowing sentence and word ids
+  BOOST_CHECK(!MapperSource::TryParse("99999999999999999999999\t1\t2", &id, &v, &w));
+  BOOST_CHECK(!MapperSource::TryParse("1\t2147483648\t2", &id, &v, &w));
+  BOOST_CHECK(!MapperSource::TryParse("1\t1\t99999999999999999999999", &id, &v, &w));
+}
+
 BOOST_AUTO_TEST_CASE( ReducerSourceEmptyFile ) {
   istringstream strm("");
   ReducerSource in(strm);
@@ -197,3 +227,59 @@ BOOST_AUTO_TEST_CASE( ViterbiSinkWrite ) {
                     "2\t0-0\n"
                     "4\t0-0 1-2\n");
 }
+
+BOOST_AUTO_TEST_CASE( SinkReverseDirection ) {
+  ostringstream os;
+  Sink out(os, kReverseDirection);
+  map<WordId, double> row;
+  row[3] = 0.5;
+  out.WriteTTableEntry(7, TTableEntry(row));
+  out.WriteToks(0.25);
+
+  istringstream is(os.str());
+  ReducerSource in(is);
+  // ttable entry under the usual key but tagged
+  BOOST_REQUIRE(!in.Done());
+  BOOST_CHECK_EQUAL(in.Key(), 7);
+  BOOST_CHECK_EQUAL(in.EntryDirection(), kReverseDirection);
+  TTableEntry entry;
+  in.Read(&entry);
+  BOOST_CHECK_EQUAL(entry.Size(), 1);
+  // toks under its own key
+  in.Next();
+  BOOST_REQUIRE(!in.Done());
+  BOOST_CHECK_EQUAL(StatKeyDirection(in.Key()), kReverseDirection);
+  BOOST_CHECK_EQUAL(ForwardStatKey(in.Key()), kToksKey);
+  double v;
+  in.Read(&v);
+  BOOST_CHECK_EQUAL(v, 0.25);
+  in.Next();
+  BOOST_REQUIRE(in.Done());
+  BOOST_CHECK_EQUAL(ReducerSource::ValueDirection("1 2 3"), kForwardDirection);
+}
+
+BOOST_AUTO_TEST_CASE( SinkFloatCounts ) {
+  ostringstream os;
+  Sink out(os, kReverseDirection, true);
+  map<WordId, double> row;
+  row[3] = 0.1;
+  row[5] = 1e-60;
+  out.WriteTTableEntry(7, TTableEntry(row));
+
+  istringstream is(os.str());
+  ReducerSource in(is);
+  BOOST_REQUIRE(!in.Done());
+  BOOST_CHECK_EQUAL(in.EntryDirection(), kReverseDirection);
+  TTableEntry entry;
+  in.Read(&entry);
+  BOOST_REQUIRE_EQUAL(entry.Size(), 2);
+  BOOST_CHECK_EQUAL(entry[0].k, 3);
+  BOOST_CHECK_EQUAL(entry[0].v, static_cast<double>(0.1f));
+  // Too small for a float but still there
+  BOOST_CHECK_EQUAL(entry[1].k, 5);
+  BOOST_CHECK_GT(entry[1].v, 0);
+  // Full precision entries parse as before
+  ReducerSource::ParseEntry("1 3 4591870180066957722", &entry);
+  BOOST_REQUIRE_EQUAL(entry.Size(), 1);
+  BOOST_CHECK_EQUAL(entry[0].v, 0.1);
+}
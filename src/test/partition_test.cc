@@ -0,0 +1,133 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE partition_test
+#include <boost/test/unit_test.hpp>
+
+#include <algorithm>
+#include <map>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+#include "partition.h"
+#include "types.h"
+
+using namespace std;
+using namespace paralign;
+
+BOOST_AUTO_TEST_CASE( DefaultIsModulo ) {
+  PartitionMap map(3);
+  BOOST_CHECK_EQUAL(map.Part(0), 0);
+  BOOST_CHECK_EQUAL(map.Part(7), 1);
+  BOOST_CHECK_EQUAL(map.Part(-2), 1);
+  BOOST_CHECK_EQUAL(map.Part(-12), 0);
+  BOOST_CHECK_EQUAL(map.Overrides(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE( AssignReadWrite ) {
+  PartitionMap map(3);
+  map.Assign(0, 2);
+  map.Assign(5, 2);   // already there
+  map.Assign(10, 0);
+  map.Assign(10, 1);  // back to its default
+  map.Assign(100, 0);
+  BOOST_CHECK_EQUAL(map.Overrides(), 2u);
+  BOOST_CHECK_EQUAL(map.Part(0), 2);
+  BOOST_CHECK_EQUAL(map.Part(10), 1);
+  BOOST_CHECK_EQUAL(map.Part(100), 0);
+  BOOST_CHECK_EQUAL(map.Part(1000), 1);
+
+  ostringstream out;
+  map.Write(out);
+  BOOST_CHECK_EQUAL(out.str(), "parts 3\n0 2\n100 0\n");
+  istringstream in(out.str());
+  PartitionMap read;
+  read.Read(in);
+  BOOST_CHECK_EQUAL(read.Parts(), 3);
+  BOOST_CHECK_EQUAL(read.Overrides(), 2u);
+  for (WordId w = -5; w < 200; ++w)
+    BOOST_CHECK_EQUAL(read.Part(w), map.Part(w));
+}
+
+BOOST_AUTO_TEST_CASE( BalanceSkewedRows ) {
+  // Zipfian row sizes; row 0 alone is a fifth of the total
+  vector<pair<WordId, int64_t> > sizes;
+  int64_t total = 0;
+  for (WordId w = 0; w < 10000; ++w) {
+    sizes.push_back(make_pair(w, 1000000 / (w + 1) + 1));
+    total += sizes.back().second;
+  }
+  const int parts = 4;
+  vector<int64_t> before(parts, 0), after;
+  for (size_t i = 0; i < sizes.size(); ++i)
+    before[PartitionMap::DefaultPart(sizes[i].first, parts)] += sizes[i].second;
+  PartitionMap map = PartitionMap::Balance(sizes, parts, &after);
+
+  // `after` is what the map does
+  vector<int64_t> check(parts, 0);
+  for (size_t i = 0; i < sizes.size(); ++i)
+    check[map.Part(sizes[i].first)] += sizes[i].second;
+  BOOST_CHECK(check == after);
+
+  const int64_t largest_before = *max_element(before.begin(), before.end());
+  const int64_t largest_after = *max_element(after.begin(), after.end());
+  BOOST_CHECK_LT(largest_after, largest_before);
+  BOOST_CHECK_LT(largest_after, total / parts * 11 / 10);
+  // Only the head is moved
+  BOOST_CHECK_LT(map.Overrides(), 1000u);
+}
+
+BOOST_AUTO_TEST_CASE( ShardedRow ) {
+  PartitionMap map(3);
+  map.Assign(0, 2);
+  map.AddShard(0, 0, 1);
+  map.AddShard(0, 100, 0);
+  map.AddShard(0, 500, 2);
+  map.Assign(4, 0);
+  BOOST_CHECK_EQUAL(map.Overrides(), 1u);
+  BOOST_CHECK(map.Sharded(0));
+  BOOST_CHECK(!map.Sharded(4));
+  BOOST_CHECK_EQUAL(map.NumShards(), 3u);
+  BOOST_CHECK_EQUAL(map.EntryPart(0, 7), 1);
+  BOOST_CHECK_EQUAL(map.EntryPart(0, 100), 0);
+  BOOST_CHECK_EQUAL(map.EntryPart(0, 499), 0);
+  BOOST_CHECK_EQUAL(map.EntryPart(0, 10000), 2);
+  BOOST_CHECK_EQUAL(map.EntryPart(4, 10000), 0);
+  BOOST_CHECK_EQUAL(map.Part(PartitionMap::ShardKey(1)), 0);
+  BOOST_CHECK_EQUAL(map.Part(PartitionMap::ShardKey(2)), 2);
+  BOOST_CHECK(PartitionMap::IsShardKey(PartitionMap::ShardKey(0)));
+  BOOST_CHECK(!PartitionMap::IsShardKey(-16));
+  BOOST_CHECK_EQUAL(PartitionMap::ShardOfKey(PartitionMap::ShardKey(2)), 2u);
+
+  ostringstream out;
+  map.Write(out);
+  BOOST_CHECK_EQUAL(out.str(), "parts 3\n4 0\nshard 0 0 1\nshard 0 100 0\nshard 0 500 2\n");
+  istringstream in(out.str());
+  PartitionMap read;
+  read.Read(in);
+  BOOST_CHECK_EQUAL(read.NumShards(), 3u);
+  for (WordId tgt = 0; tgt < 1000; tgt += 7)
+    BOOST_CHECK_EQUAL(read.EntryPart(0, tgt), map.EntryPart(0, tgt));
+}
+
+BOOST_AUTO_TEST_CASE( BalanceShardsGiantRow ) {
+  // Row 0 is half the total, more than any part can take
+  vector<pair<WordId, int64_t> > sizes;
+  sizes.push_back(make_pair(0, 3000));
+  for (WordId w = 1; w <= 3000; ++w)
+    sizes.push_back(make_pair(w, 1));
+  const int parts = 4;
+  map<WordId, vector<WordId> > begins;
+  for (WordId tgt = 0; tgt < 4000; tgt += 1000)
+    begins[0].push_back(tgt);
+  vector<int64_t> after;
+  PartitionMap map = PartitionMap::Balance(sizes, parts, &after, &begins);
+  BOOST_REQUIRE(map.Sharded(0));
+  BOOST_CHECK_EQUAL(map.NumShards(), 4u);
+  vector<bool> used(parts, false);
+  for (size_t i = 0; i < map.NumShards(); ++i) {
+    BOOST_CHECK_EQUAL(map.GetShard(i).begin, static_cast<WordId>(1000 * i));
+    BOOST_CHECK(!used[map.GetShard(i).part]);
+    used[map.GetShard(i).part] = true;
+  }
+  BOOST_CHECK_EQUAL(*max_element(after.begin(), after.end()), 1500);
+}
@@ -0,0 +1,50 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE pipeline_test
+#include <boost/test/unit_test.hpp>
+
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "pipeline.h"
+
+using namespace std;
+using namespace paralign;
+
+static void Produce(BoundedQueue<int> *q, int n) {
+  for (int i = 0; i < n; ++i)
+    q->Push(i);
+  q->Close();
+}
+
+BOOST_AUTO_TEST_CASE( BoundedQueueFifo ) {
+  BoundedQueue<int> q(2);
+  boost::thread t(boost::bind(Produce, &q, 100));
+  int v, expected = 0;
+  while (q.Pop(&v)) {
+    BOOST_CHECK_EQUAL(v, expected);
+    ++expected;
+  }
+  t.join();
+  BOOST_CHECK_EQUAL(expected, 100);
+}
+
+BOOST_AUTO_TEST_CASE( ReorderBufferRestoresOrder ) {
+  ReorderBuffer<int> b(4);
+  size_t s0 = b.Reserve(), s1 = b.Reserve(), s2 = b.Reserve();
+  BOOST_CHECK_EQUAL(s0, 0);
+  BOOST_CHECK_EQUAL(s1, 1);
+  BOOST_CHECK_EQUAL(s2, 2);
+  b.Put(s2, 12);
+  b.Put(s0, 10);
+  b.Put(s1, 11);
+  b.Close();
+  int v;
+  BOOST_REQUIRE(b.Take(&v));
+  BOOST_CHECK_EQUAL(v, 10);
+  BOOST_REQUIRE(b.Take(&v));
+  BOOST_CHECK_EQUAL(v, 11);
+  BOOST_REQUIRE(b.Take(&v));
+  BOOST_CHECK_EQUAL(v, 12);
+  BOOST_CHECK(!b.Take(&v));
+}
@@ -0,0 +1,39 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE sketch_test
+#include <boost/test/unit_test.hpp>
+
+#include "sketch.h"
+#include "types.h"
+
+using namespace paralign;
+
+BOOST_AUTO_TEST_CASE( SmallCountsAreNearlyExact ) {
+  HyperLogLog hll(12);
+  BOOST_CHECK_EQUAL(hll.Estimate(), 0);
+  for (int k = 0; k < 3; ++k)
+    for (WordId w = 0; w < 100; ++w)
+      hll.Add(HashWord(w));
+  BOOST_CHECK_CLOSE(hll.Estimate(), 100, 5);
+}
+
+BOOST_AUTO_TEST_CASE( LargeCountsWithinError ) {
+  // 1.04 / sqrt(4096) = 1.6%; allow three times that
+  HyperLogLog hll(12);
+  for (WordId src = 0; src < 1000; ++src)
+    for (WordId tgt = 0; tgt < 500; ++tgt)
+      hll.Add(HashPair(src, tgt));
+  BOOST_CHECK_CLOSE(hll.Estimate(), 500000, 5);
+}
+
+BOOST_AUTO_TEST_CASE( MergeIsUnion ) {
+  HyperLogLog a(10), b(10), both(10);
+  for (WordId w = 0; w < 30000; ++w) {
+    (w % 2 ? a : b).Add(HashWord(w));
+    both.Add(HashWord(w));
+  }
+  // Shared half
+  for (WordId w = 0; w < 15000; ++w)
+    a.Add(HashWord(w));
+  a.Merge(b);
+  BOOST_CHECK_EQUAL(a.Estimate(), both.Estimate());
+}
@@ -0,0 +1,71 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE symmetrize_test
+#include <boost/test/unit_test.hpp>
+
+#include <cstring>
+#include <vector>
+
+#include "symmetrize.h"
+#include "types.h"
+
+using namespace std;
+using namespace paralign;
+
+static vector<SentSzPair> Parse(const char *s) {
+  vector<SentSzPair> al;
+  BOOST_REQUIRE(ParseAlignment(s, s + strlen(s), &al));
+  return al;
+}
+
+static vector<SentSzPair> Run(Heuristic heuristic, const char *forward, const char *reverse) {
+  Symmetrizer symmetrizer(heuristic);
+  vector<SentSzPair> al;
+  symmetrizer.Symmetrize(Parse(forward), Parse(reverse), &al);
+  return al;
+}
+
+BOOST_AUTO_TEST_CASE( ParseAlignmentFormats ) {
+  vector<SentSzPair> al;
+  const char *empty = "";
+  BOOST_CHECK(ParseAlignment(empty, empty, &al));
+  BOOST_CHECK(al.empty());
+  al = Parse("0-1 12-3");
+  BOOST_REQUIRE_EQUAL(al.size(), 2);
+  BOOST_CHECK_EQUAL(al[0], MkSzPair(0, 1));
+  BOOST_CHECK_EQUAL(al[1], MkSzPair(12, 3));
+  const char *bad[] = {"0", "0-", "-1", "0-1x", "1-2-3", "70000-1"};
+  for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i)
+    BOOST_CHECK(!ParseAlignment(bad[i], bad[i] + strlen(bad[i]), &al));
+}
+
+BOOST_AUTO_TEST_CASE( ParseHeuristicNames ) {
+  Heuristic h;
+  BOOST_CHECK(ParseHeuristic("grow-diag-final-and", &h));
+  BOOST_CHECK_EQUAL(h, kGrowDiagFinalAnd);
+  BOOST_CHECK(ParseHeuristic("union", &h));
+  BOOST_CHECK_EQUAL(h, kUnion);
+  BOOST_CHECK(!ParseHeuristic("gdfa", &h));
+}
+
+BOOST_AUTO_TEST_CASE( UnionAndIntersection ) {
+  BOOST_CHECK(Run(kUnion, "0-0 1-1", "1-1 2-1") == Parse("0-0 1-1 2-1"));
+  BOOST_CHECK(Run(kIntersection, "0-0 1-1", "1-1 2-1") == Parse("1-1"));
+  BOOST_CHECK(Run(kIntersection, "", "") == Parse(""));
+}
+
+BOOST_AUTO_TEST_CASE( GrowDiag ) {
+  // 2-2 is only diagonally adjacent to the intersection
+  BOOST_CHECK(Run(kGrow, "0-0 1-1 2-2", "0-0 1-1") == Parse("0-0 1-1"));
+  BOOST_CHECK(Run(kGrowDiag, "0-0 1-1 2-2", "0-0 1-1") == Parse("0-0 1-1 2-2"));
+  // 1-0 is adjacent but both of its words are aligned by then
+  BOOST_CHECK(Run(kGrowDiag, "0-0 1-0 1-1", "0-0 1-1") == Parse("0-0 1-1"));
+}
+
+BOOST_AUTO_TEST_CASE( Final ) {
+  // 3-3 is far from the intersection; 3-0 covers a new source word only
+  BOOST_CHECK(Run(kGrowDiag, "0-0 3-3", "0-0 3-0") == Parse("0-0"));
+  BOOST_CHECK(Run(kGrowDiagFinal, "0-0 3-3", "0-0 3-0") == Parse("0-0 3-3"));
+  BOOST_CHECK(Run(kGrowDiagFinalAnd, "0-0 3-3", "0-0 3-0") == Parse("0-0 3-3"));
+  BOOST_CHECK(Run(kGrowDiagFinal, "0-0 0-3", "0-0 3-0") == Parse("0-0 0-3 3-0"));
+  BOOST_CHECK(Run(kGrowDiagFinalAnd, "0-0 0-3", "0-0 3-0") == Parse("0-0"));
+}
@@ -0,0 +1,93 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE tension_test
+#include <boost/test/unit_test.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+
+#include "tension.h"
+#include "types.h"
+
+using namespace std;
+using namespace paralign;
+
+static map<SentSzPair, int> MakeSizeCounts(double *toks) {
+  map<SentSzPair, int> m;
+  *toks = 0;
+  for (SentSz t = 1; t < 30; t += 3) {
+    for (SentSz s = 2; s < 30; s += 5) {
+      m[MkSzPair(t, s)] = t + s;
+      *toks += t * (t + s);
+    }
+  }
+  return m;
+}
+
+BOOST_AUTO_TEST_CASE( SizeCountsSaveLoad ) {
+  double toks;
+  map<SentSzPair, int> m = MakeSizeCounts(&toks), n;
+  char path[] = "/tmp/tension_test.XXXXXX";
+  int fd = mkstemp(path);
+  BOOST_REQUIRE(fd >= 0);
+  close(fd);
+  SaveSizeCounts(path, m);
+  LoadSizeCounts(path, &n);
+  unlink(path);
+  BOOST_CHECK(m == n);
+}
+
+BOOST_AUTO_TEST_CASE( TensionStatsMerge ) {
+  // Two reducers, the second with only reverse statistics
+  TensionStats stats[2][2];
+  map<WordId, RowTotal> totals[2][2];
+  stats[0][0].size_counts = MakeSizeCounts(&stats[0][0].toks);
+  stats[0][0].emp_feat = -1.5;
+  stats[0][0].log_likelihood = -100;
+  stats[0][0].table_change = 0.25;
+  stats[0][0].changed_rows = 2;
+  totals[0][0][0] = RowTotal(2.5, 3);
+  stats[1][1].toks = 7;
+  stats[1][1].size_counts[MkSzPair(1, 2)] = 4;
+  stats[1][0].table_change = 0.5;
+  stats[1][0].changed_rows = 3;
+  totals[1][0][0] = RowTotal(0.5, 1);
+  ostringstream out;
+  SaveTensionStats(out, stats[0], totals[0]);
+  SaveTensionStats(out, stats[1], totals[1]);
+
+  TensionStats merged[2];
+  map<WordId, RowTotal> merged_totals[2];
+  istringstream in(out.str());
+  LoadTensionStats(in, "test", merged, merged_totals);
+  BOOST_CHECK(merged[0].size_counts == stats[0][0].size_counts);
+  BOOST_CHECK_EQUAL(merged[0].toks, stats[0][0].toks);
+  BOOST_CHECK_EQUAL(merged[0].emp_feat, -1.5);
+  BOOST_CHECK_EQUAL(merged[0].log_likelihood, -100);
+  BOOST_CHECK_EQUAL(merged[0].table_change, 0.75);
+  BOOST_CHECK_EQUAL(merged[0].changed_rows, 5);
+  BOOST_CHECK_EQUAL(merged_totals[0][0].first, 3);
+  BOOST_CHECK_EQUAL(merged_totals[0][0].second, 4);
+  BOOST_CHECK_EQUAL(merged[1].toks, 7);
+  BOOST_CHECK_EQUAL(merged[1].size_counts.size(), 1);
+  BOOST_CHECK(merged_totals[1].empty());
+}
+
+BOOST_AUTO_TEST_CASE( ThreadsAgree ) {
+  double toks;
+  map<SentSzPair, int> m = MakeSizeCounts(&toks);
+  TensionOptimizer one(m, toks, 1), many(m, toks, 3);
+  BOOST_CHECK_CLOSE(one.ModelFeature(4.0), many.ModelFeature(4.0), 1e-9);
+}
+
+BOOST_AUTO_TEST_CASE( OptimizeRecoversTension ) {
+  double toks;
+  map<SentSzPair, int> m = MakeSizeCounts(&toks);
+  TensionOptimizer opt(m, toks, 2);
+  double emp_feat = opt.ModelFeature(5.0);
+  double tension = opt.Optimize(emp_feat, 4.0);
+  BOOST_CHECK_CLOSE(tension, 5.0, 1e-3);
+}
@@ -150,3 +150,25 @@ BOOST_AUTO_TEST_CASE( TTableEntryPlusEqWithOverlap ) {
   PlusEq(f, e, &h);
   BOOST_CHECK_EQUAL(g, h);
 }
+
+BOOST_AUTO_TEST_CASE( TTableEntryAssignScale ) {
+  EntryRecord records[] = {EntryRecord(1, 0.5), EntryRecord(3, 2)};
+  TTableEntry e;
+  e.Assign(records, records + 2);
+  e.Scale(0.5);
+  map<WordId, double> m;
+  m[1] = 0.25; m[3] = 1;
+  BOOST_CHECK_EQUAL(e, TTableEntry(m));
+}
+
+BOOST_AUTO_TEST_CASE( TTableEntryCopySwap ) {
+  map<WordId, double> m, n;
+  m[1] = 0.25; m[3] = 1;
+  n[2] = 0.5;
+  TTableEntry e(m), f(n), g;
+  g = e;
+  BOOST_CHECK_EQUAL(g, e);
+  g.Swap(f);
+  BOOST_CHECK_EQUAL(g, TTableEntry(n));
+  BOOST_CHECK_EQUAL(f, e);
+}
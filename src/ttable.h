@@ -8,20 +8,24 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <fcntl.h>
-#include <hdfs.h>
 
 #include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <limits>
 #include <map>
+#include <set>
 #include <string>
 #include <utility>
 #include <vector>
 #include <boost/foreach.hpp>
 #include <boost/math/special_functions/digamma.hpp>
 #include <boost/scoped_array.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/utility.hpp>
 
+#include "hdfs_io.h"
+#include "partition.h"
 #include "types.h"
 #include "contrib/log.h"
 
@@ -77,10 +81,25 @@ KV<K, V> *LookUp(K key, KV<K, V> *base, size_t num) {
     return NULL;
 }
 
+template <class K, class V>
+const KV<K, V> *LookUp(K key, const KV<K, V> *base, size_t num) {
+  return LookUp(key, const_cast<KV<K, V> *>(base), num);
+}
+
 
 typedef KV<WordId, KV<off_t, size_t> > IndexRecord;
 typedef KV<WordId, double> EntryRecord;
 
+// Rounds a count to float, as the shuffle does with `float_counts`;
+// nonzero counts below the float range become the smallest float so
+// that their entries are kept
+inline float FloatCount(double v) {
+  float f = static_cast<float>(v);
+  if (f == 0 && v != 0)
+    f = v > 0 ? std::numeric_limits<float>::denorm_min() : -std::numeric_limits<float>::denorm_min();
+  return f;
+}
+
 // A table entry holds an array of `KV<WordId, double>`; all items are
 // sorted by word id for efficient plus.
 class TTableEntry {
@@ -90,6 +109,11 @@ class TTableEntry {
 
   TTableEntry(const TTableEntry &that) : items_(that.items_) {}
 
+  TTableEntry &operator=(const TTableEntry &that) {
+    items_ = that.items_;
+    return *this;
+  }
+
   // Converts a (ordered) map to an entry
   explicit TTableEntry(const std::map<WordId, double> &m) {
     items_.reserve(m.size());
@@ -149,13 +173,55 @@ class TTableEntry {
     }
   }
 
+  double Sum() const {
+    double sum = 0;
+    BOOST_FOREACH(const EntryRecord &i, items_) {
+      sum += i.v;
+    }
+    return sum;
+  }
+
+  // Replaces items by the numerators of `NormalizeVB`, for a row whose
+  // total is only known later (see `RowScale`)
+  void NumeratorsVB(double alpha) {
+    BOOST_FOREACH(EntryRecord &i, items_) {
+      i.v = exp(boost::math::digamma(i.v + alpha));
+    }
+  }
+
   // Clears items;
   void Clear() {
     items_.clear();
   }
 
+  // Exchanges items with `that` without copying them
+  void Swap(TTableEntry &that) {
+    items_.swap(that.items_);
+  }
+
+  // Replaces items with [begin, end), which must be ordered by word id
+  void Assign(const EntryRecord *begin, const EntryRecord *end) {
+    items_.assign(begin, end);
+  }
+
+  // Multiplies all items by `factor`
+  void Scale(double factor) {
+    BOOST_FOREACH(EntryRecord &i, items_) {
+      i.v *= factor;
+    }
+  }
+
+  // Rounds all items by `FloatCount`
+  void RoundToFloat() {
+    BOOST_FOREACH(EntryRecord &i, items_) {
+      i.v = FloatCount(i.v);
+    }
+  }
+
   friend std::ostream &operator<<(std::ostream &, const TTableEntry &);
   friend std::istream &operator>>(std::istream &, TTableEntry &);
+  friend void WriteFloat(std::ostream &, const TTableEntry &);
+  friend void ReadFloat(std::istream &, TTableEntry &);
   friend void PlusEq(const TTableEntry &, const TTableEntry &, TTableEntry *);
 
  private:
@@ -187,6 +253,28 @@ inline std::istream &operator>>(std::istream &in, TTableEntry &e) {
   return in;
 }
 
+// Same as `operator<<` but with the items rounded by `FloatCount` and
+// written as the bits of the float, about half as many digits
+inline void WriteFloat(std::ostream &out, const TTableEntry &e) {
+  out << e.items_.size();
+  BOOST_FOREACH(const EntryRecord &i, e.items_) {
+    out << ' ' << i.k << ' ' << FloatAsInt32(FloatCount(i.v));
+  }
+}
+
+// Reads what's written by `WriteFloat`
+inline void ReadFloat(std::istream &in, TTableEntry &e) {
+  size_t n;
+  in >> n;
+  e.items_.resize(n);
+  for (size_t i = 0; i < n; ++i) {
+    in >> e.items_[i].k;
+    int32_t v;
+    in >> v;
+    e.items_[i].v = FloatFromInt32(v);
+  }
+}
+
 inline void PlusEq(const TTableEntry &x, const TTableEntry &y, TTableEntry *z) {
   z->items_.clear();
   size_t xi = 0, yi = 0;
@@ -263,7 +351,8 @@ class PartialTTable : boost::noncopyable {
                  << sizeof(EntryRecord) << " bytes)";
   }
 
-  void Dump(std::ostream &output) const {
+  // Rows in `scales` have their entries multiplied by its value
+  void Dump(std::ostream &output, const std::map<WordId, double> &scales = std::map<WordId, double>()) const {
     if (index_base_ == NULL) {
       output << "[ No index loaded ]\n";
     } else if (entry_base_ == NULL) {
@@ -273,10 +362,12 @@ class PartialTTable : boost::noncopyable {
         WordId src = index_base_[i].k;
         off_t offset = index_base_[i].v.k;
         size_t num_entry = index_base_[i].v.v;
+        std::map<WordId, double>::const_iterator scale = scales.find(src);
         for (size_t j = 0; j < num_entry; ++j) {
           const EntryRecord &record = (entry_base_ + offset)[j];
-          output << src << ' ' << record.k << ' ' << log(record.v) << ' '
-                 << record.v << ' ' << DoubleAsInt64(record.v) << '\n';
+          const double v = scale == scales.end() ? record.v : record.v * scale->second;
+          output << src << ' ' << record.k << ' ' << log(v) << ' '
+                 << v << ' ' << DoubleAsInt64(v) << '\n';
         }
       }
       // output << "[raw] [index]\n";
@@ -294,15 +385,42 @@ class PartialTTable : boost::noncopyable {
   }
 
   double Query(WordId src, WordId tgt) const {
+    const EntryRecord *entry_record = Find(src, tgt);
+    return entry_record == NULL ? kDefaultProbability : entry_record->v;
+  }
+
+  // Entry of (`src`, `tgt`), or NULL
+  const EntryRecord *Find(WordId src, WordId tgt) const {
     const IndexRecord *index_record = LookUp(src, index_base_, num_entry_);
     if (index_record == NULL)
-      return kDefaultProbability;
+      return NULL;
     off_t offset = index_record->v.k;
     size_t num_entry_record = index_record->v.v;
-    const EntryRecord *entry_record = LookUp(tgt, entry_base_ + offset, num_entry_record);
-    if (entry_record == NULL)
-      return kDefaultProbability;
-    return entry_record->v;
+    return LookUp(tgt, entry_base_ + offset, num_entry_record);
+  }
+
+  // Rows in index order, for reading back a table as a whole
+  size_t NumRows() const {
+    return num_entry_;
+  }
+
+  WordId RowKey(size_t row) const {
+    return index_base_[row].k;
+  }
+
+  size_t RowSize(size_t row) const {
+    return index_base_[row].v.v;
+  }
+
+  void ReadRow(size_t row, TTableEntry *entry) const {
+    const EntryRecord *begin = entry_base_ + index_base_[row].v.k;
+    entry->Assign(begin, begin + index_base_[row].v.v);
+  }
+
+  // Row of `src`, or `NumRows()` if there is none
+  size_t FindRow(WordId src) const {
+    const IndexRecord *index_record = LookUp(src, index_base_, num_entry_);
+    return index_record == NULL ? num_entry_ : index_record - index_base_;
   }
 
  private:
@@ -338,15 +456,15 @@ class PartialTTable : boost::noncopyable {
     *length = st.st_size;
 
     LOG(INFO) << "Loaded " << path << " as mmap @"
-              << std::hex << map << "[" << *length << "]";
+              << std::hex << map << std::dec << "[" << *length << "]";
   }
 
   void DoMunmap(void *addr, size_t length) {
     int r = munmap(addr, length);
     if (r < 0) {
       const char *err_msg = std::strerror(errno);
-      LOG(ERROR) << "Failed to munmap addr=" << std::hex << addr
-                 << "length=" << length << " : " << err_msg;
+      LOG(ERROR) << "Failed to munmap addr=" << std::hex << addr << std::dec
+                 << " length=" << length << " : " << err_msg;
     }
   }
 
@@ -355,105 +473,131 @@ class PartialTTable : boost::noncopyable {
   size_t num_entry_, index_length_, entry_length_;
 };
 
-// Distributed translation table
+// File name prefix of the reverse translation table in bidirectional
+// training
+const char kReversePrefix[] = "reverse.";
+
+// File name prefix of the raw expected counts saved next to a table
+// (after `kReversePrefix` for the reverse one)
+const char kCountsPrefix[] = "counts.";
+
+// Name (after the table's prefix) of the "src scale" lines pa-diagonal
+// writes for the rows sharded by the partition map, whose entries are
+// stored unnormalized
+const char kRowScaleName[] = "row.scale";
+
+// Factor that turns the entries of a sharded row, stored as counts or
+// `TTableEntry::NumeratorsVB` of them, into what `Normalize` or
+// `NormalizeVB` would give; `sum` and `size` are those of the counts
+// over all shards
+inline double RowScale(double sum, int64_t size, bool variational_bayes, double alpha) {
+  if (variational_bayes)
+    return exp(-boost::math::digamma(sum + alpha * size));
+  if (sum == 0)
+    LOG(WARNING) << "Division by zero in RowScale";
+  return 1 / sum;
+}
+
+// Writes a `kRowScaleName` of 1 for every row `map` shards, for tables
+// whose sharded rows are written already normalized
+inline void WriteUnitRowScales(const PartitionMap &map, const std::string &out_dir, const std::string &prefix) {
+  std::set<WordId> rows;
+  for (size_t i = 0; i < map.NumShards(); ++i)
+    rows.insert(map.GetShard(i).src);
+  if (rows.empty())
+    return;
+  FileOutputStream out(out_dir, prefix + kRowScaleName);
+  BOOST_FOREACH(WordId src, rows) {
+    out << src << " 1\n";
+  }
+}
+
+// Distributed translation table; `prefix` tells apart multiple tables
+// in the same directory (see `kReversePrefix`). Rows are found in the
+// parts given by the `kPartitionMapName` file of the directory, if
+// any, and by `src % parts` otherwise. Sharded rows are scaled by the
+// `kRowScaleName` file, which must list every sharded row the table holds.
 class TTable : boost::noncopyable {
  public:
-  TTable(const std::string &in_dir, size_t parts) : tables_(new PartialTTable[parts]), parts_(parts) {
+  TTable(const std::string &in_dir, size_t parts, const std::string &prefix = "")
+      : tables_(new PartialTTable[parts]), parts_(parts), map_(parts) {
+    if (map_.Load(in_dir + "/" + kPartitionMapName)) {
+      if (map_.Parts() != static_cast<int>(parts))
+        LOG(FATAL) << "Partition map of " << in_dir << " is for " << map_.Parts() << " parts, not " << parts;
+      LOG(INFO) << "Partition map moves " << map_.Overrides() << " rows and has " << map_.NumShards()
+                << " shards";
+    }
     for (size_t i = 0; i < parts; ++i) {
-      std::string index_path = in_dir + "/index." + boost::lexical_cast<string>(i);
-      std::string entry_path = in_dir + "/entry." + boost::lexical_cast<string>(i);
+      std::string index_path = in_dir + "/" + prefix + "index." + boost::lexical_cast<string>(i);
+      std::string entry_path = in_dir + "/" + prefix + "entry." + boost::lexical_cast<string>(i);
       tables_[i].Load(index_path, entry_path);
     }
-    LOG(INFO) << "Read " << parts << " pieces of translation table";
+    std::ifstream scales((in_dir + "/" + prefix + kRowScaleName).c_str());
+    WordId src;
+    double scale;
+    while (scales >> src >> scale)
+      row_scales_[src] = scale;
+    for (size_t i = 0; i < map_.NumShards(); ++i) {
+      const PartitionMap::Shard &shard = map_.GetShard(i);
+      const PartialTTable &table = tables_[shard.part];
+      if (row_scales_.find(shard.src) == row_scales_.end() && table.FindRow(shard.src) != table.NumRows())
+        LOG(FATAL) << "Row " << shard.src << " of " << in_dir << " is sharded but has no " << prefix
+                   << kRowScaleName;
+    }
+    LOG(INFO) << "Read " << parts << " pieces of " << prefix << "translation table";
   }
 
   double Query(WordId src, WordId tgt) const {
-    WordId part = src % parts_;
-    if (part < 0)
-      part += parts_;
-    return tables_[part].Query(src, tgt);
+    if (!map_.Sharded(src))
+      return tables_[map_.Part(src)].Query(src, tgt);
+    const EntryRecord *entry_record = tables_[map_.EntryPart(src, tgt)].Find(src, tgt);
+    if (entry_record == NULL)
+      return kDefaultProbability;
+    // Checked when loaded
+    return entry_record->v * row_scales_.find(src)->second;
   }
 
   void Dump(std::ostream &output) const {
     for (size_t i = 0; i < parts_; ++i) {
       output << "== PART " << i << " ==\n";
-      tables_[i].Dump(output);
+      tables_[i].Dump(output, row_scales_);
     }
   }
 
  private:
   boost::scoped_array<PartialTTable> tables_;
   size_t parts_;
+  PartitionMap map_;
+  std::map<WordId, double> row_scales_;
 };
 
-// Writer to a single piece of the distributed translation table
+// Writer to a single piece of the distributed translation table, to
+// any directory `FileOutputStream` takes
 class TTableWriter : boost::noncopyable {
  public:
-  TTableWriter(const std::string &output_dir, const std::string &part)
-      : fs_(NULL), index_(NULL), entry_(NULL) {
-    Open(output_dir, part);
+  TTableWriter(const std::string &output_dir, const std::string &part, const std::string &prefix = "")
+      : entries_(0) {
+    Open(output_dir, part, prefix);
   }
 
   ~TTableWriter() {
     Close();
   }
 
-  void Open(const std::string &output_dir, const std::string &part) {
+  void Open(const std::string &output_dir, const std::string &part, const std::string &prefix = "") {
     Close();
-    std::string user(getenv("USER"));
-    std::string protocol = "file";
-    std::string path = output_dir;
-    std::string namenode = "";
-    size_t colon_pos = path.find(':');
-    if (colon_pos != std::string::npos) {
-      protocol = path.substr(0, colon_pos);
-      path.erase(0, colon_pos + 1);
-    }
-    if (protocol == "file") {
-      namenode = "file:///";
-    } else if (protocol == "hdfs") {
-      size_t not_slash_pos = path.find_first_not_of('/');
-      if (not_slash_pos == std::string::npos)
-        LOG(FATAL) << "Ill-formed path: " << path;
-      path.erase(0, not_slash_pos);
-      size_t slash_pos = path.find('/');
-      namenode = "hdfs://" + path.substr(0, slash_pos);
-      path.erase(0, slash_pos);
-    } else {
-      LOG(FATAL) << "Unknown protocol: " << protocol;
-    }
-    if (path.empty())
-      LOG(FATAL) << "Empty path in " << output_dir;
-
-    LOG(INFO) << "namenode: " << namenode;
-    LOG(INFO) << "user: " << user;
-    LOG(INFO) << "out dir: " << path;
-    LOG(INFO) << "part: " << part;
-
-    fs_ = hdfsConnectAsUser(namenode.c_str(), 0, user.c_str());
-    if (fs_ == NULL)
-      LOG(FATAL) << "Cannot connect to file system: " << namenode;
-
-    index_ = hdfsOpenFile(fs_, (path + "/index." + part).c_str(), O_WRONLY, 0, 0, 0);
-    if (index_ == NULL)
-      LOG(FATAL) << "Cannot open index file for write: " << path << "/index." << part;
-
-    entry_ = hdfsOpenFile(fs_, (path + "/entry." + part).c_str(), O_WRONLY, 0, 0, 0);
-    if (entry_ == NULL)
-      LOG(FATAL) << "Cannot open entry file for wite: " << path << "/entry." << part;
+    LOG(INFO) << "part: " << prefix << part;
+    index_.reset(new FileOutputStream(output_dir, prefix + "index." + part));
+    entry_.reset(new FileOutputStream(output_dir, prefix + "entry." + part));
+    entries_ = 0;
+    in_mem_index_.clear();
   }
 
   void Write(WordId src, const TTableEntry &entry) {
-    tOffset begin_offset = hdfsTell(fs_, entry_);
-    if (begin_offset < 0)
-      LOG(FATAL) << "hdfsTell failed in TTableWriter::Write";
-    AddToIndex(src, begin_offset, entry.Size());
-    for (size_t i = 0; i < entry.Size(); ++i) {
-      const EntryRecord &record = entry[i];
-      tSize r = hdfsWrite(fs_, entry_, static_cast<const void *>(&record), sizeof(EntryRecord));
-      if (r < 0)
-        LOG(FATAL) << "hdfsWrite failed in TTableWriter::Write";
-    }
+    in_mem_index_[src] = KV<off_t, size_t>(entries_, entry.Size());
+    if (entry.Size() > 0)
+      entry_->write(reinterpret_cast<const char *>(&entry[0]), entry.Size() * sizeof(EntryRecord));
+    entries_ += entry.Size();
   }
 
   void WriteIndex() {
@@ -462,36 +606,19 @@ class TTableWriter : boost::noncopyable {
     BOOST_FOREACH(const P &p, in_mem_index_) {
       record.k = p.first;
       record.v = p.second;
-      tSize r = hdfsWrite(fs_, index_, static_cast<const void *>(&record), sizeof(IndexRecord));
-      if (r < 0)
-        LOG(FATAL) << "hdfsWrite failed in TTableWriter::WriteIndex";
+      index_->write(reinterpret_cast<const char *>(&record), sizeof(IndexRecord));
     }
   }
 
   void Close() {
-    if (index_) {
-      hdfsCloseFile(fs_, index_);
-      index_ = NULL;
-    }
-    if (entry_) {
-      hdfsCloseFile(fs_, entry_);
-      entry_ = NULL;
-    }
-    if (fs_) {
-      hdfsDisconnect(fs_);
-      fs_ = NULL;
-    }
+    index_.reset();
+    entry_.reset();
   }
 
  private:
-  void AddToIndex(WordId src, off_t begin_offset, size_t num_record) {
-    if (begin_offset % sizeof(EntryRecord) != 0)
-      LOG(FATAL) << "Unaligned offset: " << begin_offset;
-    in_mem_index_[src] = KV<off_t, size_t>(begin_offset / sizeof(EntryRecord), num_record);
-  }
-
-  hdfsFS fs_;
-  hdfsFile index_, entry_;
+  boost::scoped_ptr<FileOutputStream> index_, entry_;
+  // Records written to `entry_` so far
+  off_t entries_;
   std::map<WordId, KV<off_t, size_t> > in_mem_index_;
 };
 }// namespace paralign
@@ -0,0 +1,331 @@
+// pa-ttable: inspects and repartitions the translation tables of a
+// training iteration, reading the binary index and entry files through
+// mmap and writing them with `TTableWriter`.
+//
+// Usage: pa-ttable stats [-k ROWS] DIR
+//        pa-ttable repartition -n PARTS [-m MAP] DIR OUT_DIR
+//        pa-ttable merge DIR OUT_DIR
+//
+// DIR has as many parts as `index.N` files. Every table found there
+// (forward, reverse and saved counts) is handled. Rows that the
+// partition map of DIR shards are joined and multiplied by their
+// `row.scale`.
+//
+// stats prints for each table the rows, entries and bytes of each part,
+// a histogram of row lengths in powers of two, and the ROWS (default
+// 10) longest rows.
+//
+// repartition writes the tables to OUT_DIR in PARTS parts, by
+// `src % PARTS` or by the partition map MAP, which is saved there too.
+// Rows that MAP shards are split with their entries normalized, and get
+// a `row.scale` of 1. merge is repartition into a single part, e.g.
+// for pa-align-server.
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <queue>
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/lexical_cast.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/utility.hpp>
+
+#include "hdfs_io.h"
+#include "partition.h"
+#include "ttable.h"
+#include "types.h"
+#include "contrib/log.h"
+
+using namespace std;
+
+namespace paralign {
+// Prefixes of the tables an iteration can hold
+static vector<string> TablePrefixes() {
+  vector<string> prefixes;
+  prefixes.push_back("");
+  prefixes.push_back(kReversePrefix);
+  prefixes.push_back(kCountsPrefix);
+  prefixes.push_back(string(kReversePrefix) + kCountsPrefix);
+  return prefixes;
+}
+
+static string PartName(size_t part) {
+  return boost::lexical_cast<string>(part);
+}
+
+// Number of parts of table `prefix` in `dir`, by its index files
+static int CountParts(const string &dir, const string &prefix) {
+  int parts = 0;
+  while (access((dir + "/" + prefix + "index." + PartName(parts)).c_str(), R_OK) == 0)
+    ++parts;
+  return parts;
+}
+
+// All parts of one table of a directory, read back row by row in key
+// order. The shards of a row, found in several parts, come together.
+class TableReader : boost::noncopyable {
+ public:
+  TableReader(const string &dir, const string &prefix, int parts) : prefix_(prefix) {
+    for (int i = 0; i < parts; ++i) {
+      parts_.push_back(new PartialTTable);
+      parts_.back().Load(dir + "/" + prefix + "index." + PartName(i), dir + "/" + prefix + "entry." + PartName(i));
+      if (parts_.back().NumRows() > 0)
+        heads_.push(Head(parts_.back().RowKey(0), i));
+    }
+    cursors_.assign(parts, 0);
+    // Saved counts are stored as they are
+    if (prefix.find(kCountsPrefix) == string::npos) {
+      ifstream scales((dir + "/" + prefix + kRowScaleName).c_str());
+      WordId src;
+      double scale;
+      while (scales >> src >> scale)
+        scales_[src] = scale;
+    }
+  }
+
+  const string &Prefix() const {
+    return prefix_;
+  }
+
+  const boost::ptr_vector<PartialTTable> &Parts() const {
+    return parts_;
+  }
+
+  // Moves to the next row; returns false at the end
+  bool Next() {
+    if (heads_.empty())
+      return false;
+    key_ = heads_.top().first;
+    pieces_.clear();
+    while (!heads_.empty() && heads_.top().first == key_) {
+      const int part = heads_.top().second;
+      heads_.pop();
+      pieces_.push_back(make_pair(part, cursors_[part]));
+      if (++cursors_[part] < parts_[part].NumRows())
+        heads_.push(Head(parts_[part].RowKey(cursors_[part]), part));
+    }
+    return true;
+  }
+
+  WordId Key() const {
+    return key_;
+  }
+
+  // Number of parts holding a shard of the row
+  size_t NumPieces() const {
+    return pieces_.size();
+  }
+
+  size_t RowSize() const {
+    size_t size = 0;
+    for (size_t i = 0; i < pieces_.size(); ++i)
+      size += parts_[pieces_[i].first].RowSize(pieces_[i].second);
+    return size;
+  }
+
+  // The current row as any reader of the table sees it
+  void Read(TTableEntry *entry) {
+    parts_[pieces_[0].first].ReadRow(pieces_[0].second, entry);
+    for (size_t i = 1; i < pieces_.size(); ++i) {
+      parts_[pieces_[i].first].ReadRow(pieces_[i].second, &piece_);
+      PlusEq(piece_, *entry, &sum_);
+      swap(*entry, sum_);
+    }
+    map<WordId, double>::const_iterator scale = scales_.find(key_);
+    if (scale != scales_.end())
+      entry->Scale(scale->second);
+    else if (pieces_.size() > 1 && prefix_.find(kCountsPrefix) == string::npos)
+      LOG(FATAL) << "Row " << key_ << " of the " << prefix_ << "table is sharded but has no " << kRowScaleName;
+  }
+
+ private:
+  // Key of the current row of a part, smallest first
+  typedef pair<WordId, int> Head;
+
+  string prefix_;
+  boost::ptr_vector<PartialTTable> parts_;
+  vector<size_t> cursors_;
+  priority_queue<Head, vector<Head>, greater<Head> > heads_;
+  map<WordId, double> scales_;
+  WordId key_;
+  // Part and row of each piece of the current row
+  vector<pair<int, size_t> > pieces_;
+  TTableEntry piece_, sum_;
+};
+
+static string TableName(const string &prefix) {
+  return prefix.empty() ? "table" : prefix.substr(0, prefix.size() - 1) + " table";
+}
+
+static void PrintStats(TableReader *table, size_t longest, ostream &out) {
+  const boost::ptr_vector<PartialTTable> &parts = table->Parts();
+  out << setprecision(4) << TableName(table->Prefix()) << ":" << endl;
+  int64_t total_bytes = 0, largest_bytes = 0;
+  for (size_t p = 0; p < parts.size(); ++p) {
+    int64_t entries = 0;
+    for (size_t row = 0; row < parts[p].NumRows(); ++row)
+      entries += parts[p].RowSize(row);
+    const int64_t bytes = parts[p].NumRows() * sizeof(IndexRecord) + entries * sizeof(EntryRecord);
+    out << "  part " << p << ": " << parts[p].NumRows() << " rows, " << entries << " entries, " << bytes
+        << " bytes" << endl;
+    total_bytes += bytes;
+    largest_bytes = max(largest_bytes, bytes);
+  }
+  out << "  largest part " << (total_bytes ? static_cast<double>(largest_bytes) * parts.size() / total_bytes : 1)
+      << " times the mean" << endl;
+
+  // Rows by the power of two below their length, and the longest ones
+  vector<pair<int64_t, int64_t> > histogram;
+  typedef pair<size_t, WordId> Row;
+  priority_queue<Row, vector<Row>, greater<Row> > heavy;
+  int64_t rows = 0, entries = 0, sharded = 0;
+  while (table->Next()) {
+    const size_t size = table->RowSize();
+    size_t bucket = 0;
+    while ((static_cast<size_t>(2) << bucket) <= size)
+      ++bucket;
+    if (size > 0 && histogram.size() <= bucket + 1)
+      histogram.resize(bucket + 2);
+    if (histogram.empty())
+      histogram.resize(1);
+    pair<int64_t, int64_t> &h = histogram[size == 0 ? 0 : bucket + 1];
+    ++h.first;
+    h.second += size;
+    ++rows;
+    entries += size;
+    heavy.push(Row(size, table->Key()));
+    if (heavy.size() > longest)
+      heavy.pop();
+    sharded += table->NumPieces() > 1;
+  }
+  out << "  " << rows << " rows (" << sharded << " sharded), " << entries << " entries, " << total_bytes
+      << " bytes = " << total_bytes / 1048576.0 << " MB" << endl
+      << "  row lengths:" << endl;
+  for (size_t i = 0; i < histogram.size(); ++i) {
+    if (histogram[i].first == 0)
+      continue;
+    const size_t low = i == 0 ? 0 : static_cast<size_t>(1) << (i - 1);
+    out << "    " << low;
+    if (i > 1)
+      out << '-' << 2 * low - 1;
+    out << ": " << histogram[i].first << " rows, " << histogram[i].second << " entries" << endl;
+  }
+  vector<Row> longest_rows;
+  for (; !heavy.empty(); heavy.pop())
+    longest_rows.push_back(heavy.top());
+  out << "  longest rows:" << endl;
+  for (size_t i = longest_rows.size(); i-- > 0;)
+    out << "    " << longest_rows[i].second << ": " << longest_rows[i].first << " entries ("
+        << 100.0 * longest_rows[i].first / max<int64_t>(entries, 1) << "%)" << endl;
+}
+
+// Writes `entry` to the part(s) `map` gives row `src`
+static void WriteRow(const PartitionMap &map, WordId src, const TTableEntry &entry,
+                     boost::ptr_vector<TTableWriter> *writers, TTableEntry *shard) {
+  if (!map.Sharded(src) || entry.Empty()) {
+    (*writers)[map.Part(src)].Write(src, entry);
+    return;
+  }
+  for (size_t begin = 0, end; begin < entry.Size(); begin = end) {
+    const size_t s = map.ShardOf(src, entry[begin].k);
+    for (end = begin + 1; end < entry.Size() && map.ShardOf(src, entry[end].k) == s; ++end) {
+    }
+    shard->Assign(&entry[begin], &entry[begin] + (end - begin));
+    (*writers)[map.GetShard(s).part].Write(src, *shard);
+  }
+}
+
+static void Repartition(TableReader *table, const PartitionMap &map, const string &out_dir) {
+  boost::ptr_vector<TTableWriter> writers;
+  for (int p = 0; p < map.Parts(); ++p)
+    writers.push_back(new TTableWriter(out_dir, PartName(p), table->Prefix()));
+  TTableEntry entry, shard;
+  size_t rows = 0;
+  while (table->Next()) {
+    table->Read(&entry);
+    WriteRow(map, table->Key(), entry, &writers, &shard);
+    ++rows;
+  }
+  for (size_t p = 0; p < writers.size(); ++p)
+    writers[p].WriteIndex();
+  if (table->Prefix().find(kCountsPrefix) == string::npos)
+    WriteUnitRowScales(map, out_dir, table->Prefix());
+  LOG(INFO) << "Wrote " << rows << " rows of the " << TableName(table->Prefix()) << " in " << map.Parts()
+            << " parts to " << out_dir;
+}
+
+static void Usage(const char *prog) {
+  cerr << "Usage: " << prog << " stats [-k ROWS] DIR" << endl
+       << "       " << prog << " repartition -n PARTS [-m MAP] DIR OUT_DIR" << endl
+       << "       " << prog << " merge DIR OUT_DIR" << endl;
+  exit(1);
+}
+} // namespace paralign
+
+using namespace paralign;
+
+int main(int argc, char *argv[]) {
+  if (argc < 2)
+    Usage(argv[0]);
+  const string command = argv[1];
+  int parts = command == "merge" ? 1 : 0, longest = 10;
+  string map_path;
+  int c;
+  // Options follow the command
+  --argc;
+  ++argv;
+  while ((c = getopt(argc, argv, "k:n:m:")) != -1) {
+    switch (c) {
+      case 'k': longest = atoi(optarg); break;
+      case 'n': parts = atoi(optarg); break;
+      case 'm': map_path = optarg; break;
+      default: Usage(argv[-1]);
+    }
+  }
+  const bool stats = command == "stats";
+  if ((!stats && command != "repartition" && command != "merge") || argc - optind != (stats ? 1 : 2) ||
+      (!stats && (parts <= 0 || parts > 32767)) || longest < 0)
+    Usage(argv[-1]);
+  const string dir = argv[optind];
+
+  const int in_parts = CountParts(dir, "");
+  if (in_parts == 0)
+    LOG(FATAL) << "No translation table in " << dir;
+  PartitionMap in_map(in_parts);
+  if (in_map.Load(dir + "/" + kPartitionMapName) && in_map.Parts() != in_parts)
+    LOG(FATAL) << "Partition map of " << dir << " is for " << in_map.Parts() << " parts, not " << in_parts;
+
+  PartitionMap out_map(parts);
+  string out_dir;
+  if (!stats) {
+    out_dir = argv[optind + 1];
+    if (!map_path.empty() && (!out_map.Load(map_path) || out_map.Parts() != parts))
+      LOG(FATAL) << "Cannot read a partition map for " << parts << " parts from " << map_path;
+  }
+
+  const vector<string> prefixes = TablePrefixes();
+  for (size_t i = 0; i < prefixes.size(); ++i) {
+    const int n = CountParts(dir, prefixes[i]);
+    if (n == 0)
+      continue;
+    if (n != in_parts)
+      LOG(FATAL) << "The " << TableName(prefixes[i]) << " of " << dir << " has " << n << " parts, not " << in_parts;
+    TableReader table(dir, prefixes[i], n);
+    if (stats)
+      PrintStats(&table, longest, cout);
+    else
+      Repartition(&table, out_map, out_dir);
+  }
+  if (!map_path.empty()) {
+    FileOutputStream out(out_dir, kPartitionMapName);
+    out_map.Write(out);
+  }
+  return 0;
+}
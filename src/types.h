@@ -32,6 +32,18 @@ inline double DoubleFromInt64(int64_t v) {
   return w.d;
 }
 
+inline int32_t FloatAsInt32(float v) {
+  union { int32_t i; float f; } w;
+  w.f = v;
+  return w.i;
+}
+
+inline float FloatFromInt32(int32_t v) {
+  union { int32_t i; float f; } w;
+  w.i = v;
+  return w.f;
+}
+
 }      // namespace paralign
 
 #endif  // _PARALIGN_TYPES_H_
@@ -4,11 +4,12 @@
 #include <vector>
 #include <boost/foreach.hpp>
 
+#include "counters.h"
 #include "io.h"
 #include "options.h"
 #include "ttable.h"
 #include "types.h"
-#include "contrib/da.h"
+#include "viterbi.h"
 
 using namespace std;
 
@@ -16,65 +17,68 @@ namespace paralign {
 
 class Viterbi {
  public:
-  Viterbi(const Options &opts, const TTable &table, MapperSource *input, ViterbiSink *output)
-      : opts_(opts), tbl_(table), in_(input), out_(output) {}
+  Viterbi(const Options &opts, const TTable &table, MapperSource *input, ViterbiSink *output,
+          TaskCounters *counters)
+      : aligner_(opts, table), reverse_(opts.reverse), in_(input), out_(output), counters_(counters),
+        parse_time_(counters->Timer("parse")), align_time_(counters->Timer("align")) {}
 
   void Run() {
     size_t id;
     vector<WordId> src, tgt;
-    for (; !in_->Done(); in_->Next()) {
-      in_->Read(&id, &src, &tgt);
-      if (opts_.reverse) swap(src, tgt);
-      Map(id, src, tgt);
+    vector<SentSzPair> al;
+    ViterbiAligner::Scratch scratch(aligner_);
+    int64_t sentences = 0;
+    for (; !in_->Done(); Next()) {
+      Read(&id, &src, &tgt);
+      if (reverse_) swap(src, tgt);
+      {
+        PhaseTimer timer(align_time_);
+        aligner_.Align(src, tgt, &scratch, &al);
+      }
+      out_->WriteAlignment(id, al.begin(), al.end());
+      counters_->Progress(++sentences, "sentences");
     }
+    counters_->Add("sentences", sentences);
   }
 
- private:
-  // FIXME: a lot of duplicate code (vs mapper.cc)
-  void Map(size_t id, const vector<WordId> &src, const vector<WordId> &tgt) {
-    vector<SentSzPair> al;
-    for (size_t j = 0; j < tgt.size(); ++j) {
-      const WordId f_j = tgt[j];
-      double prob_a_i = 1.0 / (src.size() + !opts_.no_null_word);  // uniform (model 1)
-      WordId max_i = 0;
-      double max_p = -1;
-      int max_index = -1;
-      // Null
-      if (!opts_.no_null_word) {
-        max_i = kNull;
-        max_index = 0;
-        if (opts_.favor_diagonal) prob_a_i = opts_.prob_align_null;
-        max_p = tbl_.Query(kNull, f_j) * prob_a_i;
-      }
-      // Non-null
-      double az = 0;
-      if (opts_.favor_diagonal)
-        az = DiagonalAlignment::ComputeZ(j+1, tgt.size(), src.size(), opts_.diagonal_tension) / (1 - opts_.prob_align_null);
-      for (unsigned i = 1; i <= src.size(); ++i) {
-        if (opts_.favor_diagonal)
-          prob_a_i = DiagonalAlignment::UnnormalizedProb(j + 1, i, tgt.size(), src.size(), opts_.diagonal_tension) / az;
-        double prob = tbl_.Query(src[i-1], f_j) * prob_a_i;
-        if (prob > max_p) {
-          max_index = i;
-          max_p = prob;
-          max_i = src[i-1];
-        }
-      }
-      // Alignment point
-      if (max_index > 0) {
-        if (opts_.reverse)
-          al.push_back(MkSzPair(j, max_index - 1));
-        else
-          al.push_back(MkSzPair(max_index - 1, j));
+  // Aligns in both directions, the reverse one with `reverse_aligner`
+  void RunBidirectional(const ViterbiAligner &reverse_aligner) {
+    size_t id;
+    vector<WordId> src, tgt;
+    vector<SentSzPair> fa, ra;
+    ViterbiAligner::Scratch scratch(aligner_), reverse_scratch(reverse_aligner);
+    int64_t sentences = 0;
+    for (; !in_->Done(); Next()) {
+      Read(&id, &src, &tgt);
+      {
+        PhaseTimer timer(align_time_);
+        aligner_.Align(src, tgt, &scratch, &fa);
+        reverse_aligner.Align(tgt, src, &reverse_scratch, &ra);
       }
+      out_->WriteAlignments(id, fa.begin(), fa.end(), ra.begin(), ra.end());
+      counters_->Progress(++sentences, "sentences");
     }
-    out_->WriteAlignment(id, al.begin(), al.end());
+    counters_->Add("sentences", sentences);
+  }
+
+ private:
+  // Reading lines and parsing them both count as the parse phase
+  void Read(size_t *id, vector<WordId> *src, vector<WordId> *tgt) {
+    PhaseTimer timer(parse_time_);
+    in_->Read(id, src, tgt);
   }
 
-  const Options opts_;
-  const TTable &tbl_;
+  void Next() {
+    PhaseTimer timer(parse_time_);
+    in_->Next();
+  }
+
+  const ViterbiAligner aligner_;
+  const bool reverse_;
   MapperSource *in_;
   ViterbiSink *out_;
+  TaskCounters *counters_;
+  double *parse_time_, *align_time_;
 };
 } // namespace paralign
 
@@ -87,10 +91,19 @@ int main() {
             << opts << endl;
 
   TTable table(opts.ttable_dir, opts.ttable_parts);
+  TaskCounters counters("viterbi", opts.counters);
+  counters.CountBytes(&cin, &cout);
   MapperSource input(cin);
   ViterbiSink output(cout);
 
-  Viterbi(opts, table, &input, &output).Run();
+  if (opts.bidirectional) {
+    TTable reverse_table(opts.ttable_dir, opts.ttable_parts, kReversePrefix);
+    ViterbiAligner reverse_aligner(opts.Reversed(), reverse_table);
+    Viterbi(opts, table, &input, &output, &counters).RunBidirectional(reverse_aligner);
+  } else {
+    Viterbi(opts, table, &input, &output, &counters).Run();
+  }
+  counters.Report();
 
   return 0;
 }
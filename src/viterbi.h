@@ -0,0 +1,72 @@
+#ifndef _PARALIGN_VITERBI_H_
+#define _PARALIGN_VITERBI_H_
+
+#include <vector>
+
+#include "estep.h"
+#include "options.h"
+#include "ttable.h"
+#include "types.h"
+
+namespace paralign {
+// Finds the most probable alignment point for each target word. Holds
+// no state besides the model, so it can be shared between threads; each
+// thread passes its own `Scratch`.
+class ViterbiAligner {
+ public:
+  ViterbiAligner(const Options &opts, const TTable &table)
+      : opts_(opts), tbl_(table), align_(SelectAlign(opts)) {}
+
+  // Buffers reused from sentence to sentence by one thread's alignments
+  // with `aligner`
+  class Scratch {
+   public:
+    explicit Scratch(const ViterbiAligner &aligner) : priors_(aligner.opts_, false) {}
+
+   private:
+    friend class ViterbiAligner;
+
+    CellPriors priors_;
+    std::vector<double> probs_;
+  };
+
+  // `src` and `tgt` are already swapped when `opts.reverse` is set;
+  // alignment points are always written as (source side in the input,
+  // target side in the input).
+  void Align(const std::vector<WordId> &src, const std::vector<WordId> &tgt, Scratch *scratch,
+             std::vector<SentSzPair> *al) const {
+    (this->*align_)(src, tgt, scratch, al);
+  }
+
+ private:
+  typedef void (ViterbiAligner::*AlignFunction)(const std::vector<WordId> &, const std::vector<WordId> &,
+                                                 Scratch *, std::vector<SentSzPair> *) const;
+
+  static AlignFunction SelectAlign(const Options &opts) {
+    if (opts.no_null_word)
+      return opts.favor_diagonal ? &ViterbiAligner::AlignWith<false, true> : &ViterbiAligner::AlignWith<false, false>;
+    return opts.favor_diagonal ? &ViterbiAligner::AlignWith<true, true> : &ViterbiAligner::AlignWith<true, false>;
+  }
+
+  template <bool kNullWord, bool kDiagonal>
+  void AlignWith(const std::vector<WordId> &src, const std::vector<WordId> &tgt, Scratch *scratch,
+                 std::vector<SentSzPair> *al) const {
+    typedef LinkKernel<kNullWord, kDiagonal> Kernel;
+    al->clear();
+    CellPriors &priors = scratch->priors_;
+    std::vector<double> &probs = scratch->probs_;
+    priors.Set(tgt.size(), src.size(), opts_.diagonal_tension);
+    probs.resize(src.size() + 1);
+    for (size_t j = 0; j < tgt.size(); ++j) {
+      Kernel::Joint(tbl_, tgt[j], src, priors.Prior(j), opts_.prob_align_null, &probs[0]);
+      AddAlignmentPoint(j, Kernel::Best(&probs[0], src.size()), opts_.reverse, al);
+    }
+  }
+
+  const Options opts_;
+  const TTable &tbl_;
+  const AlignFunction align_;
+};
+} // namespace paralign
+
+#endif  // _PARALIGN_VITERBI_H_